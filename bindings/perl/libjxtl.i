@@ -11,11 +11,13 @@
 %include "template.i"
 
 /**
- * Convert an XML file to a hash.
+ * Convert an XML file to a hash.  The file is parsed once and reused until it
+ * changes.
  */
 SV *xml_to_hash( const char *xml_file );
 
 /**
- * Convert a JSON file to a hash.
+ * Convert a JSON file to a hash.  The file is parsed once and reused until it
+ * changes.
  */
 SV *json_to_hash( const char *json_file );
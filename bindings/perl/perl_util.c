@@ -14,8 +14,12 @@
 #include "json_writer.h"
 #include "json.h"
 #include "jxtl.h"
+#include "jxtl_data_cache.h"
 #include "xml2json.h"
 
+/** The most bytes of files xml_to_hash and json_to_hash keep loaded. */
+#define DATA_CACHE_BUDGET ( 64 * 1024 * 1024 )
+
 static void perl_hash_to_json( SV *input, json_writer_t *writer );
 static void perl_array_to_json( SV *input, json_writer_t *writer );
 
@@ -146,7 +150,7 @@ json_t *perl_variable_to_json( apr_pool_t *mp, SV *input )
   return json;
 }
 
-SV *json_to_perl_variable( json_t *json )
+static SV *json_to_perl_variable_internal( apr_pool_t *mp, json_t *json )
 {
   json_t *tmp_json;
   apr_array_header_t *arr;
@@ -157,7 +161,11 @@ SV *json_to_perl_variable( json_t *json )
 
   switch ( json->type ) {
   case JSON_STRING:
-    return newSVpv( json->value.string, 0 );
+    if ( JSON_IS_COMPRESSED_STRING( json ) ) {
+      return newSVpv( json_get_string_value( mp, json ),
+                      JSON_STRING_LENGTH( json ) );
+    }
+    return newSVpv( JSON_STRING_VALUE( json ), json->len );
     break;
 
   case JSON_INTEGER:
@@ -170,12 +178,12 @@ SV *json_to_perl_variable( json_t *json )
 
   case JSON_OBJECT:
     hash = newHV();
-    for ( idx = apr_hash_first( NULL, json->value.object ); idx;
+    for ( idx = apr_hash_first( mp, json->value.object ); idx;
           idx = apr_hash_next( idx ) ) {
       apr_hash_this( idx, NULL, NULL, (void **) &tmp_json );
       (void) hv_store( hash, JSON_NAME( tmp_json ),
                        strlen( JSON_NAME( tmp_json ) ),
-                       json_to_perl_variable( tmp_json ), 0 );
+                       json_to_perl_variable_internal( mp, tmp_json ), 0 );
     }
     return newRV_noinc( (SV*) hash);
     break;
@@ -185,7 +193,7 @@ SV *json_to_perl_variable( json_t *json )
     p_array = newAV();
     for ( i = 0; arr && i < arr->nelts; i++ ) {
       tmp_json = APR_ARRAY_IDX( arr, i, json_t * );
-      av_push( p_array, json_to_perl_variable( tmp_json ) );
+      av_push( p_array, json_to_perl_variable_internal( mp, tmp_json ) );
     }
     return newRV_noinc( (SV*) p_array);
     break;
@@ -204,44 +212,64 @@ SV *json_to_perl_variable( json_t *json )
   }
 }
 
-SV *xml_to_hash( const char *xml_file )
+/*
+ * Objects are iterated with iterators from a pool of our own rather than the
+ * one inside each hash, so that other threads can read the same tree.
+ */
+SV *json_to_perl_variable( json_t *json )
 {
   apr_pool_t *tmp_mp;
-  apr_file_t *file;
-  json_t *json;
-  SV *hash = &PL_sv_undef;
+  SV *result;
 
   apr_pool_create( &tmp_mp, NULL );
-  apr_file_open( &file, xml_file, APR_READ | APR_BUFFERED, 0, tmp_mp );
-  xml_to_json( tmp_mp, file, 1, &json );
-  if ( json ) {
-    hash = json_to_perl_variable( json );
-  }
+  result = json_to_perl_variable_internal( tmp_mp, json );
   apr_pool_destroy( tmp_mp );
 
-  return hash;
-} 
+  return result;
+}
 
-SV *json_to_hash( const char *json_file )
+/**
+ * Dictionaries loaded by xml_to_hash and json_to_hash, so that loading the
+ * same file again only converts it.
+ */
+static jxtl_data_cache_t *data_cache = NULL;
+
+static jxtl_data_cache_t *get_data_cache( void )
+{
+  apr_pool_t *mp;
+
+  if ( !data_cache ) {
+    apr_pool_create( &mp, NULL );
+    data_cache = jxtl_data_cache_create( mp, DATA_CACHE_BUDGET, 0 );
+  }
+
+  return data_cache;
+}
+
+static SV *doc_to_hash( json_doc_t *doc )
 {
-  apr_pool_t *tmp_mp;
-  apr_file_t *in_file;
-  json_t *json;
   SV *hash = &PL_sv_undef;
-  parser_t *json_parser;
 
-  apr_pool_create( &tmp_mp, NULL );
-  json_parser = json_parser_create( tmp_mp );
-  if ( open_apr_input_file( tmp_mp, json_file, &in_file ) &&
-       json_parser_parse_file_to_obj( tmp_mp, json_parser, in_file,
-                                      &json ) ) {
-    hash = json_to_perl_variable( json );
+  if ( doc ) {
+    hash = json_to_perl_variable( JSON_DOC_ROOT( doc ) );
+    json_doc_release( doc );
   }
-  apr_pool_destroy( tmp_mp );
 
   return hash;
 }
 
+SV *xml_to_hash( const char *xml_file )
+{
+  return doc_to_hash( jxtl_data_cache_get_xml( get_data_cache(), xml_file,
+                                               1 ) );
+}
+
+SV *json_to_hash( const char *json_file )
+{
+  return doc_to_hash( jxtl_data_cache_get_json( get_data_cache(),
+                                                json_file ) );
+}
+
 SV *verify_perl_function( SV *func )
 {
   SV *func_ptr = NULL;
@@ -11,11 +11,13 @@
 %include "template.i"
 
 /**
- * Convert an XML file to a dictionary type.
+ * Convert an XML file to a dictionary type.  The file is parsed once and
+ * reused until it changes.
  */
 PyObject *xml_to_dict( const char *xml_file );
 
 /**
- * Convert a JSON file to a dictionary type.
+ * Convert a JSON file to a dictionary type.  The file is parsed once and
+ * reused until it changes.
  */
 PyObject *json_to_dict( const char *json_file );
@@ -4,6 +4,7 @@
 #include "apr_macros.h"
 #include "json.h"
 #include "json_writer.h"
+#include "jxtl_data_cache.h"
 #include "misc.h"
 #include "xml2json.h"
 #include "py_util.h"
@@ -25,6 +26,9 @@
 #define Py_RETURN_NONE return Py_INCREF(Py_None), Py_None
 #endif
 
+/** The most bytes of files xml_to_dict and json_to_dict keep loaded. */
+#define DATA_CACHE_BUDGET ( 64 * 1024 * 1024 )
+
 #ifndef PyDict_CheckExact
 #define PyDict_CheckExact(op) ((op)->ob_type == &PyDict_Type)
 #endif
@@ -142,7 +146,7 @@ json_t *py_variable_to_json( apr_pool_t *mp, PyObject *obj )
 
 }
 
-PyObject *json_to_py_variable( json_t *json )
+static PyObject *json_to_py_variable_internal( apr_pool_t *mp, json_t *json )
 {
   json_t *tmp_json;
   apr_array_header_t *arr;
@@ -153,7 +157,12 @@ PyObject *json_to_py_variable( json_t *json )
 
   switch ( json->type ) {
   case JSON_STRING:
-    return PyString_FromString( (char *) json->value.string );
+    if ( JSON_IS_COMPRESSED_STRING( json ) ) {
+      return PyString_FromStringAndSize( json_get_string_value( mp, json ),
+                                         JSON_STRING_LENGTH( json ) );
+    }
+    return PyString_FromStringAndSize( JSON_STRING_VALUE( json ),
+                                       json->len );
     break;
 
   case JSON_INTEGER:
@@ -166,11 +175,11 @@ PyObject *json_to_py_variable( json_t *json )
 
   case JSON_OBJECT:
     py_dict = PyDict_New();
-    for ( idx = apr_hash_first( NULL, json->value.object ); idx;
+    for ( idx = apr_hash_first( mp, json->value.object ); idx;
           idx = apr_hash_next( idx ) ) {
       apr_hash_this( idx, NULL, NULL, (void **) &tmp_json );
       PyDict_SetItemString( py_dict, (char *) JSON_NAME( tmp_json ),
-                            json_to_py_variable( tmp_json ) );
+                            json_to_py_variable_internal( mp, tmp_json ) );
     }
     return py_dict;
     break;
@@ -180,7 +189,8 @@ PyObject *json_to_py_variable( json_t *json )
     py_list = PyList_New( arr->nelts );
     for ( i = 0; arr && i < arr->nelts; i++ ) {
       tmp_json = APR_ARRAY_IDX( arr, i, json_t * );
-      PyList_SET_ITEM( py_list, i, json_to_py_variable( tmp_json ) );
+      PyList_SET_ITEM( py_list, i,
+                       json_to_py_variable_internal( mp, tmp_json ) );
     }
     return py_list;
     break;
@@ -204,46 +214,49 @@ PyObject *json_to_py_variable( json_t *json )
   }
 }
 
-PyObject *xml_to_dict( const char *xml_file )
+/*
+ * Objects are iterated with iterators from a pool of our own rather than the
+ * one inside each hash, so that other threads can read the same tree.
+ */
+PyObject *json_to_py_variable( json_t *json )
 {
   apr_pool_t *tmp_mp;
-  apr_file_t *file;
-  json_t *json;
-  PyObject *dict = NULL;
+  PyObject *result;
 
   apr_pool_create( &tmp_mp, NULL );
-  apr_file_open( &file, xml_file, APR_READ | APR_BUFFERED, 0, tmp_mp );
-  xml_to_json( tmp_mp, file, 1, &json );
-  if ( json ) {
-    dict = json_to_py_variable( json );
-  }
+  result = json_to_py_variable_internal( tmp_mp, json );
   apr_pool_destroy( tmp_mp );
-  
-  if ( dict ) {
-    return dict;
-  }
-  else {
-    Py_RETURN_NONE;
+
+  return result;
+}
+
+/**
+ * Dictionaries loaded by xml_to_dict and json_to_dict, so that loading the
+ * same file again only converts it.
+ */
+static jxtl_data_cache_t *data_cache = NULL;
+
+static jxtl_data_cache_t *get_data_cache( void )
+{
+  apr_pool_t *mp;
+
+  if ( !data_cache ) {
+    apr_pool_create( &mp, NULL );
+    data_cache = jxtl_data_cache_create( mp, DATA_CACHE_BUDGET, 0 );
   }
+
+  return data_cache;
 }
 
-PyObject *json_to_dict( const char *json_file )
+static PyObject *doc_to_dict( json_doc_t *doc )
 {
-  apr_pool_t *tmp_mp;
-  apr_file_t *in_file;
-  json_t *json;
   PyObject *dict = NULL;
-  parser_t *json_parser;
 
-  apr_pool_create( &tmp_mp, NULL );
-  json_parser = json_parser_create( tmp_mp );
-  if ( open_apr_input_file( tmp_mp, json_file, &in_file ) &&
-       json_parser_parse_file_to_obj( tmp_mp, json_parser, in_file,
-                                      &json ) ) {
-    dict = json_to_py_variable( json );
+  if ( doc ) {
+    dict = json_to_py_variable( JSON_DOC_ROOT( doc ) );
+    json_doc_release( doc );
   }
-  apr_pool_destroy( tmp_mp );
-  
+
   if ( dict ) {
     return dict;
   }
@@ -252,6 +265,18 @@ PyObject *json_to_dict( const char *json_file )
   }
 }
 
+PyObject *xml_to_dict( const char *xml_file )
+{
+  return doc_to_dict( jxtl_data_cache_get_xml( get_data_cache(), xml_file,
+                                               1 ) );
+}
+
+PyObject *json_to_dict( const char *json_file )
+{
+  return doc_to_dict( jxtl_data_cache_get_json( get_data_cache(),
+                                                json_file ) );
+}
+
 PyObject *verify_python_function( PyObject *func )
 {
   return PyCallable_Check( func ) ? func : NULL;
@@ -2,7 +2,7 @@
  * json.c
  *
  * Description
- *   Functions for creating and dumping JSON.
+ *   Functions for creating and sharing JSON.
  *
  * Copyright 2010 Dan Rinehimer
  *
@@ -20,6 +20,7 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <apr_hash.h>
 #include <apr_pools.h>
 #include <apr_strings.h>
@@ -29,87 +30,220 @@
 
 #include "json.h"
 
+#include "json_compress.h"
 #include "json_parse.h"
 #include "json_lex.h"
+#include "json_number.h"
+#include "json_slab.h"
 #include "json_writer.h"
+#include "str_buf.h"
 #include "utf.h"
 
-#define JSON_CREATE( mp, json )                                    \
-  json = apr_palloc( mp, sizeof(json_t) );                         \
+/**
+ * Allocate a node out of slab, or out of mp if there is no slab.
+ */
+static json_t *json_alloc( apr_pool_t *mp, json_slab_t *slab )
+{
+  return ( slab ) ? json_slab_alloc_node( slab ) :
+                    apr_palloc( mp, sizeof(json_t) );
+}
+
+/**
+ * Copy a string out of slab, or out of mp if there is no slab.
+ */
+static char *json_strmemdup( apr_pool_t *mp, json_slab_t *slab,
+                             const char *str, int len )
+{
+  char *new_str;
+
+  if ( !slab )
+    return apr_pstrmemdup( mp, str, len );
+
+  new_str = json_slab_alloc_string( slab, len + 1 );
+  memcpy( new_str, str, len );
+  new_str[len] = '\0';
+
+  return new_str;
+}
+
+#define JSON_CREATE( mp, slab, json )                              \
+  json = json_alloc( mp, slab );                                   \
   json->name = NULL;                                               \
-  json->parent = NULL
+  json->len = 0
 
-json_t *json_create_strn( apr_pool_t *mp, const char *str, int len )
+/**
+ * Store str compressed in json if strings created in mp are compressed and
+ * it is big enough.
+ * @return TRUE if the string was stored.
+ */
+static int json_compress_string( apr_pool_t *mp, json_slab_t *slab,
+                                 json_t *json, const char *str, int len )
+{
+  apr_size_t min_size;
+  apr_size_t size = 0;
+  char *block;
+
+  if ( ( len < JSON_COMPRESS_MIN_SIZE ) ||
+       !( min_size = json_compress_get( mp ) ) || ( len < min_size ) )
+    return FALSE;
+
+  block = malloc( json_compress_bound( len ) );
+  if ( block && ( size = json_compress( mp, block, str, len ) ) ) {
+    json->value.string = json_strmemdup( mp, slab, block, size );
+    json->len = -len;
+  }
+  free( block );
+
+  return ( size > 0 );
+}
+
+json_t *json_create_strn_slab( apr_pool_t *mp, json_slab_t *slab,
+                               const char *str, int len )
 {
   json_t *json;
-  JSON_CREATE( mp, json );
-  json->value.string = apr_pstrndup( mp, str, len );
+
+  JSON_CREATE( mp, slab, json );
+  json->len = len;
+  if ( JSON_IS_INLINE_STRING( json ) ) {
+    memcpy( json->value.inline_string, str, len );
+    json->value.inline_string[len] = '\0';
+  }
+  else if ( !json_compress_string( mp, slab, json, str, len ) ) {
+    json->value.string = json_strmemdup( mp, slab, str, len );
+  }
   json->type = JSON_STRING;
   return json;
 }
 
+json_t *json_create_strn( apr_pool_t *mp, const char *str, int len )
+{
+  return json_create_strn_slab( mp, json_slab_get( mp ), str, len );
+}
+
 json_t *json_create_str( apr_pool_t *mp, const char *str )
 {
   return json_create_strn( mp, str, strlen( str ) );
 }
 
-json_t *json_create_integer( apr_pool_t *mp, int integer )
+json_t *json_create_integer_slab( apr_pool_t *mp, json_slab_t *slab,
+                                  int integer )
 {
   json_t *json;
-  JSON_CREATE( mp, json );
+  JSON_CREATE( mp, slab, json );
   json->value.integer = integer;
   json->type = JSON_INTEGER;
   return json;
 }
 
-json_t *json_create_number( apr_pool_t *mp, double number )
+json_t *json_create_integer( apr_pool_t *mp, int integer )
+{
+  return json_create_integer_slab( mp, json_slab_get( mp ), integer );
+}
+
+json_t *json_create_number_slab( apr_pool_t *mp, json_slab_t *slab,
+                                 double number )
 {
   json_t *json;
-  JSON_CREATE( mp, json );
+  JSON_CREATE( mp, slab, json );
   json->value.number = number;
   json->type = JSON_NUMBER;
   return json;
 }
 
-json_t *json_create_object( apr_pool_t *mp )
+json_t *json_create_number( apr_pool_t *mp, double number )
+{
+  return json_create_number_slab( mp, json_slab_get( mp ), number );
+}
+
+json_t *json_create_number_lexeme_slab( apr_pool_t *mp, json_slab_t *slab,
+                                        const char *text, int len )
+{
+  json_t *json;
+
+  JSON_CREATE( mp, slab, json );
+  json->value.lexeme.text = json_strmemdup( mp, slab, text, len );
+  json->len = len;
+
+  /* Only numbers with a fraction or an exponent need to be doubles. */
+  if ( strpbrk( json->value.lexeme.text, ".eE" ) ) {
+    json->value.number = strtod( json->value.lexeme.text, NULL );
+    json->type = JSON_NUMBER;
+  }
+  else {
+    json->value.integer = strtol( json->value.lexeme.text, NULL, 10 );
+    json->type = JSON_INTEGER;
+  }
+
+  return json;
+}
+
+json_t *json_create_number_lexeme( apr_pool_t *mp, const char *text,
+                                   int len )
+{
+  return json_create_number_lexeme_slab( mp, json_slab_get( mp ), text,
+                                         len );
+}
+
+json_t *json_create_object_slab( apr_pool_t *mp, json_slab_t *slab )
 {
   json_t *json;
 
-  JSON_CREATE( mp, json );
+  JSON_CREATE( mp, slab, json );
   json->value.object = apr_hash_make( mp );
   json->type = JSON_OBJECT;
   return json;
 }
 
-json_t *json_create_array( apr_pool_t *mp )
+json_t *json_create_object( apr_pool_t *mp )
+{
+  return json_create_object_slab( mp, json_slab_get( mp ) );
+}
+
+json_t *json_create_array_slab( apr_pool_t *mp, json_slab_t *slab )
 {
   json_t *json;
-  JSON_CREATE( mp, json );
+  JSON_CREATE( mp, slab, json );
   json->value.array = apr_array_make( mp, 8, sizeof(json_t *) );
   json->type = JSON_ARRAY;
   return json;
 }
 
-json_t *json_create_boolean( apr_pool_t *mp, int boolean )
+json_t *json_create_array( apr_pool_t *mp )
+{
+  return json_create_array_slab( mp, json_slab_get( mp ) );
+}
+
+json_t *json_create_boolean_slab( apr_pool_t *mp, json_slab_t *slab,
+                                  int boolean )
 {
   json_t *json;
-  JSON_CREATE( mp, json );
+  JSON_CREATE( mp, slab, json );
   json->value.boolean = boolean;
   json->type = JSON_BOOLEAN;
   return json;
 }
 
-json_t *json_create_null( apr_pool_t *mp )
+json_t *json_create_boolean( apr_pool_t *mp, int boolean )
+{
+  return json_create_boolean_slab( mp, json_slab_get( mp ), boolean );
+}
+
+json_t *json_create_null_slab( apr_pool_t *mp, json_slab_t *slab )
 {
   json_t *json;
-  JSON_CREATE( mp, json );
+  JSON_CREATE( mp, slab, json );
   json->type = JSON_NULL;
   return json;
 }
 
+json_t *json_create_null( apr_pool_t *mp )
+{
+  return json_create_null_slab( mp, json_slab_get( mp ) );
+}
+
 static void initialize_callbacks( apr_pool_t *json_mp, apr_pool_t *tmp_mp,
                                   json_callback_t *callback_data, 
-                                  json_writer_t *writer )
+                                  json_writer_t *writer, int flags )
 {
   callback_data->object_start_handler = json_writer_start_object;
   callback_data->object_end_handler = json_writer_end_object;
@@ -120,6 +254,10 @@ static void initialize_callbacks( apr_pool_t *json_mp, apr_pool_t *tmp_mp,
   callback_data->string_handler = json_writer_write_str;
   callback_data->integer_handler = json_writer_write_integer;
   callback_data->number_handler = json_writer_write_number;
+  callback_data->number_lexeme_handler = NULL;
+  if ( flags & JSON_PARSER_RAW_NUMBERS ) {
+    callback_data->number_lexeme_handler = json_writer_write_number_lexeme;
+  }
   callback_data->boolean_handler = json_writer_write_boolean;
   callback_data->null_handler = json_writer_write_null;
   callback_data->user_data = writer;
@@ -140,7 +278,8 @@ static int parse_file_or_buffer( apr_pool_t *mp, parser_t *parser,
   apr_pool_create( &tmp_mp, NULL );
   writer = json_writer_create( tmp_mp, mp );
 
-  initialize_callbacks( mp, tmp_mp, &callback_data, writer );
+  initialize_callbacks( mp, tmp_mp, &callback_data, writer,
+                        parser_get_flags( parser ) );
 
   *obj = NULL;
   if ( parse_func( parser, file_or_buf, &callback_data ) ) {
@@ -166,163 +305,438 @@ int json_parser_parse_buffer_to_obj( apr_pool_t *mp, parser_t *parser,
                                json_parser_parse_buffer, obj );
 }
 
-static void print_spaces( apr_file_t *out, int num )
+/*
+ * State used while sharing a tree.  The lookup tables and their keys live in
+ * a temporary pool so that only the shared nodes end up in the destination
+ * pool.
+ */
+typedef struct json_share_t {
+  apr_pool_t *mp;
+  apr_pool_t *tmp_mp;
+  apr_hash_t *strings;
+  /** Compressed strings, by their block. */
+  apr_hash_t *blocks;
+  apr_hash_t *nodes;
+  str_buf_t *key;
+} json_share_t;
+
+static char *share_string( json_share_t *share, const char *str )
 {
-  while ( num-- > 0 ) {
-    apr_file_printf( out,  " " );
+  char *shared_str;
+
+  if ( !str )
+    return NULL;
+
+  shared_str = apr_hash_get( share->strings, str, APR_HASH_KEY_STRING );
+  if ( !shared_str ) {
+    shared_str = apr_pstrdup( share->mp, str );
+    apr_hash_set( share->strings, shared_str, APR_HASH_KEY_STRING,
+                  shared_str );
   }
+
+  return shared_str;
 }
 
-static int is_utf8_linebreak( char *str )
+static char *share_block( json_share_t *share, const char *block )
 {
-  unsigned char c[3];
-  memcpy( c, str, 3 );
-  
-  return ( ( c[0] == 0xe2 ) && ( c[1] == 0x80 ) &&
-           ( ( c[2] == 0xa8 ) || ( c[2] == 0xa9 ) ) );
+  apr_size_t size = json_compressed_size( block );
+  char *shared_block;
+
+  shared_block = apr_hash_get( share->blocks, block, size );
+  if ( !shared_block ) {
+    shared_block = apr_pmemdup( share->mp, block, size );
+    apr_hash_set( share->blocks, shared_block, size, shared_block );
+  }
+
+  return shared_block;
 }
 
-static void print_string( apr_file_t *out, char *str )
+static int compare_nodes( const void *a, const void *b )
 {
-  unsigned char c;
+  const json_t *x = *(json_t * const *) a;
+  const json_t *y = *(json_t * const *) b;
+  return ( x < y ) ? -1 : ( x > y );
+}
 
-  apr_file_printf( out,  "\"" );
-  while ( *str ) {
-    c = *str;
-    if ( c < 32 ) {
-      apr_file_printf( out,  "\\" );
-      switch ( c ) {
-      case '\b':
-        apr_file_printf( out,  "b" );
-        break;
-      case '\t':
-        apr_file_printf( out,  "t" );
-        break;
-      case '\n':
-        apr_file_printf( out,  "n" );
-        break;
-      case '\f':
-        apr_file_printf( out,  "f" );
-        break;
-      case '\r':
-        apr_file_printf( out,  "r" );
-        break;
-      default:
-        apr_file_printf( out,  "u%.4x", c );
-        break;
-      }
+static json_t *share_internal( json_share_t *share, json_t *json )
+{
+  int i;
+  int num_items = 0;
+  char *name;
+  char *str = NULL;
+  json_t *tmp_json;
+  json_t *shared_json;
+  json_t **items = NULL;
+  json_t **sorted_items = NULL;
+  apr_hash_index_t *idx;
+
+  /*
+   * Share the children first.  Two containers are then identical exactly when
+   * they hold the same child pointers.
+   */
+  if ( JSON_IS_OBJECT( json ) ) {
+    num_items = apr_hash_count( json->value.object );
+    items = apr_palloc( share->tmp_mp, sizeof(json_t *) * num_items * 2 );
+    sorted_items = items + num_items;
+    for ( i = 0, idx = apr_hash_first( share->tmp_mp, json->value.object );
+          idx; i++, idx = apr_hash_next( idx ) ) {
+      apr_hash_this( idx, NULL, NULL, (void **) &tmp_json );
+      items[i] = share_internal( share, tmp_json );
+      sorted_items[i] = items[i];
     }
-    else if ( c == '\\' ) {
-      apr_file_printf( out,  "\\\\" );
+    /* Property order doesn't change the value of an object. */
+    qsort( sorted_items, num_items, sizeof(json_t *), compare_nodes );
+  }
+  else if ( JSON_IS_ARRAY( json ) ) {
+    num_items = json->value.array->nelts;
+    items = apr_palloc( share->tmp_mp, sizeof(json_t *) * num_items );
+    sorted_items = items;
+    for ( i = 0; i < num_items; i++ ) {
+      tmp_json = APR_ARRAY_IDX( json->value.array, i, json_t * );
+      items[i] = share_internal( share, tmp_json );
     }
-    else if ( c == '"' ) {
-      apr_file_printf( out,  "\\\"" );
+  }
+
+  /* Build the key: type, interned name and then the value. */
+  name = share_string( share, JSON_NAME( json ) );
+
+  STR_BUF_CLEAR( share->key );
+  str_buf_write( share->key, (char *) &json->type, sizeof(json->type) );
+  str_buf_write( share->key, (char *) &name, sizeof(name) );
+
+  switch ( json->type ) {
+  case JSON_STRING:
+    if ( JSON_IS_INLINE_STRING( json ) ) {
+      str_buf_write( share->key, json->value.inline_string, json->len );
     }
-    else if ( is_utf8_linebreak( str ) ) {
-      apr_file_printf( out,  "\\u%.4x", utf8_decode_byte( str ) );
-      str += 2;
+    else if ( JSON_IS_COMPRESSED_STRING( json ) ) {
+      str = share_block( share, json->value.string );
+      str_buf_write( share->key, (char *) &str, sizeof(str) );
     }
     else {
-      apr_file_printf( out,  "%c", c );
+      str = share_string( share, json->value.string );
+      str_buf_write( share->key, (char *) &str, sizeof(str) );
     }
+    break;
 
-    str++;
+  case JSON_INTEGER:
+    str_buf_write( share->key, (char *) &json->value.integer,
+                   sizeof(json->value.integer) );
+    break;
+
+  case JSON_NUMBER:
+    str_buf_write( share->key, (char *) &json->value.number,
+                   sizeof(json->value.number) );
+    break;
+
+  case JSON_BOOLEAN:
+    str_buf_write( share->key, (char *) &json->value.boolean,
+                   sizeof(json->value.boolean) );
+    break;
+
+  case JSON_OBJECT:
+  case JSON_ARRAY:
+    str_buf_write( share->key, (char *) sorted_items,
+                   sizeof(json_t *) * num_items );
+    break;
+
+  default:
+    break;
   }
-  apr_file_printf( out,  "\"" );
+
+  /* 1.0 and 1.00 are the same number, but they don't print the same. */
+  if ( ( JSON_IS_INTEGER( json ) || JSON_IS_NUMBER( json ) ) &&
+       JSON_HAS_LEXEME( json ) ) {
+    str = share_string( share, json->value.lexeme.text );
+    str_buf_write( share->key, (char *) &str, sizeof(str) );
+  }
+
+  shared_json = apr_hash_get( share->nodes, share->key->data,
+                              share->key->data_len );
+  if ( shared_json )
+    return shared_json;
+
+  /* First time this value has been seen, so make the shared copy. */
+  switch ( json->type ) {
+  case JSON_OBJECT:
+    shared_json = json_create_object( share->mp );
+    for ( i = 0; i < num_items; i++ ) {
+      apr_hash_set( shared_json->value.object, JSON_NAME( items[i] ),
+                    APR_HASH_KEY_STRING, items[i] );
+    }
+    break;
+
+  case JSON_ARRAY:
+    shared_json = apr_palloc( share->mp, sizeof(json_t) );
+    shared_json->value.array = apr_array_make( share->mp, num_items,
+                                               sizeof(json_t *) );
+    for ( i = 0; i < num_items; i++ ) {
+      APR_ARRAY_PUSH( shared_json->value.array, json_t * ) = items[i];
+    }
+    break;
+
+  default:
+    shared_json = apr_pmemdup( share->mp, json, sizeof(json_t) );
+    if ( JSON_IS_STRING( json ) && !JSON_IS_INLINE_STRING( json ) ) {
+      shared_json->value.string = str;
+    }
+    else if ( str ) {
+      shared_json->value.lexeme.text = str;
+    }
+    break;
+  }
+
+  shared_json->type = json->type;
+  JSON_NAME( shared_json ) = name;
+
+  apr_hash_set( share->nodes, apr_pmemdup( share->tmp_mp, share->key->data,
+                                           share->key->data_len ),
+                share->key->data_len, shared_json );
+
+  return shared_json;
 }
 
-static void dump_internal( apr_file_t *out, json_t *json, int first,
-                           int depth, int indent )
+json_t *json_share( apr_pool_t *mp, json_t *json )
 {
-  apr_array_header_t *arr = NULL;
-  int i = 0;
-  json_t *tmp_json = NULL;
+  json_share_t share;
+  json_t *shared_json;
+
+  if ( !json )
+    return NULL;
+
+  share.mp = mp;
+  apr_pool_create( &share.tmp_mp, NULL );
+  share.strings = apr_hash_make( share.tmp_mp );
+  share.blocks = apr_hash_make( share.tmp_mp );
+  share.nodes = apr_hash_make( share.tmp_mp );
+  share.key = str_buf_create( share.tmp_mp, 256 );
+
+  shared_json = share_internal( &share, json );
+
+  apr_pool_destroy( share.tmp_mp );
+
+  return shared_json;
+}
+
+/*
+ * State used while compacting a tree.  Each distinct source node is visited
+ * once in both passes, so shared nodes stay shared.
+ */
+typedef struct json_compact_t {
+  apr_pool_t *mp;
+  apr_pool_t *tmp_mp;
+  apr_hash_t *nodes;
+  char *block;
+  apr_size_t size;
+} json_compact_t;
+
+#define COMPACT_SIZE( size ) APR_ALIGN_DEFAULT( size )
+
+static apr_size_t compact_str_size( const char *str )
+{
+  return ( str ) ? strlen( str ) + 1 : 0;
+}
+
+/**
+ * Work out how many bytes the node and everything below it will need.
+ */
+static void compact_size( json_compact_t *compact, json_t *json )
+{
+  int i;
+  apr_size_t size;
+  json_t *tmp_json;
   apr_hash_index_t *idx;
 
-  if ( !first )
-    apr_file_printf( out,  "," );
+  if ( apr_hash_get( compact->nodes, &json, sizeof(json_t *) ) )
+    return;
 
-  if ( ( depth > 0 ) && indent ) {
-    apr_file_printf( out,  "\n" );
-    print_spaces( out, depth * indent );
-  }
+  apr_hash_set( compact->nodes,
+                apr_pmemdup( compact->tmp_mp, &json, sizeof(json_t *) ),
+                sizeof(json_t *), json );
 
-  if ( JSON_NAME( json ) ) {
-    print_string( out, JSON_NAME( json ) );
-    apr_file_printf( out,  ":" );
-     if ( indent )
-       print_spaces( out, 1 );
-  }
+  size = sizeof(json_t) + compact_str_size( JSON_NAME( json ) );
 
   switch ( json->type ) {
   case JSON_STRING:
-    print_string( out, json->value.string );
+    if ( JSON_IS_COMPRESSED_STRING( json ) ) {
+      size += json_compressed_size( json->value.string );
+    }
+    else if ( !JSON_IS_INLINE_STRING( json ) ) {
+      size += json->len + 1;
+    }
+    size = COMPACT_SIZE( size );
     break;
 
   case JSON_INTEGER:
-    apr_file_printf( out,  "%d", json->value.integer );
-    break;
-
   case JSON_NUMBER:
-    apr_file_printf( out,  "%g", json->value.number );
+    if ( JSON_HAS_LEXEME( json ) ) {
+      size += json->len + 1;
+    }
+    size = COMPACT_SIZE( size );
     break;
 
   case JSON_OBJECT:
-    apr_file_printf( out,  "{" );
-    for ( i = 0, idx = apr_hash_first( NULL, json->value.object ); idx;
-          i++, idx = apr_hash_next( idx ) ) {
+    for ( idx = apr_hash_first( compact->tmp_mp, json->value.object ); idx;
+          idx = apr_hash_next( idx ) ) {
       apr_hash_this( idx, NULL, NULL, (void **) &tmp_json );
-      dump_internal( out, tmp_json, i == 0, depth + 1, indent );
+      compact_size( compact, tmp_json );
     }
-
-    if ( indent && i > 0 ) {
-      apr_file_printf( out,  "\n" );
-      print_spaces( out, depth * indent );
-    }
-    apr_file_printf( out,  "}" );
+    size = COMPACT_SIZE( size );
     break;
 
   case JSON_ARRAY:
-    arr = json->value.array;
-    apr_file_printf( out,  "[" );
-    for ( i = 0; arr && i < arr->nelts; i++ ) {
-      tmp_json = APR_ARRAY_IDX( arr, i, json_t * );
-      dump_internal( out, tmp_json, i == 0, depth + 1, indent );
-    }
-
-    if ( indent && i > 0 ) {
-      apr_file_printf( out,  "\n" );
-      print_spaces( out, depth * indent );
+    size = COMPACT_SIZE( size ) +
+           COMPACT_SIZE( sizeof(apr_array_header_t) ) +
+           COMPACT_SIZE( sizeof(json_t *) * json->value.array->nelts );
+    for ( i = 0; i < json->value.array->nelts; i++ ) {
+      compact_size( compact,
+                    APR_ARRAY_IDX( json->value.array, i, json_t * ) );
     }
+    break;
 
-    apr_file_printf( out,  "]" );
+  default:
+    size = COMPACT_SIZE( size );
     break;
+  }
 
-  case JSON_BOOLEAN:
-    ( json->value.boolean ) ? apr_file_printf( out,  "true" ) :
-                              apr_file_printf( out,  "false" );
+  compact->size += size;
+}
+
+static void *compact_alloc( json_compact_t *compact, apr_size_t size )
+{
+  void *mem = compact->block;
+  compact->block += size;
+  return mem;
+}
+
+/** Pad the block so that the next allocation is aligned. */
+static void compact_align( json_compact_t *compact, char *start )
+{
+  compact->block = start + COMPACT_SIZE( compact->block - start );
+}
+
+static char *compact_str( json_compact_t *compact, const char *str )
+{
+  apr_size_t len = compact_str_size( str );
+  return ( len ) ? memcpy( compact_alloc( compact, len ), str, len ) : NULL;
+}
+
+static char *compact_block( json_compact_t *compact, const char *block )
+{
+  apr_size_t size = json_compressed_size( block );
+  return memcpy( compact_alloc( compact, size ), block, size );
+}
+
+/**
+ * Copy a node into the block.  The node comes first, followed by its name,
+ * its string or element vector, and then its children.
+ */
+static json_t *compact_internal( json_compact_t *compact, json_t *json )
+{
+  int i;
+  char *start;
+  json_t *tmp_json;
+  json_t *new_json;
+  apr_array_header_t *arr;
+  apr_hash_index_t *idx;
+
+  new_json = apr_hash_get( compact->nodes, &json, sizeof(json_t *) );
+  if ( new_json )
+    return new_json;
+
+  start = compact->block;
+  new_json = compact_alloc( compact, sizeof(json_t) );
+  *new_json = *json;
+  apr_hash_set( compact->nodes,
+                apr_pmemdup( compact->tmp_mp, &json, sizeof(json_t *) ),
+                sizeof(json_t *), new_json );
+
+  JSON_NAME( new_json ) = compact_str( compact, JSON_NAME( json ) );
+
+  switch ( json->type ) {
+  case JSON_STRING:
+    if ( JSON_IS_COMPRESSED_STRING( json ) ) {
+      new_json->value.string = compact_block( compact, json->value.string );
+    }
+    else if ( !JSON_IS_INLINE_STRING( json ) ) {
+      new_json->value.string = compact_str( compact, json->value.string );
+    }
     break;
 
-  case JSON_NULL:
-    apr_file_printf( out,  "null" );
+  case JSON_INTEGER:
+  case JSON_NUMBER:
+    if ( JSON_HAS_LEXEME( json ) ) {
+      new_json->value.lexeme.text = compact_str( compact,
+                                                 json->value.lexeme.text );
+    }
     break;
 
+  case JSON_OBJECT:
+    /* APR hash tables can only come from a pool. */
+    compact_align( compact, start );
+    new_json->value.object = apr_hash_make( compact->mp );
+    /* Names are copied, so slot lookups wouldn't match them anymore. */
+    new_json->len = 0;
+    for ( idx = apr_hash_first( compact->tmp_mp, json->value.object ); idx;
+          idx = apr_hash_next( idx ) ) {
+      apr_hash_this( idx, NULL, NULL, (void **) &tmp_json );
+      tmp_json = compact_internal( compact, tmp_json );
+      apr_hash_set( new_json->value.object, JSON_NAME( tmp_json ),
+                    APR_HASH_KEY_STRING, tmp_json );
+    }
+    return new_json;
+
+  case JSON_ARRAY:
+    compact_align( compact, start );
+    arr = compact_alloc( compact,
+                         COMPACT_SIZE( sizeof(apr_array_header_t) ) );
+    arr->pool = compact->mp;
+    arr->elt_size = sizeof(json_t *);
+    arr->nelts = json->value.array->nelts;
+    arr->nalloc = arr->nelts;
+    arr->elts = compact_alloc( compact, sizeof(json_t *) * arr->nelts );
+    compact_align( compact, start );
+    new_json->value.array = arr;
+    for ( i = 0; i < arr->nelts; i++ ) {
+      APR_ARRAY_IDX( arr, i, json_t * ) =
+        compact_internal( compact,
+                          APR_ARRAY_IDX( json->value.array, i, json_t * ) );
+    }
+    return new_json;
+
   default:
-    fprintf( stderr, "error:  unrecognized object type\n" );
     break;
   }
 
-  if ( ( depth == 0 ) && indent ) {
-    apr_file_printf( out,  "\n" );
-  }
+  compact_align( compact, start );
+
+  return new_json;
 }
 
-/*
- * Externally visible function that invokes the internal print function.
- */
-void json_dump( apr_file_t *out, json_t *json, int indent )
+json_t *json_compact( json_t *json, apr_pool_t *mp )
 {
-  dump_internal( out, json, 1, 0, indent );
+  apr_pool_t *tmp_mp;
+  json_compact_t compact;
+  json_t *new_json;
+
+  if ( !json )
+    return NULL;
+
+  apr_pool_create( &tmp_mp, NULL );
+
+  compact.mp = mp;
+  compact.tmp_mp = tmp_mp;
+  compact.size = 0;
+  compact.nodes = apr_hash_make( tmp_mp );
+  compact_size( &compact, json );
+
+  compact.block = apr_palloc( mp, compact.size );
+  compact.nodes = apr_hash_make( tmp_mp );
+  new_json = compact_internal( &compact, json );
+
+  apr_pool_destroy( tmp_mp );
+
+  return new_json;
 }
 
 static void print_xml_string( char *str )
@@ -347,18 +761,34 @@ static void print_xml_string( char *str )
 char *json_get_string_value( apr_pool_t *mp, json_t *json )
 {
   char *value = NULL;
+  char number_buf[JSON_NUMBER_BUFFER_SIZE];
+  apr_size_t len;
 
   switch ( json->type ) {
   case JSON_STRING:
-    value = apr_psprintf( mp, "%s", json->value.string );
+    if ( JSON_IS_COMPRESSED_STRING( json ) ) {
+      value = apr_palloc( mp, JSON_STRING_LENGTH( json ) + 1 );
+      if ( !json_decompress( json, value ) ) {
+        fprintf( stderr, "error:  could not decompress a string\n" );
+        value = NULL;
+      }
+    }
+    else {
+      value = apr_pstrmemdup( mp, JSON_STRING_VALUE( json ), json->len );
+    }
     break;
 
   case JSON_INTEGER:
-    value = apr_psprintf( mp, "%d", json->value.integer );
-    break;
-
   case JSON_NUMBER:
-    value = apr_psprintf( mp, "%g", json->value.number );
+    if ( JSON_HAS_LEXEME( json ) ) {
+      value = apr_pstrmemdup( mp, json->value.lexeme.text, json->len );
+    }
+    else {
+      len = ( JSON_IS_INTEGER( json ) ) ?
+        json_format_integer( number_buf, json->value.integer ) :
+        json_format_number( number_buf, json->value.number );
+      value = apr_pstrmemdup( mp, number_buf, len );
+    }
     break;
 
   case JSON_BOOLEAN:
@@ -22,12 +22,15 @@
 #ifndef JSON_H
 #define JSON_H
 
+#include <apr_buckets.h>
 #include <apr_general.h>
 #include <apr_hash.h>
 #include <apr_pools.h>
 #include <apr_tables.h>
 
+#include "json_slab.h"
 #include "parser.h"
+#include "str_buf.h"
 
 /**
  * JSON types
@@ -42,21 +45,82 @@ typedef enum json_type {
   JSON_NULL
 } json_type;
 
+/**
+ * Strings shorter than this are stored in the node itself.
+ */
+#define JSON_INLINE_SIZE 16
+
 typedef struct json_t {
   char *name;
   json_type type;
-  struct json_t *parent;
+  /**
+   * Length of a string value, or of the text of a number that was read with
+   * its lexeme kept.  Minus the length for a string that is kept compressed
+   * (see json_compress.h).  Zero if a number has no lexeme.  For an object, the
+   * number of slots it was loaded with (see json_schema.h).
+   */
+  int len;
   union {
     char *string;
+    char inline_string[JSON_INLINE_SIZE];
     int integer;
     double number;
     apr_hash_t *object;
     apr_array_header_t *array;
     int boolean;
+    /**
+     * Overlays integer and number with the text the number was read from.
+     */
+    struct {
+      double number;
+      char *text;
+    } lexeme;
+    /**
+     * Overlays object with the known properties of an object loaded with a
+     * schema, indexed by slot.
+     */
+    struct {
+      apr_hash_t *object;
+      struct json_t **slots;
+    } schema_object;
   } value;
 } json_t;
 
 #define JSON_NAME( json ) (json)->name
+
+/* Compressed strings have a negative length, so they are never inline. */
+#define JSON_IS_INLINE_STRING( json )                                   \
+  ( (unsigned int) (json)->len < JSON_INLINE_SIZE )
+
+/**
+ * If a JSON_STRING is kept compressed.  Its value.string is then the
+ * compressed block, which json_decompress or json_get_string_value read.
+ */
+#define JSON_IS_COMPRESSED_STRING( json ) ( (json)->len < 0 )
+
+/**
+ * The length of the text of a JSON_STRING, compressed or not.
+ */
+#define JSON_STRING_LENGTH( json )                                      \
+  ( JSON_IS_COMPRESSED_STRING( json ) ? -(json)->len : (json)->len )
+
+/**
+ * The value of a JSON_STRING that isn't compressed, wherever it is stored.
+ */
+#define JSON_STRING_VALUE( json )                                       \
+  ( JSON_IS_INLINE_STRING( json ) ? (json)->value.inline_string :       \
+                                    (json)->value.string )
+
+/**
+ * If a JSON_INTEGER or JSON_NUMBER has the text it was read from.
+ */
+#define JSON_HAS_LEXEME( json ) ( (json)->len > 0 )
+
+/**
+ * If a JSON_OBJECT has its known properties in slots.
+ */
+#define JSON_HAS_SLOTS( json ) ( (json)->len > 0 )
+
 #define JSON_IS_TYPE( json, json_type ) ( (json)->type == json_type )
 
 #define JSON_IS_STRING( json ) JSON_IS_TYPE( json, JSON_STRING )
@@ -74,16 +138,128 @@ json_t *json_create_str( apr_pool_t *mp, const char *string );
 json_t *json_create_strn( apr_pool_t *mp, const char *string, int len );
 json_t *json_create_integer( apr_pool_t *mp, int integer );
 json_t *json_create_number( apr_pool_t *mp, double number );
+
+/**
+ * Create a JSON_INTEGER or JSON_NUMBER from its text, and keep the text so
+ * that the number is printed exactly as it was written.
+ * @param mp Pool to allocate the node from.
+ * @param text A valid JSON number.
+ * @param len The length of text.
+ */
+json_t *json_create_number_lexeme( apr_pool_t *mp, const char *text,
+                                   int len );
 json_t *json_create_object( apr_pool_t *mp );
 json_t *json_create_array( apr_pool_t *mp );
 json_t *json_create_boolean( apr_pool_t *mp, int boolean );
 json_t *json_create_null( apr_pool_t *mp );
 
-void json_dump( apr_file_t *out, json_t *node, int indent );
+/**
+ * The create functions above for a caller that creates many nodes in mp and
+ * has looked up the slab attached to it once, so that it isn't looked up for
+ * each node.
+ * @param slab What json_slab_get returns for mp, NULL if it has no slab.
+ */
+json_t *json_create_strn_slab( apr_pool_t *mp, json_slab_t *slab,
+                               const char *string, int len );
+json_t *json_create_integer_slab( apr_pool_t *mp, json_slab_t *slab,
+                                  int integer );
+json_t *json_create_number_slab( apr_pool_t *mp, json_slab_t *slab,
+                                 double number );
+json_t *json_create_number_lexeme_slab( apr_pool_t *mp, json_slab_t *slab,
+                                        const char *text, int len );
+json_t *json_create_object_slab( apr_pool_t *mp, json_slab_t *slab );
+json_t *json_create_array_slab( apr_pool_t *mp, json_slab_t *slab );
+json_t *json_create_boolean_slab( apr_pool_t *mp, json_slab_t *slab,
+                                  int boolean );
+json_t *json_create_null_slab( apr_pool_t *mp, json_slab_t *slab );
+
+/**
+ * Dump a JSON tree to a file.
+ * @return TRUE if every value was dumped.  A compressed string that can't be
+ *         decompressed is reported on stderr and left out.
+ */
+int json_dump( apr_file_t *out, json_t *node, int indent );
+
+/**
+ * Dump a JSON tree to a file like json_dump, splitting arrays and objects
+ * with many values into pieces that are serialized on several threads.  The
+ * output is the same as json_dump's.  The tree must not be changed until the
+ * dump is done.
+ * @param out The file to write to.
+ * @param json The tree to dump.
+ * @param indent Number of spaces to indent each level by, or 0.
+ * @param threads The number of threads to use, including the caller.
+ * @return TRUE if every value was dumped, as with json_dump.
+ */
+int json_dump_threaded( apr_file_t *out, json_t *json, int indent,
+                        int threads );
+
+/**
+ * Append the text of a JSON tree to a string buffer.  The buffer is not NUL
+ * terminated.
+ * @param buf The string buffer.
+ * @param json The tree to dump.
+ * @param indent Number of spaces to indent each level by, or 0 for compact
+ *        output.
+ * @return TRUE if every value was dumped, as with json_dump.
+ */
+int json_dump_to_str_buf( str_buf_t *buf, json_t *json, int indent );
+
+/**
+ * Dump a JSON tree into a NUL terminated string that is allocated from mp.
+ * @return The string, or NULL if a value couldn't be dumped.
+ */
+char *json_dump_to_buffer( apr_pool_t *mp, json_t *json, int indent );
+
+/**
+ * Dump a JSON tree into a buffer supplied by the caller.  Like snprintf, at
+ * most size - 1 bytes are written, followed by a NUL.
+ * @param buf The buffer.
+ * @param size The size of buf.
+ * @param json The tree to dump.
+ * @param indent Number of spaces to indent each level by, or 0.
+ * @return The length of the complete text, not counting the NUL.  If it is
+ *         size or more, the output was truncated.
+ */
+apr_size_t json_dump_to_fixed_buffer( char *buf, apr_size_t size,
+                                      json_t *json, int indent );
+
+/**
+ * Append the text of a JSON tree to a bucket brigade.
+ */
+void json_dump_to_brigade( apr_bucket_brigade *bb, json_t *json,
+                           int indent );
+
+/**
+ * Copy a JSON tree into mp, collapsing identical nodes so that each distinct
+ * value (including its property name) is stored once.  Names and string
+ * values are interned as well.  Nodes do not know their parent, so the same
+ * node may appear in many places in the result; it must be treated as read
+ * only.  The source tree is left untouched and its pool may be destroyed
+ * afterwards.
+ * @param mp Pool to allocate the shared tree from.
+ * @param json The tree to copy.
+ * @return The root of the shared tree.
+ */
+json_t *json_share( apr_pool_t *mp, json_t *json );
+
+/**
+ * Copy a finished JSON tree into a single block allocated from mp.  Nodes are
+ * laid out depth first, each followed by its name, its string value or
+ * element vector and then its children, so walking a subtree touches
+ * contiguous memory.  Object hash tables are still allocated from mp.  Shared
+ * nodes stay shared.  Once this returns the pool holding the original tree
+ * can be destroyed.
+ * @param json The tree to copy.
+ * @param mp Pool to allocate the compacted tree from.
+ * @return The root of the compacted tree.
+ */
+json_t *json_compact( json_t *json, apr_pool_t *mp );
 
 /**
  * Return the string value of a json object, or NULL if it type JSON_NULL,
- * JSON_OBJECT or JSON_ARRAY.
+ * JSON_OBJECT or JSON_ARRAY, or is a compressed string that can't be
+ * decompressed.
  */
 char *json_get_string_value( apr_pool_t *mp, json_t *json );
 
@@ -97,11 +273,21 @@ typedef struct json_callback_t {
   void ( *string_handler )( void *user_data, const char *value );
   void ( *integer_handler )( void *user_data, int value );
   void ( *number_handler )( void *user_data, double value );
+  /**
+   * If set, numbers are not converted by the parser.  Their text is passed
+   * here instead of to integer_handler or number_handler.
+   */
+  void ( *number_lexeme_handler )( void *user_data, const char *text );
   void ( *boolean_handler )( void *user_data, int value );
   void ( *null_handler )( void *user_data );
   void *user_data;
 } json_callback_t;
 
+/**
+ * Parser flag to keep the text of numbers, see json_create_number_lexeme.
+ */
+#define JSON_PARSER_RAW_NUMBERS 0x1
+
 parser_t *json_parser_create( apr_pool_t *mp );
 int json_parser_parse_file( parser_t *parser, const void *file,
                             json_callback_t *json_callbacks );
@@ -0,0 +1,170 @@
+/*
+ * json_compress.c
+ *
+ * Description
+ *   Keeps large string values compressed in memory.
+ *
+ * Copyright 2010 Dan Rinehimer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <apr_general.h>
+#include <apr_pools.h>
+
+#if defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ)
+#include <zlib.h>
+#endif
+
+#include "json.h"
+#include "json_compress.h"
+
+#define JSON_COMPRESS_KEY "json_compress"
+
+/*
+ * A block is the size of the compressed data followed by the data.  The
+ * size is copied in and out since blocks aren't aligned.
+ */
+#define BLOCK_HEADER_SIZE sizeof(apr_uint32_t)
+
+/**
+ * Attached to a pool whose strings are compressed.  The deflate state is set
+ * up once and reused for every string, which is most of the cost of
+ * compressing a short one.
+ */
+typedef struct json_compress_t {
+  apr_size_t min_size;
+#if defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ)
+  z_stream stream;
+  int ready;
+#endif
+} json_compress_t;
+
+static apr_status_t compress_cleanup( void *compress_ptr )
+{
+#if defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ)
+  json_compress_t *compress = (json_compress_t *) compress_ptr;
+
+  if ( compress->ready ) {
+    deflateEnd( &compress->stream );
+    compress->ready = FALSE;
+  }
+#endif
+
+  return APR_SUCCESS;
+}
+
+void json_compress_attach( apr_size_t min_size, apr_pool_t *mp )
+{
+  json_compress_t *compress = apr_pcalloc( mp, sizeof(json_compress_t) );
+
+  compress->min_size = ( min_size > JSON_COMPRESS_MIN_SIZE ) ?
+                       min_size : JSON_COMPRESS_MIN_SIZE;
+  apr_pool_cleanup_register( mp, compress, compress_cleanup,
+                             apr_pool_cleanup_null );
+  apr_pool_userdata_setn( compress, JSON_COMPRESS_KEY, NULL, mp );
+}
+
+static json_compress_t *compress_get( apr_pool_t *mp )
+{
+  void *compress = NULL;
+  apr_pool_userdata_get( &compress, JSON_COMPRESS_KEY, mp );
+  return (json_compress_t *) compress;
+}
+
+apr_size_t json_compress_get( apr_pool_t *mp )
+{
+  json_compress_t *compress = compress_get( mp );
+  return ( compress ) ? compress->min_size : 0;
+}
+
+apr_size_t json_compress_bound( apr_size_t len )
+{
+#if defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ)
+  return BLOCK_HEADER_SIZE + compressBound( len );
+#else
+  return BLOCK_HEADER_SIZE;
+#endif
+}
+
+apr_size_t json_compress( apr_pool_t *mp, char *block, const char *str,
+                          apr_size_t len )
+{
+#if defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ)
+  json_compress_t *compress = compress_get( mp );
+  z_stream *stream;
+  apr_uint32_t size;
+
+  if ( !compress )
+    return 0;
+
+  stream = &compress->stream;
+  if ( !compress->ready ) {
+    /* Text compresses nearly as well at the fastest level. */
+    if ( deflateInit( stream, Z_BEST_SPEED ) != Z_OK )
+      return 0;
+    compress->ready = TRUE;
+  }
+  else {
+    deflateReset( stream );
+  }
+
+  stream->next_in = (Bytef *) str;
+  stream->avail_in = len;
+  stream->next_out = (Bytef *) block + BLOCK_HEADER_SIZE;
+  stream->avail_out = json_compress_bound( len ) - BLOCK_HEADER_SIZE;
+
+  if ( ( deflate( stream, Z_FINISH ) != Z_STREAM_END ) ||
+       ( BLOCK_HEADER_SIZE + stream->total_out >= len ) ) {
+    return 0;
+  }
+
+  size = stream->total_out;
+  memcpy( block, &size, BLOCK_HEADER_SIZE );
+
+  return BLOCK_HEADER_SIZE + size;
+#else
+  return 0;
+#endif
+}
+
+apr_size_t json_compressed_size( const char *block )
+{
+  apr_uint32_t size;
+  memcpy( &size, block, BLOCK_HEADER_SIZE );
+  return BLOCK_HEADER_SIZE + size;
+}
+
+int json_decompress( json_t *json, char *str )
+{
+#if defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ)
+  uLongf len = JSON_STRING_LENGTH( json );
+  apr_size_t size = json_compressed_size( json->value.string );
+
+  if ( uncompress( (Bytef *) str, &len,
+                   (const Bytef *) json->value.string + BLOCK_HEADER_SIZE,
+                   size - BLOCK_HEADER_SIZE ) == Z_OK &&
+       len == JSON_STRING_LENGTH( json ) ) {
+    str[len] = '\0';
+    return TRUE;
+  }
+#endif
+
+  str[0] = '\0';
+  return FALSE;
+}
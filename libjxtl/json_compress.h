@@ -0,0 +1,80 @@
+/*
+ * json_compress.h
+ *
+ * Description
+ *   Keeps large string values compressed in memory.
+ *
+ * Copyright 2010 Dan Rinehimer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef JSON_COMPRESS_H
+#define JSON_COMPRESS_H
+
+#include <apr_pools.h>
+
+#include "json.h"
+
+/** Strings shorter than this are never compressed. */
+#define JSON_COMPRESS_MIN_SIZE 64
+
+/**
+ * Keep the strings of at least min_size bytes that are created in mp
+ * compressed with zlib.  They stay JSON_STRINGs, and are decompressed each
+ * time they are printed or converted.  Strings that don't get smaller are
+ * stored as they are.  Does nothing if the library was built without zlib.
+ * @param min_size The smallest string to compress, at least
+ *        JSON_COMPRESS_MIN_SIZE.
+ * @param mp The pool the strings are created in.
+ */
+void json_compress_attach( apr_size_t min_size, apr_pool_t *mp );
+
+/**
+ * @return The smallest string that is compressed in mp, or 0 if strings
+ *         created in mp aren't compressed.
+ */
+apr_size_t json_compress_get( apr_pool_t *mp );
+
+/**
+ * @return The size of a buffer that can hold len bytes compressed.
+ */
+apr_size_t json_compress_bound( apr_size_t len );
+
+/**
+ * Compress a string with the state attached to mp by json_compress_attach.
+ * @param mp The pool.
+ * @param block Buffer of at least json_compress_bound( len ) bytes.
+ * @param str The string.
+ * @param len The length of str.
+ * @return The number of bytes used in block, or 0 if the string couldn't
+ *         be made smaller.
+ */
+apr_size_t json_compress( apr_pool_t *mp, char *block, const char *str,
+                          apr_size_t len );
+
+/**
+ * @return The size of a block made by json_compress.
+ */
+apr_size_t json_compressed_size( const char *block );
+
+/**
+ * Decompress a compressed JSON_STRING.
+ * @param json The string.
+ * @param str Buffer for the text, of JSON_STRING_LENGTH( json ) + 1 bytes.
+ *        The text is NUL terminated.
+ * @return TRUE if the text was decompressed.
+ */
+int json_decompress( json_t *json, char *str );
+
+#endif
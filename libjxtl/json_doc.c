@@ -0,0 +1,61 @@
+/*
+ * json_doc.c
+ *
+ * Description
+ *   Reference counted, read only JSON documents that can be shared between
+ *   threads.
+ *
+ * Copyright 2010 Dan Rinehimer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <apr_atomic.h>
+#include <apr_general.h>
+#include <apr_pools.h>
+
+#include "json.h"
+#include "json_doc.h"
+
+json_doc_t *json_doc_adopt( apr_pool_t *mp, json_t *json )
+{
+  json_doc_t *doc = apr_palloc( mp, sizeof(json_doc_t) );
+
+  doc->mp = mp;
+  doc->root = json;
+  apr_atomic_set32( &doc->refcount, 1 );
+
+  return doc;
+}
+
+json_doc_t *json_doc_create( json_t *json )
+{
+  apr_pool_t *mp;
+
+  apr_pool_create( &mp, NULL );
+
+  return json_doc_adopt( mp, json_compact( json, mp ) );
+}
+
+json_doc_t *json_doc_retain( json_doc_t *doc )
+{
+  apr_atomic_inc32( &doc->refcount );
+  return doc;
+}
+
+void json_doc_release( json_doc_t *doc )
+{
+  if ( doc && !apr_atomic_dec32( &doc->refcount ) ) {
+    apr_pool_destroy( doc->mp );
+  }
+}
@@ -0,0 +1,80 @@
+/*
+ * json_doc.h
+ *
+ * Description
+ *   Reference counted, read only JSON documents that can be shared between
+ *   threads.
+ *
+ * Copyright 2010 Dan Rinehimer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef JSON_DOC_H
+#define JSON_DOC_H
+
+#include <apr_general.h>
+#include <apr_pools.h>
+
+#include "json.h"
+
+/**
+ * A loaded tree that is frozen and owns the pool it lives in.  Nothing
+ * writes to a document's nodes, and the library's read paths (path
+ * evaluation, template expansion, json_dump and the bindings' conversions)
+ * iterate objects with iterators of their own, so any number of threads can
+ * read one document at once.  Each thread needs its own template, since
+ * expanding a template uses state kept in it.
+ *
+ * The pool is destroyed when the last reference is released.
+ */
+typedef struct json_doc_t {
+  apr_pool_t *mp;
+  json_t *root;
+  volatile apr_uint32_t refcount;
+} json_doc_t;
+
+/**
+ * Freeze a copy of a tree.  The tree is copied with json_compact into a
+ * pool of the document's own, so its pool can be destroyed afterwards.
+ * @param json The tree.
+ * @return The document, with one reference.
+ */
+json_doc_t *json_doc_create( json_t *json );
+
+/**
+ * Freeze a tree where it is, taking over the pool it was loaded into.
+ * @param mp The pool that holds the tree.  It has to be a pool without a
+ *        parent, and the caller must not clear or destroy it.
+ * @param json The tree.
+ * @return The document, with one reference.
+ */
+json_doc_t *json_doc_adopt( apr_pool_t *mp, json_t *json );
+
+/**
+ * Add a reference to a document.
+ * @return doc
+ */
+json_doc_t *json_doc_retain( json_doc_t *doc );
+
+/**
+ * Drop a reference to a document, destroying it with the last one.
+ */
+void json_doc_release( json_doc_t *doc );
+
+/**
+ * @return The root of the document's tree.
+ */
+#define JSON_DOC_ROOT( doc ) (doc)->root
+
+#endif
@@ -0,0 +1,877 @@
+/*
+ * json_dump.c
+ *
+ * Description
+ *   Serialization of JSON trees to text.
+ *
+ * Copyright 2010 Dan Rinehimer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <apr_buckets.h>
+#include <apr_file_io.h>
+#include <apr_hash.h>
+#include <apr_pools.h>
+#include <apr_strings.h>
+#include <apr_tables.h>
+#if APR_HAS_THREADS
+#include <apr_thread_cond.h>
+#include <apr_thread_mutex.h>
+#include <apr_thread_proc.h>
+#endif
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "apr_macros.h"
+
+#include "json.h"
+#include "json_compress.h"
+#include "json_dump.h"
+#include "json_number.h"
+#include "str_buf.h"
+#include "utf.h"
+
+/** Room needed for anything that is formatted into the buffer. */
+#define DUMP_FORMAT_SIZE 64
+
+static const char dump_spaces[] =
+  "                                                                "
+  "                                                                ";
+
+#define DUMP_SPACES_LEN ( (int) sizeof(dump_spaces) - 1 )
+
+/** Arrays and objects with at least this many values are split up. */
+#define DUMP_PARALLEL_MIN_VALUES 1024
+
+/** Number of values in each piece of a split array or object. */
+#define DUMP_CHUNK_VALUES 256
+
+/** Pieces per thread that may be held before they are written out. */
+#define DUMP_CHUNKS_PER_THREAD 4
+
+/**
+ * State of a dump besides its output.
+ */
+typedef struct dump_ctx_t {
+  /** Threads to split large values across, 1 on a worker thread. */
+  int threads;
+  /** Pool for the bookkeeping of the dump. */
+  apr_pool_t *mp;
+  /**
+   * Pools to iterate the objects at each depth with.  The iterator inside a
+   * hash is never used, so that any number of dumps and other readers can
+   * walk the same tree at once (see json_doc.h), and so that the pieces of a
+   * split value can reach the same shared object (see json_share).
+   */
+  apr_array_header_t *iter_pools;
+  /** Compressed strings are decompressed here, see dump_compressed_string. */
+  char *inflate_buf;
+  apr_size_t inflate_size;
+  /** FALSE once a value couldn't be dumped. */
+  int status;
+} dump_ctx_t;
+
+#define DUMP_IN_PARALLEL( ctx, nelts )                                  \
+  ( (ctx)->threads > 1 && (nelts) >= DUMP_PARALLEL_MIN_VALUES )
+
+static void dump_ctx_init( dump_ctx_t *ctx, apr_pool_t *mp, int threads )
+{
+  ctx->threads = threads;
+  ctx->mp = mp;
+  ctx->iter_pools = apr_array_make( mp, 16, sizeof(apr_pool_t *) );
+  ctx->inflate_buf = NULL;
+  ctx->inflate_size = 0;
+  ctx->status = TRUE;
+}
+
+/**
+ * @return The pool to iterate an object at depth with.
+ */
+static apr_pool_t *dump_iter_pool( dump_ctx_t *ctx, int depth )
+{
+  apr_pool_t *iter_mp;
+
+  while ( ctx->iter_pools->nelts <= depth ) {
+    apr_pool_create( &iter_mp, ctx->mp );
+    APR_ARRAY_PUSH( ctx->iter_pools, apr_pool_t * ) = iter_mp;
+  }
+
+  return APR_ARRAY_IDX( ctx->iter_pools, depth, apr_pool_t * );
+}
+
+void json_dump_init( json_dump_t *dump, char *buf, apr_size_t size,
+                     json_dump_output_func output_func, void *output_data )
+{
+  dump->output_func = output_func;
+  dump->output_data = output_data;
+  dump->buf = buf;
+  dump->size = size;
+  dump->len = 0;
+}
+
+void json_dump_flush( json_dump_t *dump )
+{
+  if ( dump->len > 0 ) {
+    dump->output_func( dump->output_data, dump->buf, dump->len );
+    dump->len = 0;
+  }
+}
+
+void json_dump_write( json_dump_t *dump, const char *str, apr_size_t len )
+{
+  if ( dump->len + len > dump->size ) {
+    json_dump_flush( dump );
+    if ( len > dump->size ) {
+      dump->output_func( dump->output_data, str, len );
+      return;
+    }
+  }
+  memcpy( dump->buf + dump->len, str, len );
+  dump->len += len;
+}
+
+void json_dump_char( json_dump_t *dump, char c )
+{
+  if ( dump->len == dump->size ) {
+    json_dump_flush( dump );
+  }
+  dump->buf[dump->len++] = c;
+}
+
+#define dump_literal( dump, str ) json_dump_write( dump, str, sizeof(str) - 1 )
+
+/**
+ * Make sure there are at least DUMP_FORMAT_SIZE bytes free in the buffer.
+ */
+static char *dump_reserve( json_dump_t *dump )
+{
+  if ( dump->len + DUMP_FORMAT_SIZE > dump->size ) {
+    json_dump_flush( dump );
+  }
+  return dump->buf + dump->len;
+}
+
+void json_dump_spaces( json_dump_t *dump, int num )
+{
+  int len;
+
+  while ( num > 0 ) {
+    len = ( num < DUMP_SPACES_LEN ) ? num : DUMP_SPACES_LEN;
+    json_dump_write( dump, dump_spaces, len );
+    num -= len;
+  }
+}
+
+static int is_utf8_linebreak( const char *str )
+{
+  const unsigned char *c = (const unsigned char *) str;
+
+  return ( ( c[0] == 0xe2 ) && ( c[1] == 0x80 ) &&
+           ( ( c[2] == 0xa8 ) || ( c[2] == 0xa9 ) ) );
+}
+
+/*
+ * Bytes that may need escaping: control characters (including the
+ * terminating NUL), quotes, backslashes and 0xE2, which starts the UTF-8
+ * encodings of U+2028 and U+2029.
+ */
+#define NEEDS_ESCAPE( c ) ( (c) < 0x20 || (c) == '"' || (c) == '\\' || \
+                            (c) == 0xe2 )
+
+#ifdef __SSE2__
+/**
+ * @return The first byte from str up to end that may need escaping, or end.
+ */
+static const char *find_escape( const char *str, const char *end )
+{
+  const __m128i quote = _mm_set1_epi8( '"' );
+  const __m128i backslash = _mm_set1_epi8( '\\' );
+  const __m128i linebreak = _mm_set1_epi8( (char) 0xe2 );
+  const __m128i control = _mm_set1_epi8( 0x1f );
+  __m128i chunk;
+  __m128i matches;
+  int mask;
+
+  for ( ; end - str >= 16; str += 16 ) {
+    chunk = _mm_loadu_si128( (const __m128i *) str );
+    matches = _mm_or_si128(
+      _mm_or_si128( _mm_cmpeq_epi8( chunk, quote ),
+                    _mm_cmpeq_epi8( chunk, backslash ) ),
+      _mm_or_si128( _mm_cmpeq_epi8( chunk, linebreak ),
+                    _mm_cmpeq_epi8( _mm_min_epu8( chunk, control ),
+                                    chunk ) ) );
+    mask = _mm_movemask_epi8( matches );
+    if ( mask ) {
+      return str + __builtin_ctz( mask );
+    }
+  }
+
+  while ( str < end && !NEEDS_ESCAPE( (unsigned char) *str ) ) {
+    str++;
+  }
+
+  return str;
+}
+#else
+
+#define SWAR_ONES 0x0101010101010101ULL
+#define SWAR_HIGHS 0x8080808080808080ULL
+#define SWAR_HAS_ZERO( x ) ( ( (x) - SWAR_ONES ) & ~(x) & SWAR_HIGHS )
+#define SWAR_HAS_BYTE( x, c ) SWAR_HAS_ZERO( (x) ^ ( SWAR_ONES * (c) ) )
+#define SWAR_HAS_LESS( x, n ) ( ( (x) - SWAR_ONES * (n) ) & ~(x) & SWAR_HIGHS )
+
+/**
+ * @return The first byte from str up to end that may need escaping, or end.
+ */
+static const char *find_escape( const char *str, const char *end )
+{
+  apr_uint64_t word;
+
+  for ( ; end - str >= 8; str += 8 ) {
+    memcpy( &word, str, 8 );
+    if ( SWAR_HAS_LESS( word, 0x20 ) || SWAR_HAS_BYTE( word, '"' ) ||
+         SWAR_HAS_BYTE( word, '\\' ) || SWAR_HAS_BYTE( word, 0xe2 ) ) {
+      break;
+    }
+  }
+
+  while ( str < end && !NEEDS_ESCAPE( (unsigned char) *str ) ) {
+    str++;
+  }
+
+  return str;
+}
+#endif
+
+/**
+ * Print the first len bytes of str, stopping early at a NUL.
+ */
+void json_dump_string( json_dump_t *dump, const char *str, apr_size_t len )
+{
+  const char *end = str + len;
+  const char *run;
+  unsigned char c;
+  char *tmp;
+
+  json_dump_char( dump, '"' );
+  while ( str < end ) {
+    run = str;
+    str = find_escape( str, end );
+    if ( str > run ) {
+      json_dump_write( dump, run, str - run );
+    }
+    if ( str == end ) {
+      break;
+    }
+
+    c = *str;
+    if ( c == '\0' ) {
+      break;
+    }
+    else if ( c < 32 ) {
+      switch ( c ) {
+      case '\b':
+        dump_literal( dump, "\\b" );
+        break;
+      case '\t':
+        dump_literal( dump, "\\t" );
+        break;
+      case '\n':
+        dump_literal( dump, "\\n" );
+        break;
+      case '\f':
+        dump_literal( dump, "\\f" );
+        break;
+      case '\r':
+        dump_literal( dump, "\\r" );
+        break;
+      default:
+        tmp = dump_reserve( dump );
+        dump->len += apr_snprintf( tmp, DUMP_FORMAT_SIZE, "\\u%.4x", c );
+        break;
+      }
+    }
+    else if ( c == '\\' ) {
+      dump_literal( dump, "\\\\" );
+    }
+    else if ( c == '"' ) {
+      dump_literal( dump, "\\\"" );
+    }
+    else if ( end - str >= 3 && is_utf8_linebreak( str ) ) {
+      tmp = dump_reserve( dump );
+      dump->len += apr_snprintf( tmp, DUMP_FORMAT_SIZE, "\\u%.4x",
+                                 utf8_decode_byte( (char *) str ) );
+      str += 2;
+    }
+    else {
+      json_dump_char( dump, c );
+    }
+
+    str++;
+  }
+  json_dump_char( dump, '"' );
+}
+
+void json_dump_integer( json_dump_t *dump, int integer )
+{
+  char *tmp = dump_reserve( dump );
+  dump->len += json_format_integer( tmp, integer );
+}
+
+void json_dump_number( json_dump_t *dump, double number )
+{
+  char *tmp = dump_reserve( dump );
+  dump->len += json_format_number( tmp, number );
+}
+
+/**
+ * Dump a string that is kept compressed.  It is decompressed into a buffer
+ * that is reused for the rest of the dump, and grown from ctx->mp when a
+ * string doesn't fit.  A string that can't be decompressed is left out and
+ * fails the dump.
+ */
+static void dump_compressed_string( json_dump_t *dump, json_t *json,
+                                    dump_ctx_t *ctx )
+{
+  apr_size_t size = JSON_STRING_LENGTH( json ) + 1;
+
+  if ( size > ctx->inflate_size ) {
+    ctx->inflate_size = ( size > ctx->inflate_size * 2 ) ?
+                        size : ctx->inflate_size * 2;
+    ctx->inflate_buf = apr_palloc( ctx->mp, ctx->inflate_size );
+  }
+
+  if ( json_decompress( json, ctx->inflate_buf ) ) {
+    json_dump_string( dump, ctx->inflate_buf, JSON_STRING_LENGTH( json ) );
+  }
+  else {
+    fprintf( stderr, "error:  could not decompress a string\n" );
+    ctx->status = FALSE;
+  }
+}
+
+static void dump_values_parallel( json_dump_t *dump, json_t **values,
+                                  int nelts, int depth, int indent,
+                                  dump_ctx_t *ctx );
+static void dump_object_parallel( json_dump_t *dump, json_t *json,
+                                  int depth, int indent,
+                                  dump_ctx_t *ctx );
+
+static void dump_internal( json_dump_t *dump, json_t *json, int first,
+                           int depth, int indent, dump_ctx_t *ctx )
+{
+  apr_array_header_t *arr = NULL;
+  int i = 0;
+  json_t *tmp_json = NULL;
+  apr_hash_index_t *idx;
+  apr_pool_t *iter_mp;
+
+  if ( !first )
+    json_dump_char( dump, ',' );
+
+  if ( ( depth > 0 ) && indent ) {
+    json_dump_char( dump, '\n' );
+    json_dump_spaces( dump, depth * indent );
+  }
+
+  if ( JSON_NAME( json ) ) {
+    json_dump_string( dump, JSON_NAME( json ), strlen( JSON_NAME( json ) ) );
+    json_dump_char( dump, ':' );
+     if ( indent )
+       json_dump_char( dump, ' ' );
+  }
+
+  switch ( json->type ) {
+  case JSON_STRING:
+    if ( JSON_IS_COMPRESSED_STRING( json ) ) {
+      dump_compressed_string( dump, json, ctx );
+    }
+    else {
+      json_dump_string( dump, JSON_STRING_VALUE( json ), json->len );
+    }
+    break;
+
+  case JSON_INTEGER:
+  case JSON_NUMBER:
+    if ( JSON_HAS_LEXEME( json ) ) {
+      json_dump_write( dump, json->value.lexeme.text, json->len );
+    }
+    else if ( JSON_IS_INTEGER( json ) ) {
+      json_dump_integer( dump, json->value.integer );
+    }
+    else {
+      json_dump_number( dump, json->value.number );
+    }
+    break;
+
+  case JSON_OBJECT:
+    json_dump_char( dump, '{' );
+    i = apr_hash_count( json->value.object );
+    if ( DUMP_IN_PARALLEL( ctx, i ) ) {
+      dump_object_parallel( dump, json, depth + 1, indent, ctx );
+    }
+    else {
+      iter_mp = dump_iter_pool( ctx, depth );
+      for ( i = 0, idx = apr_hash_first( iter_mp, json->value.object ); idx;
+            i++, idx = apr_hash_next( idx ) ) {
+        apr_hash_this( idx, NULL, NULL, (void **) &tmp_json );
+        dump_internal( dump, tmp_json, i == 0, depth + 1, indent, ctx );
+      }
+      apr_pool_clear( iter_mp );
+    }
+
+    if ( indent && i > 0 ) {
+      json_dump_char( dump, '\n' );
+      json_dump_spaces( dump, depth * indent );
+    }
+    json_dump_char( dump, '}' );
+    break;
+
+  case JSON_ARRAY:
+    arr = json->value.array;
+    json_dump_char( dump, '[' );
+    if ( arr && DUMP_IN_PARALLEL( ctx, arr->nelts ) ) {
+      dump_values_parallel( dump, (json_t **) arr->elts, arr->nelts,
+                            depth + 1, indent, ctx );
+      i = arr->nelts;
+    }
+    else {
+      for ( i = 0; arr && i < arr->nelts; i++ ) {
+        tmp_json = APR_ARRAY_IDX( arr, i, json_t * );
+        dump_internal( dump, tmp_json, i == 0, depth + 1, indent, ctx );
+      }
+    }
+
+    if ( indent && i > 0 ) {
+      json_dump_char( dump, '\n' );
+      json_dump_spaces( dump, depth * indent );
+    }
+
+    json_dump_char( dump, ']' );
+    break;
+
+  case JSON_BOOLEAN:
+    ( json->value.boolean ) ? dump_literal( dump, "true" ) :
+                              dump_literal( dump, "false" );
+    break;
+
+  case JSON_NULL:
+    dump_literal( dump, "null" );
+    break;
+
+  default:
+    fprintf( stderr, "error:  unrecognized object type\n" );
+    break;
+  }
+
+  if ( ( depth == 0 ) && indent ) {
+    json_dump_char( dump, '\n' );
+  }
+}
+
+/**
+ * A chunk of a split array or object, from when it is serialized until it
+ * is written out.
+ */
+typedef struct dump_slot_t {
+  /** Pool for the chunk, cleared once it is written. */
+  apr_pool_t *mp;
+  str_buf_t *buf;
+  int done;
+} dump_slot_t;
+
+/*
+ * A split array or object.  It is cut into chunks of DUMP_CHUNK_VALUES
+ * values that the threads take in turn and serialize into slots of their
+ * own, which the calling thread writes out in order.  A chunk is only taken
+ * once its slot is free, so at most DUMP_CHUNKS_PER_THREAD chunks per thread
+ * are held at once however large the value is.
+ */
+typedef struct dump_job_t {
+  json_t **values;
+  int nelts;
+  int depth;
+  int indent;
+  int num_chunks;
+  /** The next chunk to serialize. */
+  int next_chunk;
+  /** The number of chunks written out. */
+  int written;
+  int num_slots;
+  dump_slot_t *slots;
+  /** FALSE once a chunk couldn't be dumped. */
+  int status;
+#if APR_HAS_THREADS
+  apr_thread_mutex_t *mutex;
+  /** Signalled when a chunk is done and when a slot is freed. */
+  apr_thread_cond_t *cond;
+#endif
+} dump_job_t;
+
+static void dump_job_lock( dump_job_t *job )
+{
+#if APR_HAS_THREADS
+  apr_thread_mutex_lock( job->mutex );
+#endif
+}
+
+static void dump_job_unlock( dump_job_t *job )
+{
+#if APR_HAS_THREADS
+  apr_thread_mutex_unlock( job->mutex );
+#endif
+}
+
+static void dump_job_wait( dump_job_t *job )
+{
+#if APR_HAS_THREADS
+  apr_thread_cond_wait( job->cond, job->mutex );
+#endif
+}
+
+static void dump_job_signal( dump_job_t *job )
+{
+#if APR_HAS_THREADS
+  apr_thread_cond_broadcast( job->cond );
+#endif
+}
+
+/**
+ * Take the next chunk, if there is one and its slot is free.  Called with
+ * the job locked.
+ * @return The chunk, or -1.
+ */
+static int dump_job_take( dump_job_t *job )
+{
+  if ( job->next_chunk < job->num_chunks &&
+       job->next_chunk < job->written + job->num_slots ) {
+    return job->next_chunk++;
+  }
+  return -1;
+}
+
+/**
+ * Serialize a chunk into its slot.  Called with the job unlocked, and
+ * locks it again when the chunk is done.
+ */
+static void dump_chunk( dump_job_t *job, int chunk )
+{
+  char tmp_buf[JSON_DUMP_MEMORY_BUFFER_SIZE];
+  dump_slot_t *slot = &job->slots[chunk % job->num_slots];
+  dump_ctx_t ctx;
+  json_dump_t chunk_dump;
+  int i;
+  int end;
+
+  dump_ctx_init( &ctx, slot->mp, 1 );
+  slot->buf = str_buf_create( slot->mp, JSON_DUMP_MEMORY_BUFFER_SIZE );
+  json_dump_init( &chunk_dump, tmp_buf, JSON_DUMP_MEMORY_BUFFER_SIZE,
+                  json_dump_str_buf_output, slot->buf );
+  i = chunk * DUMP_CHUNK_VALUES;
+  end = ( job->nelts - i < DUMP_CHUNK_VALUES ) ? job->nelts :
+                                                 i + DUMP_CHUNK_VALUES;
+  for ( ; i < end; i++ ) {
+    dump_internal( &chunk_dump, job->values[i], i == 0, job->depth,
+                   job->indent, &ctx );
+  }
+  json_dump_flush( &chunk_dump );
+
+  dump_job_lock( job );
+  if ( !ctx.status ) {
+    job->status = FALSE;
+  }
+  slot->done = TRUE;
+  dump_job_signal( job );
+}
+
+#if APR_HAS_THREADS
+static void * APR_THREAD_FUNC dump_worker( apr_thread_t *thread, void *data )
+{
+  dump_job_t *job = (dump_job_t *) data;
+  int chunk;
+
+  dump_job_lock( job );
+  while ( job->next_chunk < job->num_chunks ) {
+    if ( ( chunk = dump_job_take( job ) ) >= 0 ) {
+      dump_job_unlock( job );
+      dump_chunk( job, chunk );
+    }
+    else {
+      dump_job_wait( job );
+    }
+  }
+  dump_job_unlock( job );
+
+  apr_thread_exit( thread, APR_SUCCESS );
+  return NULL;
+}
+#endif
+
+/**
+ * Dump the values of an array or object, which are at depth, on
+ * ctx->threads threads.  The calling thread is one of them, and writes the
+ * chunks out as they are done.
+ */
+static void dump_values_parallel( json_dump_t *dump, json_t **values,
+                                  int nelts, int depth, int indent,
+                                  dump_ctx_t *ctx )
+{
+  apr_pool_t *mp;
+  dump_job_t job;
+  dump_slot_t *slot;
+  int chunk;
+  int i;
+#if APR_HAS_THREADS
+  apr_thread_t **threads;
+  apr_status_t thread_status;
+#endif
+
+  apr_pool_create( &mp, ctx->mp );
+  job.values = values;
+  job.nelts = nelts;
+  job.depth = depth;
+  job.indent = indent;
+  job.num_chunks = ( nelts + DUMP_CHUNK_VALUES - 1 ) / DUMP_CHUNK_VALUES;
+  job.next_chunk = 0;
+  job.written = 0;
+  job.num_slots = ctx->threads * DUMP_CHUNKS_PER_THREAD;
+  job.status = TRUE;
+  job.slots = apr_pcalloc( mp, sizeof(dump_slot_t) * job.num_slots );
+  for ( i = 0; i < job.num_slots; i++ ) {
+    apr_pool_create( &job.slots[i].mp, mp );
+  }
+
+#if APR_HAS_THREADS
+  apr_thread_mutex_create( &job.mutex, APR_THREAD_MUTEX_DEFAULT, mp );
+  apr_thread_cond_create( &job.cond, mp );
+  threads = apr_pcalloc( mp, sizeof(apr_thread_t *) * ctx->threads );
+  for ( i = 1; i < ctx->threads; i++ ) {
+    if ( apr_thread_create( &threads[i], NULL, dump_worker, &job,
+                            mp ) != APR_SUCCESS ) {
+      /* The threads that did start pick up its share. */
+      threads[i] = NULL;
+    }
+  }
+#endif
+
+  dump_job_lock( &job );
+  while ( job.written < job.num_chunks ) {
+    slot = &job.slots[job.written % job.num_slots];
+    if ( slot->done ) {
+      dump_job_unlock( &job );
+      json_dump_write( dump, slot->buf->data, slot->buf->data_len );
+      apr_pool_clear( slot->mp );
+      dump_job_lock( &job );
+      slot->done = FALSE;
+      job.written++;
+      dump_job_signal( &job );
+    }
+    else if ( ( chunk = dump_job_take( &job ) ) >= 0 ) {
+      dump_job_unlock( &job );
+      dump_chunk( &job, chunk );
+    }
+    else {
+      dump_job_wait( &job );
+    }
+  }
+  dump_job_unlock( &job );
+
+#if APR_HAS_THREADS
+  for ( i = 1; i < ctx->threads; i++ ) {
+    if ( threads[i] ) {
+      apr_thread_join( &thread_status, threads[i] );
+    }
+  }
+#endif
+
+  if ( !job.status ) {
+    ctx->status = FALSE;
+  }
+  apr_pool_destroy( mp );
+}
+
+static void dump_object_parallel( json_dump_t *dump, json_t *json,
+                                  int depth, int indent,
+                                  dump_ctx_t *ctx )
+{
+  apr_pool_t *mp;
+  apr_hash_index_t *idx;
+  json_t **values;
+  int nelts = 0;
+
+  apr_pool_create( &mp, ctx->mp );
+  values = apr_palloc( mp, sizeof(json_t *) *
+                       apr_hash_count( json->value.object ) );
+  for ( idx = apr_hash_first( mp, json->value.object ); idx;
+        idx = apr_hash_next( idx ) ) {
+    apr_hash_this( idx, NULL, NULL, (void **) &values[nelts++] );
+  }
+  dump_values_parallel( dump, values, nelts, depth, indent, ctx );
+  apr_pool_destroy( mp );
+}
+
+/**
+ * Serialize json through a buffer of size bytes into output_func.
+ * @return TRUE if every value was dumped.
+ */
+static int dump_json( json_t *json, int indent, char *buf, apr_size_t size,
+                      json_dump_output_func output_func, void *output_data )
+{
+  apr_pool_t *dump_mp;
+  dump_ctx_t ctx;
+  json_dump_t dump;
+
+  apr_pool_create( &dump_mp, NULL );
+  dump_ctx_init( &ctx, dump_mp, 1 );
+  json_dump_init( &dump, buf, size, output_func, output_data );
+  dump_internal( &dump, json, 1, 0, indent, &ctx );
+  json_dump_flush( &dump );
+  apr_pool_destroy( dump_mp );
+
+  return ctx.status;
+}
+
+void json_dump_file_output( void *output_data, const char *data,
+                         apr_size_t len )
+{
+  apr_file_write_full( (apr_file_t *) output_data, data, len, NULL );
+}
+
+void json_dump_str_buf_output( void *output_data, const char *data,
+                            apr_size_t len )
+{
+  str_buf_write( (str_buf_t *) output_data, data, len );
+}
+
+void json_dump_brigade_output( void *output_data, const char *data,
+                            apr_size_t len )
+{
+  apr_brigade_write( (apr_bucket_brigade *) output_data, NULL, NULL,
+                     data, len );
+}
+
+/*
+ * A caller's buffer that is filled as far as it goes, while counting how
+ * much room the whole output needs.
+ */
+typedef struct fixed_buf_t {
+  char *data;
+  apr_size_t size;
+  apr_size_t len;
+} fixed_buf_t;
+
+static void fixed_buf_output( void *output_data, const char *data,
+                              apr_size_t len )
+{
+  fixed_buf_t *fixed_buf = (fixed_buf_t *) output_data;
+  apr_size_t copy_len = 0;
+
+  if ( fixed_buf->len < fixed_buf->size ) {
+    copy_len = fixed_buf->size - fixed_buf->len;
+    copy_len = ( len < copy_len ) ? len : copy_len;
+    memcpy( fixed_buf->data + fixed_buf->len, data, copy_len );
+  }
+  fixed_buf->len += len;
+}
+
+/*
+ * Externally visible function that invokes the internal print function.
+ */
+int json_dump( apr_file_t *out, json_t *json, int indent )
+{
+  return json_dump_threaded( out, json, indent, 1 );
+}
+
+int json_dump_threaded( apr_file_t *out, json_t *json, int indent,
+                        int threads )
+{
+  apr_pool_t *dump_mp;
+  dump_ctx_t ctx;
+  json_dump_t dump;
+
+  apr_pool_create( &dump_mp, NULL );
+
+#if APR_HAS_THREADS
+  dump_ctx_init( &ctx, dump_mp, ( threads > 1 ) ? threads : 1 );
+#else
+  dump_ctx_init( &ctx, dump_mp, 1 );
+#endif
+
+  json_dump_init( &dump, apr_palloc( dump_mp, JSON_DUMP_BUFFER_SIZE ),
+                  JSON_DUMP_BUFFER_SIZE, json_dump_file_output, out );
+  dump_internal( &dump, json, 1, 0, indent, &ctx );
+  json_dump_flush( &dump );
+
+  apr_pool_destroy( dump_mp );
+
+  return ctx.status;
+}
+
+int json_dump_to_str_buf( str_buf_t *buf, json_t *json, int indent )
+{
+  char tmp_buf[JSON_DUMP_MEMORY_BUFFER_SIZE];
+  return dump_json( json, indent, tmp_buf, JSON_DUMP_MEMORY_BUFFER_SIZE,
+                    json_dump_str_buf_output, buf );
+}
+
+char *json_dump_to_buffer( apr_pool_t *mp, json_t *json, int indent )
+{
+  apr_pool_t *tmp_mp;
+  str_buf_t *buf;
+  char *dumped_json;
+
+  apr_pool_create( &tmp_mp, NULL );
+
+  buf = str_buf_create( tmp_mp, JSON_DUMP_MEMORY_BUFFER_SIZE );
+  dumped_json = ( json_dump_to_str_buf( buf, json, indent ) ) ?
+                apr_pstrmemdup( mp, buf->data, buf->data_len ) : NULL;
+
+  apr_pool_destroy( tmp_mp );
+
+  return dumped_json;
+}
+
+apr_size_t json_dump_to_fixed_buffer( char *buf, apr_size_t size,
+                                      json_t *json, int indent )
+{
+  char tmp_buf[JSON_DUMP_MEMORY_BUFFER_SIZE];
+  fixed_buf_t fixed_buf;
+
+  /* Keep room for the terminating NUL. */
+  fixed_buf.data = buf;
+  fixed_buf.size = ( size > 0 ) ? size - 1 : 0;
+  fixed_buf.len = 0;
+
+  dump_json( json, indent, tmp_buf, JSON_DUMP_MEMORY_BUFFER_SIZE,
+             fixed_buf_output, &fixed_buf );
+
+  if ( size > 0 ) {
+    buf[( fixed_buf.len < fixed_buf.size ) ? fixed_buf.len :
+                                             fixed_buf.size] = '\0';
+  }
+
+  return fixed_buf.len;
+}
+
+void json_dump_to_brigade( apr_bucket_brigade *bb, json_t *json, int indent )
+{
+  char tmp_buf[JSON_DUMP_MEMORY_BUFFER_SIZE];
+  dump_json( json, indent, tmp_buf, JSON_DUMP_MEMORY_BUFFER_SIZE,
+             json_dump_brigade_output, bb );
+}
@@ -0,0 +1,84 @@
+/*
+ * json_dump.h
+ *
+ * Description
+ *   Buffered output of JSON text, shared by json_dump and the JSON text
+ *   writer.
+ *
+ * Copyright 2010 Dan Rinehimer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef JSON_DUMP_H
+#define JSON_DUMP_H
+
+#include <apr_general.h>
+
+/** Size of the buffer used to write to a file. */
+#define JSON_DUMP_BUFFER_SIZE ( 256 * 1024 )
+
+/** Size of the buffer used when writing to memory. */
+#define JSON_DUMP_MEMORY_BUFFER_SIZE 4096
+
+/**
+ * Function that takes the output of a dump.
+ */
+typedef void ( *json_dump_output_func )( void *output_data, const char *data,
+                                         apr_size_t len );
+
+/**
+ * Output is collected in buf and handed to the output function when it fills
+ * up.
+ */
+typedef struct json_dump_t {
+  json_dump_output_func output_func;
+  void *output_data;
+  char *buf;
+  apr_size_t size;
+  apr_size_t len;
+} json_dump_t;
+
+/**
+ * Set up a dump that writes through buf, which has to be at least 64 bytes.
+ */
+void json_dump_init( json_dump_t *dump, char *buf, apr_size_t size,
+                     json_dump_output_func output_func, void *output_data );
+
+/**
+ * Hand whatever is in the buffer to the output function.
+ */
+void json_dump_flush( json_dump_t *dump );
+
+void json_dump_write( json_dump_t *dump, const char *str, apr_size_t len );
+void json_dump_char( json_dump_t *dump, char c );
+void json_dump_spaces( json_dump_t *dump, int num );
+
+/**
+ * Write the first len bytes of str as a quoted and escaped JSON string,
+ * stopping early at a NUL.
+ */
+void json_dump_string( json_dump_t *dump, const char *str, apr_size_t len );
+
+void json_dump_integer( json_dump_t *dump, int integer );
+void json_dump_number( json_dump_t *dump, double number );
+
+/** Output functions for an apr_file_t, str_buf_t and apr_bucket_brigade. */
+void json_dump_file_output( void *output_data, const char *data,
+                            apr_size_t len );
+void json_dump_str_buf_output( void *output_data, const char *data,
+                               apr_size_t len );
+void json_dump_brigade_output( void *output_data, const char *data,
+                               apr_size_t len );
+
+#endif
@@ -0,0 +1,379 @@
+/*
+ * json_edit.c
+ *
+ * Description
+ *   Changes a loaded JSON tree in place and remembers which nodes changed.
+ *
+ * Copyright 2010 Dan Rinehimer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <apr_general.h>
+#include <apr_hash.h>
+#include <apr_pools.h>
+#include <apr_strings.h>
+#include <apr_tables.h>
+
+#include "apr_macros.h"
+#include "json.h"
+#include "json_edit.h"
+#include "jxtl_path.h"
+
+typedef struct json_edit_listener_t {
+  json_edit_retire_func func;
+  void *data;
+} json_edit_listener_t;
+
+typedef struct json_edit_stamp_t {
+  /** The node, which is also the key in the stamps hash. */
+  json_t *json;
+  apr_uint64_t generation;
+} json_edit_stamp_t;
+
+json_edit_t *json_edit_create( apr_pool_t *mp, json_t *json )
+{
+  json_edit_t *edit = apr_palloc( mp, sizeof(json_edit_t) );
+
+  edit->mp = mp;
+  apr_pool_create( &edit->tmp_mp, mp );
+  edit->root = json;
+  edit->generation = 0;
+  edit->stamps = apr_hash_make( mp );
+  edit->free_stamps = apr_array_make( mp, 16,
+                                      sizeof(json_edit_stamp_t *) );
+  edit->listeners = apr_array_make( mp, 4, sizeof(json_edit_listener_t) );
+
+  return edit;
+}
+
+static void json_edit_error( const char *error_string, ... )
+{
+  va_list args;
+  fprintf( stderr, "json_edit error:  " );
+  va_start( args, error_string );
+  vfprintf( stderr, error_string, args );
+  fprintf( stderr, "\n" );
+  va_end( args );
+}
+
+/**
+ * Evaluate path from the root.
+ * @return The number of nodes selected, or -1 if path is not valid.
+ */
+static int edit_eval( json_edit_t *edit, const char *path,
+                      jxtl_path_obj_t **obj )
+{
+  int num_nodes;
+
+  apr_pool_clear( edit->tmp_mp );
+  num_nodes = jxtl_path_eval( edit->tmp_mp, path, edit->root, obj );
+  if ( num_nodes < 0 ) {
+    json_edit_error( "could not parse path \"%s\"", path );
+  }
+
+  return num_nodes;
+}
+
+/**
+ * Evaluate a path that has to select a single object.
+ */
+static jxtl_path_frame_t *edit_eval_object( json_edit_t *edit,
+                                            const char *path )
+{
+  jxtl_path_obj_t *obj;
+  jxtl_path_frame_t *frame;
+  int num_nodes = edit_eval( edit, path, &obj );
+
+  if ( num_nodes < 0 ) {
+    return NULL;
+  }
+  else if ( num_nodes != 1 ) {
+    json_edit_error( "\"%s\" selects %d nodes instead of one", path,
+                     num_nodes );
+    return NULL;
+  }
+
+  frame = APR_ARRAY_HEAD( obj->frames, jxtl_path_frame_t * );
+  if ( !JSON_IS_OBJECT( frame->json ) ) {
+    json_edit_error( "\"%s\" is not an object", path );
+    return NULL;
+  }
+
+  return frame;
+}
+
+/**
+ * Stamp the node in frame and all of its ancestors with the current
+ * generation.
+ */
+static void mark_changed( json_edit_t *edit, jxtl_path_frame_t *frame )
+{
+  json_edit_stamp_t *stamp;
+
+  for ( ; frame; frame = frame->parent ) {
+    stamp = apr_hash_get( edit->stamps, &frame->json, sizeof(json_t *) );
+    if ( !stamp ) {
+      stamp = ( edit->free_stamps->nelts > 0 ) ?
+              APR_ARRAY_POP( edit->free_stamps, json_edit_stamp_t * ) :
+              apr_palloc( edit->mp, sizeof(json_edit_stamp_t) );
+      stamp->json = frame->json;
+      apr_hash_set( edit->stamps, &stamp->json, sizeof(json_t *), stamp );
+    }
+    stamp->generation = edit->generation;
+  }
+}
+
+/**
+ * Forget the stamps of a subtree that left the tree and tell the listeners
+ * about its nodes.
+ */
+static void retire( json_edit_t *edit, json_t *json )
+{
+  int i;
+  json_edit_stamp_t *stamp;
+  apr_hash_index_t *idx;
+  json_t *tmp_json;
+  json_edit_listener_t *listener;
+
+  stamp = apr_hash_get( edit->stamps, &json, sizeof(json_t *) );
+  if ( stamp ) {
+    APR_ARRAY_PUSH( edit->free_stamps, json_edit_stamp_t * ) = stamp;
+    apr_hash_set( edit->stamps, &json, sizeof(json_t *), NULL );
+  }
+
+  for ( i = 0; i < edit->listeners->nelts; i++ ) {
+    listener = &APR_ARRAY_IDX( edit->listeners, i, json_edit_listener_t );
+    listener->func( listener->data, json );
+  }
+
+  if ( JSON_IS_OBJECT( json ) ) {
+    for ( idx = apr_hash_first( edit->tmp_mp, json->value.object ); idx;
+          idx = apr_hash_next( idx ) ) {
+      apr_hash_this( idx, NULL, NULL, (void **) &tmp_json );
+      retire( edit, tmp_json );
+    }
+  }
+  else if ( JSON_IS_ARRAY( json ) ) {
+    for ( i = 0; i < json->value.array->nelts; i++ ) {
+      retire( edit, APR_ARRAY_IDX( json->value.array, i, json_t * ) );
+    }
+  }
+}
+
+/**
+ * Put value in the slot that old was in, if the object has one for it.
+ */
+static void replace_slot( json_t *obj, json_t *old, json_t *value )
+{
+  int i;
+
+  for ( i = 0; JSON_HAS_SLOTS( obj ) && i < obj->len; i++ ) {
+    if ( obj->value.schema_object.slots[i] == old ) {
+      obj->value.schema_object.slots[i] = value;
+      break;
+    }
+  }
+}
+
+int json_edit_set( json_edit_t *edit, const char *path, const char *name,
+                   json_t *value )
+{
+  jxtl_path_frame_t *frame;
+  json_t *obj;
+  json_t *old;
+
+  if ( !( frame = edit_eval_object( edit, path ) ) )
+    return FALSE;
+
+  obj = frame->json;
+  old = apr_hash_get( obj->value.object, name, APR_HASH_KEY_STRING );
+
+  if ( old == value ) {
+    /* Setting a property to itself, it might have changed in place. */
+  }
+  else if ( old ) {
+    /*
+     * Reuse the old name; an object loaded with a schema shares it with
+     * the schema, which is how slot lookups know the slot is right.
+     */
+    value->name = old->name;
+    apr_hash_set( obj->value.object, value->name, APR_HASH_KEY_STRING,
+                  value );
+    replace_slot( obj, old, value );
+    retire( edit, old );
+  }
+  else {
+    value->name = apr_pstrdup( edit->mp, name );
+    apr_hash_set( obj->value.object, value->name, APR_HASH_KEY_STRING,
+                  value );
+  }
+
+  /* The value is stamped too, it is new or may have changed in place. */
+  edit->generation++;
+  mark_changed( edit, jxtl_path_frame_create( edit->tmp_mp, frame, value ) );
+
+  return TRUE;
+}
+
+int json_edit_insert( json_edit_t *edit, const char *path, const char *name,
+                      int index, json_t *value )
+{
+  jxtl_path_frame_t *frame;
+  json_t *array;
+  apr_array_header_t *elts;
+
+  if ( !( frame = edit_eval_object( edit, path ) ) )
+    return FALSE;
+
+  array = apr_hash_get( frame->json->value.object, name,
+                        APR_HASH_KEY_STRING );
+  if ( !array || !JSON_IS_ARRAY( array ) ) {
+    json_edit_error( "\"%s\" is not an array", name );
+    return FALSE;
+  }
+
+  elts = array->value.array;
+  if ( index < -1 || index > elts->nelts ) {
+    json_edit_error( "index %d is out of range for \"%s\"", index, name );
+    return FALSE;
+  }
+
+  value->name = NULL;
+  APR_ARRAY_PUSH( elts, json_t * ) = value;
+  if ( index >= 0 ) {
+    memmove( &APR_ARRAY_IDX( elts, index + 1, json_t * ),
+             &APR_ARRAY_IDX( elts, index, json_t * ),
+             sizeof(json_t *) * ( elts->nelts - index - 1 ) );
+    APR_ARRAY_IDX( elts, index, json_t * ) = value;
+  }
+
+  edit->generation++;
+  mark_changed( edit, jxtl_path_frame_create( edit->tmp_mp, frame, array ) );
+
+  return TRUE;
+}
+
+/**
+ * Take json out of the object or array in parent.
+ */
+static int remove_node( json_t *parent, json_t *json )
+{
+  int i;
+  apr_array_header_t *elts;
+
+  if ( JSON_IS_ARRAY( parent ) ) {
+    elts = parent->value.array;
+    for ( i = 0; i < elts->nelts; i++ ) {
+      if ( APR_ARRAY_IDX( elts, i, json_t * ) == json ) {
+        memmove( &APR_ARRAY_IDX( elts, i, json_t * ),
+                 &APR_ARRAY_IDX( elts, i + 1, json_t * ),
+                 sizeof(json_t *) * ( elts->nelts - i - 1 ) );
+        elts->nelts--;
+        return TRUE;
+      }
+    }
+  }
+  else if ( JSON_IS_OBJECT( parent ) && JSON_NAME( json ) &&
+            apr_hash_get( parent->value.object, JSON_NAME( json ),
+                          APR_HASH_KEY_STRING ) == json ) {
+    apr_hash_set( parent->value.object, JSON_NAME( json ),
+                  APR_HASH_KEY_STRING, NULL );
+    replace_slot( parent, json, NULL );
+    return TRUE;
+  }
+
+  return FALSE;
+}
+
+int json_edit_remove( json_edit_t *edit, const char *path )
+{
+  int i;
+  int num_removed = 0;
+  jxtl_path_obj_t *obj;
+  jxtl_path_frame_t *frame;
+
+  if ( edit_eval( edit, path, &obj ) <= 0 )
+    return 0;
+
+  edit->generation++;
+
+  for ( i = 0; i < obj->frames->nelts; i++ ) {
+    frame = APR_ARRAY_IDX( obj->frames, i, jxtl_path_frame_t * );
+    if ( !frame->parent ) {
+      json_edit_error( "the root can't be removed" );
+    }
+    else if ( remove_node( frame->parent->json, frame->json ) ) {
+      mark_changed( edit, frame->parent );
+      retire( edit, frame->json );
+      num_removed++;
+    }
+  }
+
+  return num_removed;
+}
+
+int json_edit_touch( json_edit_t *edit, const char *path )
+{
+  int i;
+  jxtl_path_obj_t *obj;
+
+  if ( edit_eval( edit, path, &obj ) <= 0 )
+    return 0;
+
+  edit->generation++;
+
+  for ( i = 0; i < obj->frames->nelts; i++ ) {
+    mark_changed( edit, APR_ARRAY_IDX( obj->frames, i,
+                                       jxtl_path_frame_t * ) );
+  }
+
+  return obj->frames->nelts;
+}
+
+apr_uint64_t json_edit_stamp( json_edit_t *edit, json_t *json )
+{
+  json_edit_stamp_t *stamp = apr_hash_get( edit->stamps, &json,
+                                           sizeof(json_t *) );
+  return ( stamp ) ? stamp->generation : 0;
+}
+
+void json_edit_add_listener( json_edit_t *edit, json_edit_retire_func func,
+                             void *data )
+{
+  json_edit_listener_t *listener;
+
+  listener = &APR_ARRAY_PUSH( edit->listeners, json_edit_listener_t );
+  listener->func = func;
+  listener->data = data;
+}
+
+void json_edit_remove_listener( json_edit_t *edit,
+                                json_edit_retire_func func, void *data )
+{
+  int i;
+  json_edit_listener_t *listener;
+
+  for ( i = 0; i < edit->listeners->nelts; i++ ) {
+    listener = &APR_ARRAY_IDX( edit->listeners, i, json_edit_listener_t );
+    if ( listener->func == func && listener->data == data ) {
+      memmove( listener, listener + 1, sizeof(json_edit_listener_t) *
+               ( edit->listeners->nelts - i - 1 ) );
+      edit->listeners->nelts--;
+      break;
+    }
+  }
+}
@@ -0,0 +1,128 @@
+/*
+ * json_edit.h
+ *
+ * Description
+ *   Changes a loaded JSON tree in place and remembers which nodes changed.
+ *
+ * Copyright 2010 Dan Rinehimer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef JSON_EDIT_H
+#define JSON_EDIT_H
+
+#include <apr_general.h>
+#include <apr_hash.h>
+#include <apr_pools.h>
+#include <apr_tables.h>
+
+#include "json.h"
+
+/**
+ * Called for every node of a subtree that was removed from the tree or
+ * replaced.
+ */
+typedef void ( *json_edit_retire_func )( void *data, json_t *json );
+
+/**
+ * Nodes don't know their parent, so changes are addressed with path
+ * expressions evaluated from the root, and the path taken gives the
+ * ancestors of the node that changed.  Every change starts a new generation,
+ * and the node that changed and each of its ancestors are stamped with it.
+ * Nodes that were never changed have generation 0.
+ *
+ * The tree must not be shared (see json_share) and must only be changed
+ * through the edit, or with json_edit_touch afterwards.
+ */
+typedef struct json_edit_t {
+  /** The pool the tree lives in.  New names are allocated from it. */
+  apr_pool_t *mp;
+  /** Scratch pool for evaluating paths. */
+  apr_pool_t *tmp_mp;
+  json_t *root;
+  /** The generation of the last change. */
+  apr_uint64_t generation;
+  /** The generation each changed node was last changed in. */
+  apr_hash_t *stamps;
+  /** Stamps of retired nodes, to be reused. */
+  apr_array_header_t *free_stamps;
+  /** Who to tell about retired nodes. */
+  apr_array_header_t *listeners;
+} json_edit_t;
+
+/**
+ * Start editing a tree.
+ * @param mp The pool the tree was loaded into.
+ * @param json The root of the tree.
+ */
+json_edit_t *json_edit_create( apr_pool_t *mp, json_t *json );
+
+/**
+ * Set a property of an object, replacing the value it had.
+ * @param edit The edit.
+ * @param path Selects exactly one object.
+ * @param name The name of the property.
+ * @param value The new value, which is given the name.  It shouldn't already
+ *        be in the tree, unless it is the property's value, which may have
+ *        been changed in place.  It is then marked as changed.
+ * @return TRUE if the property was set.
+ */
+int json_edit_set( json_edit_t *edit, const char *path, const char *name,
+                   json_t *value );
+
+/**
+ * Insert a value into an array property of an object.
+ * @param edit The edit.
+ * @param path Selects exactly one object.
+ * @param name The name of the array property.
+ * @param index Where to insert value, or -1 to append it.
+ * @param value The value, which is given a NULL name like all array
+ *        elements.
+ * @return TRUE if the value was inserted.
+ */
+int json_edit_insert( json_edit_t *edit, const char *path, const char *name,
+                      int index, json_t *value );
+
+/**
+ * Remove the nodes a path selects from the objects or arrays they are in.
+ * @return The number of nodes removed.
+ */
+int json_edit_remove( json_edit_t *edit, const char *path );
+
+/**
+ * Mark the nodes a path selects as changed, after changing their value in
+ * place.
+ * @return The number of nodes marked.
+ */
+int json_edit_touch( json_edit_t *edit, const char *path );
+
+/**
+ * @return The generation json was last changed in, or 0.
+ */
+apr_uint64_t json_edit_stamp( json_edit_t *edit, json_t *json );
+
+/**
+ * Call func for the nodes of every subtree taken out of the tree from now
+ * on.
+ */
+void json_edit_add_listener( json_edit_t *edit, json_edit_retire_func func,
+                             void *data );
+
+/**
+ * Stop calling a function added with json_edit_add_listener.
+ */
+void json_edit_remove_listener( json_edit_t *edit,
+                                json_edit_retire_func func, void *data );
+
+#endif
@@ -0,0 +1,463 @@
+/*
+ * json_number.c
+ *
+ * Description
+ *   Conversion of integers and numbers to JSON text.  Numbers are converted
+ *   with the Grisu2 algorithm from Florian Loitsch, "Printing Floating-Point
+ *   Numbers Quickly and Accurately with Integers" (PLDI 2010).  Its output
+ *   always reads back as the same number and is the shortest such text for
+ *   all but a tiny fraction of inputs.
+ *
+ * Copyright 2010 Dan Rinehimer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include <apr_general.h>
+
+#include "json_number.h"
+
+static const char digit_pairs[] =
+  "00010203040506070809"
+  "10111213141516171819"
+  "20212223242526272829"
+  "30313233343536373839"
+  "40414243444546474849"
+  "50515253545556575859"
+  "60616263646566676869"
+  "70717273747576777879"
+  "80818283848586878889"
+  "90919293949596979899";
+
+/**
+ * Write value in decimal, two digits at a time from the end.
+ * @return The number of digits.
+ */
+static apr_size_t format_unsigned( char *buf, apr_uint32_t value )
+{
+  char tmp[10];
+  char *ptr = tmp + sizeof(tmp);
+  apr_size_t len;
+
+  while ( value >= 100 ) {
+    ptr -= 2;
+    memcpy( ptr, digit_pairs + ( value % 100 ) * 2, 2 );
+    value /= 100;
+  }
+
+  if ( value >= 10 ) {
+    ptr -= 2;
+    memcpy( ptr, digit_pairs + value * 2, 2 );
+  }
+  else {
+    *--ptr = '0' + value;
+  }
+
+  len = tmp + sizeof(tmp) - ptr;
+  memcpy( buf, ptr, len );
+
+  return len;
+}
+
+apr_size_t json_format_integer( char *buf, int integer )
+{
+  apr_size_t len = 0;
+  apr_uint32_t value = (apr_uint32_t) integer;
+
+  if ( integer < 0 ) {
+    buf[len++] = '-';
+    value = 0 - value;
+  }
+
+  len += format_unsigned( buf + len, value );
+  buf[len] = '\0';
+
+  return len;
+}
+
+#define DOUBLE_SIGNIFICAND_SIZE 52
+#define DOUBLE_EXPONENT_BIAS ( 0x3ff + DOUBLE_SIGNIFICAND_SIZE )
+#define DOUBLE_EXPONENT_MASK 0x7ff0000000000000ULL
+#define DOUBLE_SIGNIFICAND_MASK 0x000fffffffffffffULL
+#define DOUBLE_HIDDEN_BIT 0x0010000000000000ULL
+#define DOUBLE_SIGN_BIT 0x8000000000000000ULL
+
+/**
+ * A floating point number f * 2^e with a 64 bit significand.
+ */
+typedef struct diy_fp_t {
+  apr_uint64_t f;
+  int e;
+} diy_fp_t;
+
+/*
+ * Normalized powers of ten from 10^-348 to 10^340 in steps of 8.
+ */
+static const apr_uint64_t cached_powers_f[] = {
+  0xfa8fd5a0081c0288ULL, 0xbaaee17fa23ebf76ULL, 0x8b16fb203055ac76ULL,
+  0xcf42894a5dce35eaULL, 0x9a6bb0aa55653b2dULL, 0xe61acf033d1a45dfULL,
+  0xab70fe17c79ac6caULL, 0xff77b1fcbebcdc4fULL, 0xbe5691ef416bd60cULL,
+  0x8dd01fad907ffc3cULL, 0xd3515c2831559a83ULL, 0x9d71ac8fada6c9b5ULL,
+  0xea9c227723ee8bcbULL, 0xaecc49914078536dULL, 0x823c12795db6ce57ULL,
+  0xc21094364dfb5637ULL, 0x9096ea6f3848984fULL, 0xd77485cb25823ac7ULL,
+  0xa086cfcd97bf97f4ULL, 0xef340a98172aace5ULL, 0xb23867fb2a35b28eULL,
+  0x84c8d4dfd2c63f3bULL, 0xc5dd44271ad3cdbaULL, 0x936b9fcebb25c996ULL,
+  0xdbac6c247d62a584ULL, 0xa3ab66580d5fdaf6ULL, 0xf3e2f893dec3f126ULL,
+  0xb5b5ada8aaff80b8ULL, 0x87625f056c7c4a8bULL, 0xc9bcff6034c13053ULL,
+  0x964e858c91ba2655ULL, 0xdff9772470297ebdULL, 0xa6dfbd9fb8e5b88fULL,
+  0xf8a95fcf88747d94ULL, 0xb94470938fa89bcfULL, 0x8a08f0f8bf0f156bULL,
+  0xcdb02555653131b6ULL, 0x993fe2c6d07b7facULL, 0xe45c10c42a2b3b06ULL,
+  0xaa242499697392d3ULL, 0xfd87b5f28300ca0eULL, 0xbce5086492111aebULL,
+  0x8cbccc096f5088ccULL, 0xd1b71758e219652cULL, 0x9c40000000000000ULL,
+  0xe8d4a51000000000ULL, 0xad78ebc5ac620000ULL, 0x813f3978f8940984ULL,
+  0xc097ce7bc90715b3ULL, 0x8f7e32ce7bea5c70ULL, 0xd5d238a4abe98068ULL,
+  0x9f4f2726179a2245ULL, 0xed63a231d4c4fb27ULL, 0xb0de65388cc8ada8ULL,
+  0x83c7088e1aab65dbULL, 0xc45d1df942711d9aULL, 0x924d692ca61be758ULL,
+  0xda01ee641a708deaULL, 0xa26da3999aef774aULL, 0xf209787bb47d6b85ULL,
+  0xb454e4a179dd1877ULL, 0x865b86925b9bc5c2ULL, 0xc83553c5c8965d3dULL,
+  0x952ab45cfa97a0b3ULL, 0xde469fbd99a05fe3ULL, 0xa59bc234db398c25ULL,
+  0xf6c69a72a3989f5cULL, 0xb7dcbf5354e9beceULL, 0x88fcf317f22241e2ULL,
+  0xcc20ce9bd35c78a5ULL, 0x98165af37b2153dfULL, 0xe2a0b5dc971f303aULL,
+  0xa8d9d1535ce3b396ULL, 0xfb9b7cd9a4a7443cULL, 0xbb764c4ca7a44410ULL,
+  0x8bab8eefb6409c1aULL, 0xd01fef10a657842cULL, 0x9b10a4e5e9913129ULL,
+  0xe7109bfba19c0c9dULL, 0xac2820d9623bf429ULL, 0x80444b5e7aa7cf85ULL,
+  0xbf21e44003acdd2dULL, 0x8e679c2f5e44ff8fULL, 0xd433179d9c8cb841ULL,
+  0x9e19db92b4e31ba9ULL, 0xeb96bf6ebadf77d9ULL, 0xaf87023b9bf0ee6bULL
+};
+
+static const short cached_powers_e[] = {
+  -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980,
+  -954, -927, -901, -874, -847, -821, -794, -768, -741, -715,
+  -688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+  -422, -396, -369, -343, -316, -289, -263, -236, -210, -183,
+  -157, -130, -103, -77, -50, -24, 3, 30, 56, 83,
+  109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+  375, 402, 428, 455, 481, 508, 534, 561, 588, 614,
+  641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+  907, 933, 960, 986, 1013, 1039, 1066
+};
+
+static const apr_uint64_t powers_of_ten[] = {
+  1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+  10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL,
+  100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+  100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+  100000000000000000ULL, 1000000000000000000ULL,
+  10000000000000000000ULL
+};
+
+static diy_fp_t diy_fp_multiply( diy_fp_t x, diy_fp_t y )
+{
+  const apr_uint64_t mask = 0xffffffffULL;
+  apr_uint64_t a = x.f >> 32;
+  apr_uint64_t b = x.f & mask;
+  apr_uint64_t c = y.f >> 32;
+  apr_uint64_t d = y.f & mask;
+  apr_uint64_t ac = a * c;
+  apr_uint64_t bc = b * c;
+  apr_uint64_t ad = a * d;
+  apr_uint64_t bd = b * d;
+  apr_uint64_t tmp = ( bd >> 32 ) + ( ad & mask ) + ( bc & mask );
+  diy_fp_t result;
+
+  /* Round the low half. */
+  tmp += 1ULL << 31;
+  result.f = ac + ( ad >> 32 ) + ( bc >> 32 ) + ( tmp >> 32 );
+  result.e = x.e + y.e + 64;
+
+  return result;
+}
+
+static diy_fp_t diy_fp_normalize( diy_fp_t x )
+{
+  while ( !( x.f & DOUBLE_SIGN_BIT ) ) {
+    x.f <<= 1;
+    x.e--;
+  }
+  return x;
+}
+
+/**
+ * Compute the bounds of the interval of reals that round to v, normalized
+ * to the exponent of the upper bound.
+ */
+static void normalized_boundaries( diy_fp_t v, diy_fp_t *minus,
+                                   diy_fp_t *plus )
+{
+  diy_fp_t pl;
+  diy_fp_t mi;
+
+  pl.f = ( v.f << 1 ) + 1;
+  pl.e = v.e - 1;
+  while ( !( pl.f & ( DOUBLE_HIDDEN_BIT << 1 ) ) ) {
+    pl.f <<= 1;
+    pl.e--;
+  }
+  pl.f <<= 64 - DOUBLE_SIGNIFICAND_SIZE - 2;
+  pl.e -= 64 - DOUBLE_SIGNIFICAND_SIZE - 2;
+
+  /* The gap below a power of two is half the size of the one above. */
+  if ( v.f == DOUBLE_HIDDEN_BIT ) {
+    mi.f = ( v.f << 2 ) - 1;
+    mi.e = v.e - 2;
+  }
+  else {
+    mi.f = ( v.f << 1 ) - 1;
+    mi.e = v.e - 1;
+  }
+  mi.f <<= mi.e - pl.e;
+  mi.e = pl.e;
+
+  *plus = pl;
+  *minus = mi;
+}
+
+/**
+ * Find a cached power of ten c such that multiplying by it brings an
+ * exponent of e into the range [-60, -32].
+ * @param k Set to the decimal exponent of 1/c.
+ */
+static diy_fp_t cached_power( int e, int *k )
+{
+  double dk = ( -61 - e ) * 0.30102999566398114 + 347;
+  int ik = (int) dk;
+  int index;
+  diy_fp_t c;
+
+  if ( dk - ik > 0.0 ) {
+    ik++;
+  }
+
+  index = ( ik >> 3 ) + 1;
+  *k = -( -348 + index * 8 );
+
+  c.f = cached_powers_f[index];
+  c.e = cached_powers_e[index];
+
+  return c;
+}
+
+/**
+ * Move the last digit towards w while staying inside the interval.
+ */
+static void grisu_round( char *buf, int len, apr_uint64_t delta,
+                         apr_uint64_t rest, apr_uint64_t ten_kappa,
+                         apr_uint64_t wp_w )
+{
+  while ( rest < wp_w && delta - rest >= ten_kappa &&
+          ( rest + ten_kappa < wp_w ||
+            wp_w - rest > rest + ten_kappa - wp_w ) ) {
+    buf[len - 1]--;
+    rest += ten_kappa;
+  }
+}
+
+static int count_digits( apr_uint32_t n )
+{
+  int digits = 1;
+
+  while ( digits < 10 && n >= powers_of_ten[digits] ) {
+    digits++;
+  }
+
+  return digits;
+}
+
+/**
+ * Generate the shortest digits of a number in (w - delta, w].
+ */
+static void digit_gen( diy_fp_t w, diy_fp_t mp, apr_uint64_t delta,
+                       char *buf, int *len, int *k )
+{
+  diy_fp_t one;
+  apr_uint64_t wp_w = mp.f - w.f;
+  apr_uint64_t p2;
+  apr_uint64_t tmp;
+  apr_uint32_t p1;
+  apr_uint32_t d;
+  int kappa;
+
+  one.f = 1ULL << -mp.e;
+  one.e = mp.e;
+  p1 = (apr_uint32_t) ( mp.f >> -one.e );
+  p2 = mp.f & ( one.f - 1 );
+  kappa = count_digits( p1 );
+  *len = 0;
+
+  while ( kappa > 0 ) {
+    d = p1 / (apr_uint32_t) powers_of_ten[kappa - 1];
+    p1 %= (apr_uint32_t) powers_of_ten[kappa - 1];
+    if ( d || *len ) {
+      buf[(*len)++] = '0' + d;
+    }
+    kappa--;
+    tmp = ( (apr_uint64_t) p1 << -one.e ) + p2;
+    if ( tmp <= delta ) {
+      *k += kappa;
+      grisu_round( buf, *len, delta, tmp, powers_of_ten[kappa] << -one.e,
+                   wp_w );
+      return;
+    }
+  }
+
+  for ( ;; ) {
+    p2 *= 10;
+    delta *= 10;
+    d = (apr_uint32_t) ( p2 >> -one.e );
+    if ( d || *len ) {
+      buf[(*len)++] = '0' + d;
+    }
+    p2 &= one.f - 1;
+    kappa--;
+    if ( p2 < delta ) {
+      *k += kappa;
+      grisu_round( buf, *len, delta, p2, one.f,
+                   ( -kappa < 20 ) ? wp_w * powers_of_ten[-kappa] : 0 );
+      return;
+    }
+  }
+}
+
+/**
+ * Write the digits of a positive, finite number.  The number is the digits
+ * times 10^k.
+ */
+static void grisu2( apr_uint64_t bits, char *buf, int *len, int *k )
+{
+  diy_fp_t v;
+  diy_fp_t w_m;
+  diy_fp_t w_p;
+  diy_fp_t c_mk;
+  diy_fp_t w;
+  diy_fp_t wp;
+  diy_fp_t wm;
+  int biased_e = (int) ( ( bits & DOUBLE_EXPONENT_MASK ) >>
+                         DOUBLE_SIGNIFICAND_SIZE );
+
+  v.f = bits & DOUBLE_SIGNIFICAND_MASK;
+  if ( biased_e != 0 ) {
+    v.f += DOUBLE_HIDDEN_BIT;
+    v.e = biased_e - DOUBLE_EXPONENT_BIAS;
+  }
+  else {
+    v.e = 1 - DOUBLE_EXPONENT_BIAS;
+  }
+
+  normalized_boundaries( v, &w_m, &w_p );
+  c_mk = cached_power( w_p.e, k );
+  w = diy_fp_multiply( diy_fp_normalize( v ), c_mk );
+  wp = diy_fp_multiply( w_p, c_mk );
+  wm = diy_fp_multiply( w_m, c_mk );
+  /* Stay clear of the rounding error of the multiplications. */
+  wm.f++;
+  wp.f--;
+
+  digit_gen( w, wp, wp.f - wm.f, buf, len, k );
+}
+
+static int format_exponent( char *buf, int exponent )
+{
+  int len = 0;
+
+  buf[len++] = 'e';
+  if ( exponent < 0 ) {
+    buf[len++] = '-';
+    exponent = -exponent;
+  }
+  else {
+    buf[len++] = '+';
+  }
+
+  return len + format_unsigned( buf + len, exponent );
+}
+
+/**
+ * Lay out len digits times 10^k in buf, which they are already at the start
+ * of.
+ * @return The length of the text.
+ */
+static int format_digits( char *buf, int len, int k )
+{
+  /* The number is in [10^(kk-1), 10^kk). */
+  int kk = len + k;
+
+  if ( k >= 0 && kk <= 21 ) {
+    /* 1234e7 -> 12340000000 */
+    memset( buf + len, '0', k );
+    return kk;
+  }
+  else if ( kk > 0 && kk <= 21 ) {
+    /* 1234e-2 -> 12.34 */
+    memmove( buf + kk + 1, buf + kk, len - kk );
+    buf[kk] = '.';
+    return len + 1;
+  }
+  else if ( kk > -6 && kk <= 0 ) {
+    /* 1234e-6 -> 0.001234 */
+    memmove( buf + 2 - kk, buf, len );
+    buf[0] = '0';
+    buf[1] = '.';
+    memset( buf + 2, '0', -kk );
+    return len + 2 - kk;
+  }
+  else if ( len == 1 ) {
+    /* 1e30 */
+    return 1 + format_exponent( buf + 1, kk - 1 );
+  }
+  else {
+    /* 1234e30 -> 1.234e+33 */
+    memmove( buf + 2, buf + 1, len - 1 );
+    buf[1] = '.';
+    return len + 1 + format_exponent( buf + len + 1, kk - 1 );
+  }
+}
+
+apr_size_t json_format_number( char *buf, double number )
+{
+  apr_uint64_t bits;
+  apr_size_t len = 0;
+  int digits;
+  int k;
+
+  memcpy( &bits, &number, sizeof(bits) );
+
+  if ( ( bits & DOUBLE_EXPONENT_MASK ) == DOUBLE_EXPONENT_MASK ) {
+    if ( bits & DOUBLE_SIGNIFICAND_MASK ) {
+      memcpy( buf, "nan", 4 );
+      return 3;
+    }
+    else if ( bits & DOUBLE_SIGN_BIT ) {
+      memcpy( buf, "-inf", 5 );
+      return 4;
+    }
+    memcpy( buf, "inf", 4 );
+    return 3;
+  }
+
+  if ( bits & DOUBLE_SIGN_BIT ) {
+    buf[len++] = '-';
+    bits &= ~DOUBLE_SIGN_BIT;
+  }
+
+  if ( bits == 0 ) {
+    buf[len++] = '0';
+  }
+  else {
+    grisu2( bits, buf + len, &digits, &k );
+    len += format_digits( buf + len, digits, k );
+  }
+  buf[len] = '\0';
+
+  return len;
+}
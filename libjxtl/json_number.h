@@ -0,0 +1,52 @@
+/*
+ * json_number.h
+ *
+ * Description
+ *   Conversion of integers and numbers to JSON text.
+ *
+ * Copyright 2010 Dan Rinehimer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef JSON_NUMBER_H
+#define JSON_NUMBER_H
+
+#include <apr_general.h>
+
+/**
+ * Size of a buffer that can hold any formatted integer or number and its
+ * terminating NUL.
+ */
+#define JSON_NUMBER_BUFFER_SIZE 32
+
+/**
+ * Write an integer in decimal.
+ * @param buf Buffer of at least JSON_NUMBER_BUFFER_SIZE bytes.
+ * @param integer The integer.
+ * @return The length of the text, which is NUL terminated.
+ */
+apr_size_t json_format_integer( char *buf, int integer );
+
+/**
+ * Write the shortest text that reads back as exactly number.  The text does
+ * not depend on the locale.  Numbers from 1e-6 up to 1e21 are written
+ * without an exponent, others like 1.5e+300.  NaN and infinities, which JSON
+ * can't represent, are written as nan, inf and -inf.
+ * @param buf Buffer of at least JSON_NUMBER_BUFFER_SIZE bytes.
+ * @param number The number.
+ * @return The length of the text, which is NUL terminated.
+ */
+apr_size_t json_format_number( char *buf, double number );
+
+#endif
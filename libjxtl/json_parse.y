@@ -43,6 +43,18 @@
     }                                                                   \
  } while ( 0 )
 
+/* The lexer passes the text of numbers if there is a handler for it. */
+#define number_lexemes                                                  \
+  ( callbacks_ptr &&                                                    \
+    ((json_callback_t *) callbacks_ptr)->number_lexeme_handler )
+
+#define number_callback( func, value, text ) do {                       \
+    if ( number_lexemes )                                               \
+      callback( number_lexeme_handler, text );                          \
+    else                                                                \
+      callback( func, value );                                          \
+  } while ( 0 )
+
 int json_lex( YYSTYPE *yylval_param, YYLTYPE *yylloc_param,
               yyscan_t yyscanner );
 void json_error( YYLTYPE *yylloc, yyscan_t scanner, parser_t *parser,
@@ -111,8 +123,8 @@ elements
 
 value
   : T_STRING { callback( string_handler, $<string>1 ); }
-  | T_INTEGER { callback( integer_handler, $<integer>1 ); }
-  | T_NUMBER { callback( number_handler, $<number>1 ); }
+  | T_INTEGER { number_callback( integer_handler, $<integer>1, $<string>1 ); }
+  | T_NUMBER { number_callback( number_handler, $<number>1, $<string>1 ); }
   | object
   | array
   | T_TRUE { callback( boolean_handler, 1 ); }
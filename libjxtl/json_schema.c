@@ -0,0 +1,156 @@
+/*
+ * json_schema.c
+ *
+ * Description
+ *   Schemas that describe the shape of a data dictionary.
+ *
+ * Copyright 2010 Dan Rinehimer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <apr_general.h>
+#include <apr_hash.h>
+#include <apr_pools.h>
+#include <apr_strings.h>
+
+#include "json.h"
+#include "json_schema.h"
+
+#define JSON_SCHEMA_KEY "json_schema"
+
+static const char *schema_types[] = {
+  "string", "integer", "number", "object", "array", "boolean", "null", NULL
+};
+
+static const json_type schema_json_types[] = {
+  JSON_STRING, JSON_INTEGER, JSON_NUMBER, JSON_OBJECT, JSON_ARRAY,
+  JSON_BOOLEAN, JSON_NULL
+};
+
+static json_t *schema_get( json_t *json, const char *name )
+{
+  return apr_hash_get( json->value.object, name, APR_HASH_KEY_STRING );
+}
+
+static json_schema_t *schema_create( apr_pool_t *mp, json_t *json,
+                                     const char *name, int slot )
+{
+  json_schema_t *schema;
+  json_schema_t *prop_schema;
+  json_t *tmp_json;
+  json_t *prop_json;
+  apr_hash_index_t *idx;
+  int i;
+
+  if ( !JSON_IS_OBJECT( json ) ) {
+    fprintf( stderr, "schema error:  schema for \"%s\" is not an object\n",
+             name ? name : "/" );
+    return NULL;
+  }
+
+  schema = apr_palloc( mp, sizeof(json_schema_t) );
+  schema->type = JSON_SCHEMA_ANY;
+  schema->name = ( name ) ? apr_pstrdup( mp, name ) : NULL;
+  schema->slot = slot;
+  schema->properties = NULL;
+  schema->num_slots = 0;
+  schema->items = NULL;
+
+  tmp_json = schema_get( json, "type" );
+  if ( tmp_json ) {
+    for ( i = 0; JSON_IS_STRING( tmp_json ) && schema_types[i]; i++ ) {
+      if ( strcmp( JSON_STRING_VALUE( tmp_json ), schema_types[i] ) == 0 ) {
+        schema->type = schema_json_types[i];
+        break;
+      }
+    }
+    if ( schema->type == JSON_SCHEMA_ANY ) {
+      fprintf( stderr, "schema error:  unknown type for \"%s\"\n",
+               name ? name : "/" );
+      return NULL;
+    }
+  }
+
+  tmp_json = schema_get( json, "properties" );
+  if ( tmp_json && JSON_IS_OBJECT( tmp_json ) ) {
+    schema->properties = apr_hash_make( mp );
+    for ( idx = apr_hash_first( mp, tmp_json->value.object ); idx;
+          idx = apr_hash_next( idx ) ) {
+      apr_hash_this( idx, NULL, NULL, (void **) &prop_json );
+      prop_schema = schema_create( mp, prop_json, JSON_NAME( prop_json ),
+                                   schema->num_slots++ );
+      if ( !prop_schema )
+        return NULL;
+      apr_hash_set( schema->properties, prop_schema->name,
+                    APR_HASH_KEY_STRING, prop_schema );
+    }
+  }
+
+  tmp_json = schema_get( json, "items" );
+  if ( tmp_json ) {
+    /* Elements are known by the name of the array. */
+    schema->items = schema_create( mp, tmp_json, name, slot );
+    if ( !schema->items )
+      return NULL;
+    schema->items->name = schema->name;
+  }
+
+  return schema;
+}
+
+json_schema_t *json_schema_create( apr_pool_t *mp, json_t *json )
+{
+  return ( json ) ? schema_create( mp, json, NULL, -1 ) : NULL;
+}
+
+void json_schema_attach( json_schema_t *schema, apr_pool_t *mp )
+{
+  apr_pool_userdata_setn( schema, JSON_SCHEMA_KEY, NULL, mp );
+}
+
+json_schema_t *json_schema_get( apr_pool_t *mp )
+{
+  void *schema = NULL;
+  apr_pool_userdata_get( &schema, JSON_SCHEMA_KEY, mp );
+  return (json_schema_t *) schema;
+}
+
+json_schema_t *json_schema_get_property( json_schema_t *schema,
+                                         const char *name )
+{
+  if ( !schema || !schema->properties )
+    return NULL;
+
+  return apr_hash_get( schema->properties, name, APR_HASH_KEY_STRING );
+}
+
+static int schema_type_matches( json_schema_t *schema, json_t *json )
+{
+  return ( ( schema->type == JSON_SCHEMA_ANY ) ||
+           ( schema->type == json->type ) ||
+           ( schema->type == JSON_NUMBER && JSON_IS_INTEGER( json ) ) );
+}
+
+json_schema_t *json_schema_match( json_schema_t *schema, json_t *json )
+{
+  if ( !schema )
+    return NULL;
+
+  if ( schema->type == JSON_ARRAY && !JSON_IS_ARRAY( json ) ) {
+    schema = schema->items;
+  }
+
+  return ( schema && schema_type_matches( schema, json ) ) ? schema : NULL;
+}
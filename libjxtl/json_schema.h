@@ -0,0 +1,99 @@
+/*
+ * json_schema.h
+ *
+ * Description
+ *   Schemas that describe the shape of a data dictionary.
+ *
+ * Copyright 2010 Dan Rinehimer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef JSON_SCHEMA_H
+#define JSON_SCHEMA_H
+
+#include <apr_hash.h>
+#include <apr_pools.h>
+
+#include "json.h"
+
+/** Type of a schema that accepts any value. */
+#define JSON_SCHEMA_ANY -1
+
+/**
+ * A compiled schema.  Schemas are written as a subset of JSON Schema:
+ *
+ *   { "type": "object",
+ *     "properties": { "name": { "type": "string" },
+ *                     "beer": { "type": "array",
+ *                               "items": { "type": "object", ... } } } }
+ *
+ * Each property of an object is given a slot.  Objects loaded with a schema
+ * keep their known properties in a vector indexed by slot, and templates
+ * compiled against the same schema look them up by slot instead of by name.
+ * Unknown properties are loaded as usual and are found by name.
+ */
+typedef struct json_schema_t {
+  /** The type of the value, or JSON_SCHEMA_ANY. */
+  int type;
+  /**
+   * Name of the property this schema describes.  Nodes loaded with the
+   * schema use this pointer as their name.
+   */
+  char *name;
+  /** Slot of the property in its object. */
+  int slot;
+  /** Schemas of the properties of an object, by name. */
+  apr_hash_t *properties;
+  /** Number of properties of an object. */
+  int num_slots;
+  /** Schema of the elements of an array. */
+  struct json_schema_t *items;
+} json_schema_t;
+
+/**
+ * Compile a schema.
+ * @param mp Pool to allocate the schema from.  It has to outlive any data
+ *        or template that uses the schema.
+ * @param json The schema description.
+ * @return The compiled schema, or NULL if the description is invalid.
+ */
+json_schema_t *json_schema_create( apr_pool_t *mp, json_t *json );
+
+/**
+ * Load the data created in mp with schema.  The JSON writer, and so the JSON
+ * and XML loaders, pick up a schema attached to the pool they create nodes
+ * in.
+ */
+void json_schema_attach( json_schema_t *schema, apr_pool_t *mp );
+
+/**
+ * @return The schema attached to mp, or NULL.
+ */
+json_schema_t *json_schema_get( apr_pool_t *mp );
+
+/**
+ * @return The schema of the property name of an object, or NULL if it is
+ *         not known.
+ */
+json_schema_t *json_schema_get_property( json_schema_t *schema,
+                                         const char *name );
+
+/**
+ * Work out which schema a value loaded under schema has.  A non-array value
+ * for an array schema is a lone element of the array.
+ * @return The schema, or NULL if the value doesn't match.
+ */
+json_schema_t *json_schema_match( json_schema_t *schema, json_t *json );
+
+#endif
@@ -0,0 +1,171 @@
+/*
+ * json_slab.c
+ *
+ * Description
+ *   A slab allocator for the nodes of a JSON tree.
+ *
+ * Copyright 2010 Dan Rinehimer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <apr_general.h>
+#include <apr_pools.h>
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#include "json.h"
+#include "json_slab.h"
+
+#define JSON_SLAB_KEY "json_slab"
+
+#define JSON_SLAB_NODE_SIZE APR_ALIGN_DEFAULT( sizeof(json_t) )
+
+static apr_status_t slab_cleanup( void *slab_ptr )
+{
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP)
+  json_slab_t *slab = (json_slab_t *) slab_ptr;
+  json_slab_map_t *map;
+
+  for ( map = slab->maps; map; map = map->next ) {
+    munmap( map->addr, map->len );
+  }
+  slab->maps = NULL;
+#endif
+
+  return APR_SUCCESS;
+}
+
+/**
+ * Map a huge page backed slab.  Explicit huge pages are tried first, then
+ * transparent huge pages.  Returns NULL if nothing could be mapped.
+ */
+static char *slab_map( json_slab_t *slab )
+{
+  char *addr = NULL;
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP)
+  void *mem = MAP_FAILED;
+  int huge = FALSE;
+  json_slab_map_t *map;
+
+#ifdef MAP_HUGETLB
+  mem = mmap( NULL, JSON_SLAB_HUGE_SIZE, PROT_READ | PROT_WRITE,
+              MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 );
+  huge = ( mem != MAP_FAILED );
+#endif
+
+  if ( mem == MAP_FAILED ) {
+    mem = mmap( NULL, JSON_SLAB_HUGE_SIZE, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    if ( mem == MAP_FAILED )
+      return NULL;
+#if defined(HAVE_MADVISE) && defined(MADV_HUGEPAGE)
+    huge = ( madvise( mem, JSON_SLAB_HUGE_SIZE, MADV_HUGEPAGE ) == 0 );
+#endif
+  }
+
+  map = apr_palloc( slab->mp, sizeof(json_slab_map_t) );
+  map->addr = mem;
+  map->len = JSON_SLAB_HUGE_SIZE;
+  map->next = slab->maps;
+  slab->maps = map;
+
+  if ( huge ) {
+    slab->huge_slabs++;
+  }
+  addr = mem;
+#endif
+
+  return addr;
+}
+
+static void *slab_alloc( json_slab_t *slab, json_slab_class slab_class,
+                         apr_size_t size )
+{
+  json_slab_region_t *region = &slab->regions[slab_class];
+  apr_size_t slab_size = JSON_SLAB_SIZE;
+  char *mem;
+
+  if ( (apr_size_t) ( region->end - region->next ) < size ) {
+    mem = NULL;
+    if ( slab->flags & JSON_SLAB_HUGE_PAGES ) {
+      mem = slab_map( slab );
+      slab_size = JSON_SLAB_HUGE_SIZE;
+    }
+    if ( !mem ) {
+      mem = apr_palloc( slab->mp, JSON_SLAB_SIZE );
+      slab_size = JSON_SLAB_SIZE;
+    }
+    region->next = mem;
+    region->end = mem + slab_size;
+    slab->slabs++;
+    slab->slab_bytes += slab_size;
+  }
+
+  mem = region->next;
+  region->next += size;
+
+  return mem;
+}
+
+json_slab_t *json_slab_create( apr_pool_t *mp, int flags )
+{
+  json_slab_t *slab = apr_pcalloc( mp, sizeof(json_slab_t) );
+  slab->mp = mp;
+  slab->flags = flags;
+  apr_pool_cleanup_register( mp, slab, slab_cleanup, apr_pool_cleanup_null );
+  return slab;
+}
+
+void json_slab_attach( json_slab_t *slab, apr_pool_t *mp )
+{
+  apr_pool_userdata_setn( slab, JSON_SLAB_KEY, NULL, mp );
+}
+
+json_slab_t *json_slab_get( apr_pool_t *mp )
+{
+  void *slab = NULL;
+  apr_pool_userdata_get( &slab, JSON_SLAB_KEY, mp );
+  return (json_slab_t *) slab;
+}
+
+void *json_slab_alloc_node( json_slab_t *slab )
+{
+  slab->nodes++;
+  slab->node_bytes += JSON_SLAB_NODE_SIZE;
+  return slab_alloc( slab, JSON_SLAB_NODE, JSON_SLAB_NODE_SIZE );
+}
+
+char *json_slab_alloc_string( json_slab_t *slab, apr_size_t size )
+{
+  slab->string_bytes += size;
+  if ( size > JSON_SLAB_MAX_ALLOC )
+    return apr_palloc( slab->mp, size );
+  return slab_alloc( slab, JSON_SLAB_STRING, size );
+}
+
+void json_slab_get_stats( json_slab_t *slab, json_slab_stats_t *stats )
+{
+  stats->nodes = slab->nodes;
+  stats->node_bytes = slab->node_bytes;
+  stats->string_bytes = slab->string_bytes;
+  stats->slabs = slab->slabs;
+  stats->slab_bytes = slab->slab_bytes;
+  stats->huge_slabs = slab->huge_slabs;
+}
@@ -0,0 +1,131 @@
+/*
+ * json_slab.h
+ *
+ * Description
+ *   A slab allocator for the nodes of a JSON tree.
+ *
+ * Copyright 2010 Dan Rinehimer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef JSON_SLAB_H
+#define JSON_SLAB_H
+
+#include <apr_pools.h>
+
+/**
+ * Back the slabs with huge pages if the system has them.
+ */
+#define JSON_SLAB_HUGE_PAGES 0x1
+
+/** Size of a slab from the pool. */
+#define JSON_SLAB_SIZE ( 64 * 1024 )
+
+/** Size of a huge page backed slab. */
+#define JSON_SLAB_HUGE_SIZE ( 2 * 1024 * 1024 )
+
+/** Allocations larger than this come straight from the pool. */
+#define JSON_SLAB_MAX_ALLOC 256
+
+/**
+ * Size classes.  Nodes get slabs of their own so that a tree's nodes are
+ * packed densely, and out of line strings are kept next to each other.
+ */
+typedef enum json_slab_class {
+  JSON_SLAB_NODE,
+  JSON_SLAB_STRING,
+  JSON_SLAB_NUM_CLASSES
+} json_slab_class;
+
+typedef struct json_slab_region_t {
+  char *next;
+  char *end;
+} json_slab_region_t;
+
+typedef struct json_slab_map_t {
+  void *addr;
+  apr_size_t len;
+  struct json_slab_map_t *next;
+} json_slab_map_t;
+
+typedef struct json_slab_t {
+  apr_pool_t *mp;
+  int flags;
+  /** The current slab of each size class. */
+  json_slab_region_t regions[JSON_SLAB_NUM_CLASSES];
+  /** Slabs that were mapped and need to be unmapped with the pool. */
+  json_slab_map_t *maps;
+  apr_size_t nodes;
+  apr_size_t node_bytes;
+  apr_size_t string_bytes;
+  apr_size_t slabs;
+  apr_size_t slab_bytes;
+  apr_size_t huge_slabs;
+} json_slab_t;
+
+typedef struct json_slab_stats_t {
+  /** Number of nodes allocated. */
+  apr_size_t nodes;
+  /** Bytes used by nodes. */
+  apr_size_t node_bytes;
+  /** Bytes used by strings, including those too large for a slab. */
+  apr_size_t string_bytes;
+  /** Number of slabs. */
+  apr_size_t slabs;
+  /** Bytes reserved for slabs. */
+  apr_size_t slab_bytes;
+  /** Number of slabs known to be backed by huge pages. */
+  apr_size_t huge_slabs;
+} json_slab_stats_t;
+
+/**
+ * Create a slab allocator.  Its slabs are released when mp is cleared or
+ * destroyed.
+ * @param mp Pool to allocate the allocator and its slabs out of.
+ * @param flags JSON_SLAB_HUGE_PAGES or 0.
+ * @return The new allocator.
+ */
+json_slab_t *json_slab_create( apr_pool_t *mp, int flags );
+
+/**
+ * Attach the allocator to a pool.  Every node and string that the
+ * json_create_* functions allocate out of mp will come from the slabs.
+ * @param slab The allocator.
+ * @param mp The pool that the JSON tree is being created in.
+ */
+void json_slab_attach( json_slab_t *slab, apr_pool_t *mp );
+
+/**
+ * @return The allocator attached to mp, or NULL.
+ */
+json_slab_t *json_slab_get( apr_pool_t *mp );
+
+/**
+ * Allocate a node.
+ */
+void *json_slab_alloc_node( json_slab_t *slab );
+
+/**
+ * Allocate the value of a string.
+ * @param slab The allocator.
+ * @param size The number of bytes, including the terminator.
+ */
+char *json_slab_alloc_string( json_slab_t *slab, apr_size_t size );
+
+/**
+ * Get the number of nodes and bytes used by the allocator.
+ */
+void json_slab_get_stats( json_slab_t *slab, json_slab_stats_t *stats );
+
+#endif
@@ -0,0 +1,336 @@
+/*
+ * json_text_writer.c
+ *
+ * Description
+ *   A writer with the same calls as json_writer that writes JSON text
+ *   instead of building a tree.
+ *
+ * Copyright 2010 Dan Rinehimer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <apr_general.h>
+#include <apr_pools.h>
+#include <apr_tables.h>
+
+#include "apr_macros.h"
+#include "json_dump.h"
+#include "json_text_writer.h"
+#include "json_writer_ctx.h"
+
+static json_text_writer_t *text_writer_create( apr_pool_t *mp,
+                                               apr_size_t buffer_size,
+                                               json_dump_output_func
+                                               output_func,
+                                               void *output_data,
+                                               int indent )
+{
+  json_text_writer_t *writer;
+  writer = apr_palloc( mp, sizeof( json_text_writer_t ) );
+  writer->mp = mp;
+  writer->context = json_writer_ctx_create( writer->mp );
+  json_dump_init( &writer->dump, apr_palloc( mp, buffer_size ), buffer_size,
+                  output_func, output_data );
+  writer->indent = indent;
+  writer->count_stack = apr_array_make( writer->mp, 1024, sizeof( int ) );
+  return writer;
+}
+
+json_text_writer_t *json_text_writer_create( apr_pool_t *mp,
+                                             json_dump_output_func output_func,
+                                             void *output_data, int indent )
+{
+  return text_writer_create( mp, JSON_DUMP_MEMORY_BUFFER_SIZE, output_func,
+                             output_data, indent );
+}
+
+json_text_writer_t *json_text_writer_create_to_file( apr_pool_t *mp,
+                                                     apr_file_t *out,
+                                                     int indent )
+{
+  return text_writer_create( mp, JSON_DUMP_BUFFER_SIZE, json_dump_file_output,
+                             out, indent );
+}
+
+json_text_writer_t *json_text_writer_create_to_str_buf( apr_pool_t *mp,
+                                                        str_buf_t *buf,
+                                                        int indent )
+{
+  return text_writer_create( mp, JSON_DUMP_MEMORY_BUFFER_SIZE,
+                             json_dump_str_buf_output, buf, indent );
+}
+
+void json_text_writer_flush( json_text_writer_t *writer )
+{
+  json_dump_flush( &writer->dump );
+}
+
+void json_text_writer_init_callbacks( json_text_writer_t *writer,
+                                      json_callback_t *callbacks, int flags )
+{
+  callbacks->object_start_handler = json_text_writer_start_object;
+  callbacks->object_end_handler = json_text_writer_end_object;
+  callbacks->array_start_handler = json_text_writer_start_array;
+  callbacks->array_end_handler = json_text_writer_end_array;
+  callbacks->property_start_handler = json_text_writer_start_property;
+  callbacks->property_end_handler = json_text_writer_end_property;
+  callbacks->string_handler = json_text_writer_write_str;
+  callbacks->integer_handler = json_text_writer_write_integer;
+  callbacks->number_handler = json_text_writer_write_number;
+  callbacks->number_lexeme_handler = NULL;
+  if ( flags & JSON_PARSER_RAW_NUMBERS ) {
+    callbacks->number_lexeme_handler = json_text_writer_write_number_lexeme;
+  }
+  callbacks->boolean_handler = json_text_writer_write_boolean;
+  callbacks->null_handler = json_text_writer_write_null;
+  callbacks->user_data = writer;
+}
+
+json_writer_ctx_t *json_text_writer_get_context( void *writer_ptr )
+{
+  json_text_writer_t *writer = (json_text_writer_t *) writer_ptr;
+  return writer->context;
+}
+
+static void json_text_writer_error( const char *error_string, ... )
+{
+  va_list args;
+  fprintf( stderr, "json_text_writer error:  " );
+  va_start( args, error_string );
+  vfprintf( stderr, error_string, args );
+  fprintf( stderr, "\n" );
+  va_end( args );
+}
+
+/**
+ * Write the separator and indentation that come before the next member of
+ * the innermost object or array.
+ */
+static void write_member_prefix( json_text_writer_t *writer )
+{
+  int *count = &APR_ARRAY_TAIL( writer->count_stack, int );
+
+  if ( *count > 0 ) {
+    json_dump_char( &writer->dump, ',' );
+  }
+  (*count)++;
+
+  if ( writer->indent ) {
+    json_dump_char( &writer->dump, '\n' );
+    json_dump_spaces( &writer->dump,
+                      writer->count_stack->nelts * writer->indent );
+  }
+}
+
+/**
+ * Called before writing a value in state.  Array elements are members of the
+ * array; property values were already prefixed by their name.
+ */
+static void write_value_prefix( json_text_writer_t *writer,
+                                json_writer_ctx_state state )
+{
+  if ( state == JSON_IN_ARRAY ) {
+    write_member_prefix( writer );
+  }
+}
+
+/**
+ * Called after a value is complete.  The top level value ends with a newline
+ * when indenting, like json_dump.
+ */
+static void write_value_suffix( json_text_writer_t *writer )
+{
+  if ( writer->count_stack->nelts == 0 && writer->indent ) {
+    json_dump_char( &writer->dump, '\n' );
+  }
+}
+
+static void write_close( json_text_writer_t *writer, char c )
+{
+  int *count = apr_array_pop( writer->count_stack );
+
+  if ( writer->indent && *count > 0 ) {
+    json_dump_char( &writer->dump, '\n' );
+    json_dump_spaces( &writer->dump,
+                      writer->count_stack->nelts * writer->indent );
+  }
+  json_dump_char( &writer->dump, c );
+  write_value_suffix( writer );
+}
+
+void json_text_writer_start_object( void *writer_ptr )
+{
+  json_text_writer_t *writer = (json_text_writer_t *) writer_ptr;
+  json_writer_ctx_state state = json_writer_ctx_get_state( writer->context );
+
+  if ( !json_writer_ctx_start_object( writer->context ) ) {
+    json_text_writer_error( "could not start object" );
+    return;
+  }
+
+  write_value_prefix( writer, state );
+  json_dump_char( &writer->dump, '{' );
+  APR_ARRAY_PUSH( writer->count_stack, int ) = 0;
+}
+
+void json_text_writer_end_object( void *writer_ptr )
+{
+  json_text_writer_t *writer = (json_text_writer_t *) writer_ptr;
+  if ( !json_writer_ctx_end_object( writer->context ) ) {
+    json_text_writer_error( "could not end object" );
+    return;
+  }
+
+  write_close( writer, '}' );
+}
+
+void json_text_writer_start_array( void *writer_ptr )
+{
+  json_text_writer_t *writer = (json_text_writer_t *) writer_ptr;
+  json_writer_ctx_state state = json_writer_ctx_get_state( writer->context );
+
+  if ( !json_writer_ctx_start_array( writer->context ) ) {
+    json_text_writer_error( "could not start array" );
+    return;
+  }
+
+  write_value_prefix( writer, state );
+  json_dump_char( &writer->dump, '[' );
+  APR_ARRAY_PUSH( writer->count_stack, int ) = 0;
+}
+
+void json_text_writer_end_array( void *writer_ptr )
+{
+  json_text_writer_t *writer = (json_text_writer_t *) writer_ptr;
+  if ( !json_writer_ctx_end_array( writer->context ) ) {
+    json_text_writer_error( "could not end array" );
+    return;
+  }
+
+  write_close( writer, ']' );
+}
+
+void json_text_writer_start_property( void *writer_ptr, const char *name )
+{
+  json_text_writer_t *writer = (json_text_writer_t *) writer_ptr;
+  if ( !json_writer_ctx_start_property( writer->context, name ) ) {
+    json_text_writer_error( "could not start property \"%s\"", name );
+    return;
+  }
+
+  write_member_prefix( writer );
+  json_dump_string( &writer->dump, name, strlen( name ) );
+  json_dump_char( &writer->dump, ':' );
+  if ( writer->indent ) {
+    json_dump_char( &writer->dump, ' ' );
+  }
+}
+
+void json_text_writer_end_property( void *writer_ptr )
+{
+  json_text_writer_t *writer = (json_text_writer_t *) writer_ptr;
+  if ( !json_writer_ctx_end_property( writer->context ) )
+    json_text_writer_error( "could not end property" );
+}
+
+/**
+ * Check that a simple value can be written and write what comes before it.
+ */
+static int start_value( json_text_writer_t *writer )
+{
+  json_writer_ctx_state state = json_writer_ctx_get_state( writer->context );
+
+  if ( !json_writer_ctx_can_write_value( writer->context ) )
+    return FALSE;
+
+  write_value_prefix( writer, state );
+  return TRUE;
+}
+
+void json_text_writer_write_strn( void *writer_ptr, const char *value,
+                                  int len )
+{
+  json_text_writer_t *writer = (json_text_writer_t *) writer_ptr;
+  if ( !start_value( writer ) ) {
+    json_text_writer_error( "could not write string \"%s\"", value );
+    return;
+  }
+
+  json_dump_string( &writer->dump, value, len );
+}
+
+void json_text_writer_write_str( void *writer_ptr, const char *value )
+{
+  json_text_writer_write_strn( writer_ptr, value, strlen( value ) );
+}
+
+void json_text_writer_write_integer( void *writer_ptr, int value )
+{
+  json_text_writer_t *writer = (json_text_writer_t *) writer_ptr;
+  if ( !start_value( writer ) ) {
+    json_text_writer_error( "could not write int \"%d\"", value );
+    return;
+  }
+
+  json_dump_integer( &writer->dump, value );
+}
+
+void json_text_writer_write_number( void *writer_ptr, double value )
+{
+  json_text_writer_t *writer = (json_text_writer_t *) writer_ptr;
+  if ( !start_value( writer ) ) {
+    json_text_writer_error( "could not write number \"%lf\"", value );
+    return;
+  }
+
+  json_dump_number( &writer->dump, value );
+}
+
+void json_text_writer_write_number_lexeme( void *writer_ptr,
+                                           const char *text )
+{
+  json_text_writer_t *writer = (json_text_writer_t *) writer_ptr;
+  if ( !start_value( writer ) ) {
+    json_text_writer_error( "could not write number \"%s\"", text );
+    return;
+  }
+
+  json_dump_write( &writer->dump, text, strlen( text ) );
+}
+
+void json_text_writer_write_boolean( void *writer_ptr, int value )
+{
+  json_text_writer_t *writer = (json_text_writer_t *) writer_ptr;
+  if ( !start_value( writer ) ) {
+    json_text_writer_error( "could not write bool" );
+    return;
+  }
+
+  ( value ) ? json_dump_write( &writer->dump, "true", 4 ) :
+              json_dump_write( &writer->dump, "false", 5 );
+}
+
+void json_text_writer_write_null( void *writer_ptr )
+{
+  json_text_writer_t *writer = (json_text_writer_t *) writer_ptr;
+  if ( !start_value( writer ) ) {
+    json_text_writer_error( "could not write null" );
+    return;
+  }
+
+  json_dump_write( &writer->dump, "null", 4 );
+}
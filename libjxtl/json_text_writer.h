@@ -0,0 +1,126 @@
+/*
+ * json_text_writer.h
+ *
+ * Description
+ *   A writer with the same calls as json_writer that writes JSON text
+ *   instead of building a tree.
+ *
+ * Copyright 2010 Dan Rinehimer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef JSON_TEXT_WRITER_H
+#define JSON_TEXT_WRITER_H
+
+#include <apr_file_io.h>
+#include <apr_pools.h>
+#include <apr_tables.h>
+
+#include "json.h"
+#include "json_dump.h"
+#include "json_writer_ctx.h"
+#include "str_buf.h"
+
+/**
+ * Values are written out as soon as they are complete, formatted the same
+ * way json_dump formats a tree, so memory use only depends on the depth of
+ * the JSON.  Unlike json_writer, a property that is started twice in the
+ * same object is written twice.
+ */
+typedef struct json_text_writer_t {
+  /** Memory pool used to allocate the writer. */
+  apr_pool_t *mp;
+
+  /** A writer context to validate actions. */
+  json_writer_ctx_t *context;
+
+  /** The buffered output. */
+  json_dump_t dump;
+
+  /** Number of spaces to indent each level by, or 0 for compact output. */
+  int indent;
+
+  /** Number of members written so far in each open object and array. */
+  apr_array_header_t *count_stack;
+} json_text_writer_t;
+
+/**
+ * Create a new JSON text writer.
+ * @param mp Pool to allocate the writer out of.
+ * @param output_func Function that is handed the text as it is written.
+ * @param output_data Data passed to output_func.
+ * @param indent Number of spaces to indent each level by, or 0.
+ * @return The writer created.
+ */
+json_text_writer_t *json_text_writer_create( apr_pool_t *mp,
+                                             json_dump_output_func output_func,
+                                             void *output_data, int indent );
+
+/**
+ * Create a new JSON text writer that writes to a file.
+ */
+json_text_writer_t *json_text_writer_create_to_file( apr_pool_t *mp,
+                                                     apr_file_t *out,
+                                                     int indent );
+
+/**
+ * Create a new JSON text writer that appends to a string buffer.
+ */
+json_text_writer_t *json_text_writer_create_to_str_buf( apr_pool_t *mp,
+                                                        str_buf_t *buf,
+                                                        int indent );
+
+/**
+ * Hand any buffered text to the output.  This has to be called once writing
+ * is finished.
+ * @param writer The JSON text writer.
+ */
+void json_text_writer_flush( json_text_writer_t *writer );
+
+/**
+ * Fill in callbacks so that a JSON parser writes to the text writer.
+ * @param writer The JSON text writer.
+ * @param callbacks The callbacks to fill in.
+ * @param flags The parser's flags.  With JSON_PARSER_RAW_NUMBERS numbers are
+ *        written exactly as they were read.
+ */
+void json_text_writer_init_callbacks( json_text_writer_t *writer,
+                                      json_callback_t *callbacks, int flags );
+
+/**
+ * @param writer_ptr The JSON text writer.
+ * @return The context used by this JSON text writer.
+ */
+json_writer_ctx_t *json_text_writer_get_context( void *writer_ptr );
+
+/**
+ * The following work like their json_writer counterparts.
+ */
+void json_text_writer_start_object( void *writer_ptr );
+void json_text_writer_end_object( void *writer_ptr );
+void json_text_writer_start_array( void *writer_ptr );
+void json_text_writer_end_array( void *writer_ptr );
+void json_text_writer_start_property( void *writer_ptr, const char *name );
+void json_text_writer_end_property( void *writer_ptr );
+void json_text_writer_write_str( void *writer_ptr, const char *value );
+void json_text_writer_write_strn( void *writer_ptr, const char *value,
+                                  int len );
+void json_text_writer_write_integer( void *writer_ptr, int value );
+void json_text_writer_write_number( void *writer_ptr, double value );
+void json_text_writer_write_number_lexeme( void *writer_ptr,
+                                           const char *text );
+void json_text_writer_write_boolean( void *writer_ptr, int value );
+void json_text_writer_write_null( void *writer_ptr );
+
+#endif
@@ -21,6 +21,7 @@
 
 #include <stdio.h>
 #include <apr_general.h>
+#include <apr_hash.h>
 #include <apr_pools.h>
 #include <apr_strings.h>
 #include <apr_tables.h>
@@ -36,9 +37,14 @@ json_writer_t *json_writer_create( apr_pool_t *mp, apr_pool_t *json_mp )
   writer = apr_palloc( mp, sizeof( json_writer_t ) );
   writer->mp = mp;
   writer->json_mp = ( json_mp ) ? json_mp : mp;
+  writer->slab = json_slab_get( writer->json_mp );
   writer->context = json_writer_ctx_create( writer->mp );
   writer->json = NULL;
   writer->json_stack = apr_array_make( writer->mp, 1024, sizeof( json_t * ) );
+  writer->schema = json_schema_get( writer->json_mp );
+  writer->schema_stack = apr_array_make( writer->mp, 1024,
+                                         sizeof( json_schema_t * ) );
+  writer->names = apr_hash_make( writer->mp );
   return writer;
 }
 
@@ -58,66 +64,134 @@ static void json_writer_error( const char *error_string, ... )
   va_end( args );
 }
 
-static void json_add( json_writer_t *writer, json_t *json )
+/**
+ * Get the copy of a property name in json_mp, making it the first time the
+ * name is seen.
+ */
+static char *json_writer_intern( json_writer_t *writer, const char *prop )
+{
+  apr_size_t len = strlen( prop );
+  char *name = apr_hash_get( writer->names, prop, len );
+
+  if ( !name ) {
+    name = apr_pstrmemdup( writer->json_mp, prop, len );
+    apr_hash_set( writer->names, name, len, name );
+  }
+
+  return name;
+}
+
+/**
+ * Add json to the object or array on top of the stack.  Returns the schema of
+ * json if the writer has a schema and json matches it.
+ */
+static json_schema_t *json_add( json_writer_t *writer, json_t *json )
 {
   json_t *obj = NULL;
   json_t *tmp_json;
   json_t *new_array;
   char *name;
+  json_schema_t *schema = NULL;
+  json_schema_t *prop_schema = NULL;
 
   if ( writer->json_stack->nelts > 0 ) {
     obj = APR_ARRAY_TAIL( writer->json_stack, json_t * );
+    if ( writer->schema ) {
+      schema = APR_ARRAY_TAIL( writer->schema_stack, json_schema_t * );
+    }
   }
 
   if ( !obj ) {
     writer->json = json;
-    return;
+    return json_schema_match( writer->schema, json );
   }
 
   switch ( obj->type ) {
   case JSON_OBJECT:
-    name = apr_pstrdup( writer->json_mp,
-                        json_writer_ctx_get_prop( writer->context ) );
+    prop_schema = json_schema_get_property( schema,
+                                            json_writer_ctx_get_prop(
+                                              writer->context ) );
+    if ( prop_schema ) {
+      /* Known properties all share the name from the schema. */
+      name = prop_schema->name;
+    }
+    else {
+      name = json_writer_intern( writer,
+                                 json_writer_ctx_get_prop( writer->context ) );
+    }
     JSON_NAME( json ) = name;
     tmp_json = apr_hash_get( obj->value.object, JSON_NAME( json ),
                              APR_HASH_KEY_STRING );
     if ( tmp_json && tmp_json->type != JSON_ARRAY ) {
       /* Key already exists, make an array and put both objects in it. */
-      new_array = json_create_array( writer->json_mp );
+      new_array = json_create_array_slab( writer->json_mp, writer->slab );
       JSON_NAME( new_array ) = JSON_NAME( json );
       JSON_NAME( json ) = NULL;
       JSON_NAME( tmp_json ) = NULL;
-      json->parent = new_array;
-      tmp_json->parent = new_array;
-      new_array->parent = obj;
       APR_ARRAY_PUSH( new_array->value.array, json_t * ) = tmp_json;
       APR_ARRAY_PUSH( new_array->value.array, json_t * ) = json;
       apr_hash_set( obj->value.object, JSON_NAME( new_array ),
                     APR_HASH_KEY_STRING, new_array );
+      tmp_json = new_array;
     }
     else if ( tmp_json && tmp_json->type == JSON_ARRAY ) {
       /* Exists, but we already converted it to an array */
-      json->parent = tmp_json;
       json->name = NULL;
       APR_ARRAY_PUSH( tmp_json->value.array, json_t * ) = json;
     }
     else {
       /* Standard insertion */
-      json->parent = obj;
       apr_hash_set( obj->value.object, JSON_NAME( json ),
                     APR_HASH_KEY_STRING, json );
+      tmp_json = json;
     }
-    break;
+    if ( prop_schema && JSON_HAS_SLOTS( obj ) ) {
+      obj->value.schema_object.slots[prop_schema->slot] = tmp_json;
+    }
+    return json_schema_match( prop_schema, json );
 
   case JSON_ARRAY:
-    json->parent = obj;
     APR_ARRAY_PUSH( obj->value.array, json_t * ) = json;
-    break;
+    return json_schema_match( schema, json );
 
   default:
     json_writer_error( "values can only be added to arrays or objects" );
     break;
   }
+
+  return NULL;
+}
+
+/**
+ * Push a new object or array along with the schema of its members.
+ */
+static void json_push( json_writer_t *writer, json_t *json,
+                       json_schema_t *schema )
+{
+  APR_ARRAY_PUSH( writer->json_stack, json_t * ) = json;
+
+  if ( !writer->schema )
+    return;
+
+  if ( JSON_IS_ARRAY( json ) ) {
+    schema = ( schema ) ? schema->items : NULL;
+  }
+  else if ( schema && schema->num_slots > 0 ) {
+    json->value.schema_object.slots =
+      apr_pcalloc( writer->json_mp, sizeof(json_t *) * schema->num_slots );
+    json->len = schema->num_slots;
+  }
+
+  APR_ARRAY_PUSH( writer->schema_stack, json_schema_t * ) = schema;
+}
+
+static void json_pop( json_writer_t *writer )
+{
+  apr_array_pop( writer->json_stack );
+
+  if ( writer->schema ) {
+    apr_array_pop( writer->schema_stack );
+  }
 }
 
 /**
@@ -133,10 +207,8 @@ void json_writer_start_object( void *writer_ptr )
     return;
   }
 
-  json = json_create_object( writer->json_mp );
-  json_add( writer, json );
-
-  APR_ARRAY_PUSH( writer->json_stack, json_t * ) = json;
+  json = json_create_object_slab( writer->json_mp, writer->slab );
+  json_push( writer, json, json_add( writer, json ) );
 }
 
 void json_writer_end_object( void *writer_ptr )
@@ -147,7 +219,7 @@ void json_writer_end_object( void *writer_ptr )
     return;
   }
 
-  apr_array_pop( writer->json_stack );
+  json_pop( writer );
 }
 
 void json_writer_start_array( void *writer_ptr )
@@ -159,10 +231,8 @@ void json_writer_start_array( void *writer_ptr )
     return;
   }
 
-  json = json_create_array( writer->json_mp );
-  json_add( writer, json );
-
-  APR_ARRAY_PUSH( writer->json_stack, json_t * ) = json;
+  json = json_create_array_slab( writer->json_mp, writer->slab );
+  json_push( writer, json, json_add( writer, json ) );
 }
 
 void json_writer_end_array( void *writer_ptr )
@@ -173,7 +243,7 @@ void json_writer_end_array( void *writer_ptr )
     return;
   }
 
-  apr_array_pop( writer->json_stack );
+  json_pop( writer );
 }
 
 /**
@@ -203,7 +273,8 @@ void json_writer_write_strn( void *writer_ptr, const char *value, int len )
     return;
   }
 
-  json_add( writer, json_create_strn( writer->json_mp, value, len ) );
+  json_add( writer, json_create_strn_slab( writer->json_mp, writer->slab,
+                                           value, len ) );
 }
 
 void json_writer_write_str( void *writer_ptr, const char *value )
@@ -219,7 +290,8 @@ void json_writer_write_integer( void *writer_ptr, int value )
     return;
   }
 
-  json_add( writer, json_create_integer( writer->json_mp, value ) );
+  json_add( writer, json_create_integer_slab( writer->json_mp, writer->slab,
+                                              value ) );
 }
 
 void json_writer_write_number( void *writer_ptr, double value )
@@ -230,7 +302,21 @@ void json_writer_write_number( void *writer_ptr, double value )
     return;
   }
 
-  json_add( writer, json_create_number( writer->json_mp, value ) );
+  json_add( writer, json_create_number_slab( writer->json_mp, writer->slab,
+                                             value ) );
+}
+
+void json_writer_write_number_lexeme( void *writer_ptr, const char *text )
+{
+  json_writer_t *writer = (json_writer_t *) writer_ptr;
+  if ( !json_writer_ctx_can_write_value( writer->context ) ) {
+    json_writer_error( "could not write number \"%s\"", text );
+    return;
+  }
+
+  json_add( writer, json_create_number_lexeme_slab( writer->json_mp,
+                                                    writer->slab, text,
+                                                    strlen( text ) ) );
 }
 
 void json_writer_write_boolean( void *writer_ptr, int value )
@@ -241,7 +327,8 @@ void json_writer_write_boolean( void *writer_ptr, int value )
     return;
   }
 
-  json_add( writer, json_create_boolean( writer->json_mp, value ) );
+  json_add( writer, json_create_boolean_slab( writer->json_mp, writer->slab,
+                                              value ) );
 }
 
 void json_writer_write_null( void *writer_ptr )
@@ -252,5 +339,5 @@ void json_writer_write_null( void *writer_ptr )
     return;
   }
 
-  json_add( writer, json_create_null( writer->json_mp ) );
+  json_add( writer, json_create_null_slab( writer->json_mp, writer->slab ) );
 }
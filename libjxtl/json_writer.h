@@ -22,10 +22,13 @@
 #ifndef JSON_WRITER_H
 #define JSON_WRITER_H
 
+#include <apr_hash.h>
 #include <apr_pools.h>
 #include <apr_tables.h>
 
 #include "json.h"
+#include "json_schema.h"
+#include "json_slab.h"
 #include "json_writer_ctx.h"
 
 typedef struct json_writer_t {
@@ -41,6 +44,12 @@ typedef struct json_writer_t {
    */
   apr_pool_t *json_mp;
 
+  /**
+   * The slab attached to json_mp, or NULL.  Looked up once here rather than
+   * for each node created.
+   */
+  json_slab_t *slab;
+
   /**
    * Root node of the JSON created by the writer.
    */
@@ -55,6 +64,23 @@ typedef struct json_writer_t {
    * A stack of arrays and objects for building the JSON.
    */
   apr_array_header_t *json_stack;
+
+  /**
+   * The schema attached to json_mp, or NULL.
+   */
+  json_schema_t *schema;
+
+  /**
+   * The schema of the members of each entry in json_stack, if there is a
+   * schema.
+   */
+  apr_array_header_t *schema_stack;
+
+  /**
+   * Property names already copied into json_mp, so that each distinct name
+   * is stored once and shared by every node that has it.
+   */
+  apr_hash_t *names;
 } json_writer_t;
 
 
@@ -139,6 +165,13 @@ void json_writer_write_integer( void *writer_ptr, int value );
  */
 void json_writer_write_number( void *writer_ptr, double value );
 
+/**
+ * Write a number from its text, keeping the text for printing.
+ * @param writer_ptr The JSON writer.
+ * @param text A valid JSON number.
+ */
+void json_writer_write_number_lexeme( void *writer_ptr, const char *text );
+
 /**
  * Write a boolean.
  * @param writer_ptr The JSON writer.
@@ -33,7 +33,8 @@ json_writer_ctx_t *json_writer_ctx_create( apr_pool_t *mp )
   context->mp = mp;
   context->depth = 0;
   context->prop_stack = apr_array_make( context->mp, 1024,
-                                        sizeof(char *) );
+                                        sizeof(apr_size_t) );
+  context->names = str_buf_create( context->mp, 0 );
   context->state_stack = apr_array_make( context->mp, 1024,
                                          sizeof(json_writer_ctx_state) );
   APR_ARRAY_PUSH( context->state_stack, json_writer_ctx_state ) = JSON_INITIAL;
@@ -54,7 +55,11 @@ int json_writer_ctx_can_start_object_or_array( json_writer_ctx_t *context )
 
 char *json_writer_ctx_get_prop( json_writer_ctx_t *context )
 {
-  return APR_ARRAY_TAIL( context->prop_stack, char * );
+  if ( context->prop_stack->nelts == 0 )
+    return NULL;
+
+  return context->names->data + APR_ARRAY_TAIL( context->prop_stack,
+                                                apr_size_t );
 }
 
 int json_writer_ctx_start_object( json_writer_ctx_t *context )
@@ -98,13 +103,13 @@ int json_writer_ctx_end_array( json_writer_ctx_t *context )
 int json_writer_ctx_start_property( json_writer_ctx_t *context,
                                     const char *name )
 {
-  char *name_copy;
   if ( json_writer_ctx_get_state( context ) != JSON_IN_OBJECT )
     return FALSE;
 
-  name_copy = apr_pstrdup( context->mp, name );
-
-  APR_ARRAY_PUSH( context->prop_stack, char * ) = name_copy;
+  /* Names are copied onto a stack so memory only grows with depth. */
+  APR_ARRAY_PUSH( context->prop_stack,
+                  apr_size_t ) = context->names->data_len;
+  str_buf_write( context->names, name, strlen( name ) + 1 );
   APR_ARRAY_PUSH( context->state_stack,
                   json_writer_ctx_state ) = JSON_PROPERTY;
   return TRUE;
@@ -112,7 +117,11 @@ int json_writer_ctx_start_property( json_writer_ctx_t *context,
 
 int json_writer_ctx_end_property( json_writer_ctx_t *context )
 {
-  apr_array_pop( context->prop_stack );
+  apr_size_t *offset = apr_array_pop( context->prop_stack );
+
+  if ( offset ) {
+    context->names->data_len = *offset;
+  }
   apr_array_pop( context->state_stack );
   return TRUE;
 }
@@ -26,6 +26,8 @@
 #include <apr_pools.h>
 #include <apr_tables.h>
 
+#include "str_buf.h"
+
 typedef enum json_writer_ctx_state {
   JSON_INITIAL,
   JSON_IN_OBJECT,
@@ -36,7 +38,10 @@ typedef enum json_writer_ctx_state {
 typedef struct json_writer_ctx_t {
   apr_pool_t *mp;
   int depth;
+  /** Offsets in names of the names of the open properties. */
   apr_array_header_t *prop_stack;
+  /** Names of the open properties, each NUL terminated. */
+  str_buf_t *names;
   apr_array_header_t *state_stack;
 } json_writer_ctx_t;
 
@@ -65,7 +70,8 @@ int json_writer_ctx_can_start_object_or_array( json_writer_ctx_t *context );
 /**
  * Get the name of the current property.
  * @param The writer context.
- * @return The current property.
+ * @return The current property.  It is only valid until the next property
+ *         is started.
  */
 char *json_writer_ctx_get_prop( json_writer_ctx_t *context );
 
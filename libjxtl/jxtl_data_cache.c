@@ -0,0 +1,407 @@
+/*
+ * jxtl_data_cache.c
+ *
+ * Description
+ *   Keeps dictionaries loaded from files so they are parsed once.
+ *
+ * Copyright 2010 Dan Rinehimer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <apr_file_info.h>
+#include <apr_file_io.h>
+#include <apr_general.h>
+#include <apr_hash.h>
+#include <apr_pools.h>
+#include <apr_strings.h>
+#if APR_HAS_THREADS
+#include <apr_thread_mutex.h>
+#endif
+
+#include "apr_macros.h"
+#include "json.h"
+#include "json_doc.h"
+#include "jxtl_data_cache.h"
+#include "misc.h"
+#include "str_buf.h"
+#include "xml2json.h"
+
+/** How much of a file is hashed at a time. */
+#define HASH_BUFFER_SIZE 65536
+
+/* 64 bit FNV-1a. */
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+/* How a dictionary was loaded, the first character of its key. */
+#define LOAD_JSON 'j'
+#define LOAD_XML 'x'
+#define LOAD_XML_SKIP_ROOT 's'
+
+typedef struct jxtl_data_cache_entry_t {
+  /** What the file looked like when it was loaded. */
+  apr_off_t size;
+  apr_time_t mtime;
+  apr_uint64_t hash;
+  json_doc_t *doc;
+  struct jxtl_data_cache_entry_t *prev;
+  struct jxtl_data_cache_entry_t *next;
+  /** How it was loaded followed by the path, allocated with the entry. */
+  char key[1];
+} jxtl_data_cache_entry_t;
+
+static void cache_lock( jxtl_data_cache_t *cache )
+{
+#if APR_HAS_THREADS
+  apr_thread_mutex_lock( cache->mutex );
+#endif
+}
+
+static void cache_unlock( jxtl_data_cache_t *cache )
+{
+#if APR_HAS_THREADS
+  apr_thread_mutex_unlock( cache->mutex );
+#endif
+}
+
+static void cache_unlink( jxtl_data_cache_t *cache,
+                          jxtl_data_cache_entry_t *entry )
+{
+  if ( entry->prev )
+    entry->prev->next = entry->next;
+  else
+    cache->head = entry->next;
+
+  if ( entry->next )
+    entry->next->prev = entry->prev;
+  else
+    cache->tail = entry->prev;
+}
+
+static void cache_push_front( jxtl_data_cache_t *cache,
+                              jxtl_data_cache_entry_t *entry )
+{
+  entry->prev = NULL;
+  entry->next = cache->head;
+  if ( cache->head )
+    cache->head->prev = entry;
+  else
+    cache->tail = entry;
+  cache->head = entry;
+}
+
+/**
+ * Take an entry out of the cache and release its document.
+ */
+static void cache_drop( jxtl_data_cache_t *cache,
+                        jxtl_data_cache_entry_t *entry )
+{
+  apr_hash_set( cache->entries, entry->key, APR_HASH_KEY_STRING, NULL );
+  cache_unlink( cache, entry );
+  cache->used -= (apr_size_t) entry->size;
+  json_doc_release( entry->doc );
+  free( entry );
+}
+
+static apr_status_t cache_cleanup( void *data )
+{
+  jxtl_data_cache_clear( data );
+  return APR_SUCCESS;
+}
+
+jxtl_data_cache_t *jxtl_data_cache_create( apr_pool_t *mp,
+                                           apr_size_t budget, int flags )
+{
+  jxtl_data_cache_t *cache = apr_palloc( mp, sizeof(jxtl_data_cache_t) );
+
+  cache->mp = mp;
+  cache->flags = flags;
+  cache->budget = budget;
+  cache->used = 0;
+  cache->entries = apr_hash_make( mp );
+  cache->head = NULL;
+  cache->tail = NULL;
+#if APR_HAS_THREADS
+  apr_thread_mutex_create( &cache->mutex, APR_THREAD_MUTEX_DEFAULT, mp );
+#endif
+  /* Registered after the mutex, so it runs before the mutex is destroyed. */
+  apr_pool_cleanup_register( mp, cache, cache_cleanup,
+                             apr_pool_cleanup_null );
+
+  return cache;
+}
+
+/**
+ * Carry on a hash over more bytes.
+ */
+static apr_uint64_t hash_bytes( apr_uint64_t h, const unsigned char *buf,
+                                apr_size_t len )
+{
+  apr_size_t i;
+
+  for ( i = 0; i < len; i++ ) {
+    h = ( h ^ buf[i] ) * FNV_PRIME;
+  }
+
+  return h;
+}
+
+/**
+ * Hash the contents of a file.
+ */
+static int hash_file( apr_pool_t *mp, const char *path, apr_uint64_t *hash )
+{
+  apr_file_t *file;
+  unsigned char *buf;
+  apr_size_t len;
+  apr_status_t status;
+  apr_uint64_t h = FNV_OFFSET_BASIS;
+
+  if ( apr_file_open( &file, path, APR_READ, 0, mp ) != APR_SUCCESS )
+    return FALSE;
+
+  buf = apr_palloc( mp, HASH_BUFFER_SIZE );
+  do {
+    len = HASH_BUFFER_SIZE;
+    status = apr_file_read( file, buf, &len );
+    h = hash_bytes( h, buf, len );
+  } while ( status == APR_SUCCESS );
+
+  apr_file_close( file );
+  *hash = h;
+
+  return ( status == APR_EOF );
+}
+
+/**
+ * Read all of a file into memory and hash it.
+ * @return The text, NUL terminated, or NULL if it couldn't be read.
+ */
+static char *read_file( apr_pool_t *mp, apr_file_t *file, apr_size_t size,
+                        apr_size_t *len, apr_uint64_t *hash )
+{
+  str_buf_t *buf = str_buf_create( mp, size + HASH_BUFFER_SIZE );
+  char *chunk = apr_palloc( mp, HASH_BUFFER_SIZE );
+  apr_size_t chunk_len;
+  apr_status_t status;
+  apr_uint64_t h = FNV_OFFSET_BASIS;
+
+  do {
+    chunk_len = HASH_BUFFER_SIZE;
+    status = apr_file_read( file, chunk, &chunk_len );
+    h = hash_bytes( h, (unsigned char *) chunk, chunk_len );
+    str_buf_write( buf, chunk, chunk_len );
+  } while ( status == APR_SUCCESS );
+
+  if ( status != APR_EOF )
+    return NULL;
+
+  *len = buf->data_len;
+  *hash = h;
+  str_buf_putc( buf, '\0' );
+
+  return buf->data;
+}
+
+/**
+ * Parse a file into a document of its own.
+ * @param finfo Set to the size and modification time of the file that was
+ *        parsed, or NULL if they aren't needed.
+ * @param hash NULL to parse the file as it is read, otherwise the file is
+ *        read whole and this is set to the hash of what was parsed.
+ */
+static json_doc_t *load_doc( char how, const char *path, apr_finfo_t *finfo,
+                             apr_uint64_t *hash )
+{
+  apr_pool_t *load_mp;
+  apr_file_t *file;
+  parser_t *json_parser;
+  json_t *json = NULL;
+  json_doc_t *doc = NULL;
+  char *text = NULL;
+  apr_size_t len;
+  int loaded = FALSE;
+
+  apr_pool_create( &load_mp, NULL );
+
+  /*
+   * The size and time come from the file that is parsed, before it is
+   * read, so that a change while it is parsed is seen the next time.
+   */
+  if ( !open_apr_input_file( load_mp, path, &file ) ||
+       ( finfo &&
+         apr_file_info_get( finfo, APR_FINFO_SIZE | APR_FINFO_MTIME,
+                            file ) != APR_SUCCESS ) ||
+       ( hash &&
+         !( text = read_file( load_mp, file, ( finfo ) ?
+                              (apr_size_t) finfo->size : 0, &len,
+                              hash ) ) ) ) {
+    apr_pool_destroy( load_mp );
+    return NULL;
+  }
+
+  /* A file that fails part way may still leave a tree, which isn't kept. */
+  if ( how == LOAD_JSON ) {
+    json_parser = json_parser_create( load_mp );
+    loaded = ( text ) ?
+      json_parser_parse_buffer_to_obj( load_mp, json_parser, text, &json ) :
+      json_parser_parse_file_to_obj( load_mp, json_parser, file, &json );
+  }
+  else {
+    loaded = ( text ) ?
+      xml_to_json_buffer( load_mp, text, len, ( how == LOAD_XML_SKIP_ROOT ),
+                          &json ) :
+      xml_to_json( load_mp, file, ( how == LOAD_XML_SKIP_ROOT ), &json );
+  }
+
+  if ( loaded && json ) {
+    doc = json_doc_create( json );
+  }
+  apr_pool_destroy( load_mp );
+
+  return doc;
+}
+
+static int entry_is_current( jxtl_data_cache_t *cache,
+                             jxtl_data_cache_entry_t *entry,
+                             apr_finfo_t *finfo, apr_uint64_t hash )
+{
+  return ( entry && entry->size == finfo->size &&
+           entry->mtime == finfo->mtime &&
+           ( !( cache->flags & JXTL_DATA_CACHE_HASH ) ||
+             entry->hash == hash ) );
+}
+
+/**
+ * Keep a document that was just loaded, unless it is bigger than the whole
+ * budget, and drop the least recently used entries until the budget is met.
+ */
+static void cache_insert( jxtl_data_cache_t *cache, const char *key,
+                          json_doc_t *doc, apr_finfo_t *finfo,
+                          apr_uint64_t hash )
+{
+  jxtl_data_cache_entry_t *entry;
+  apr_size_t key_len = strlen( key );
+
+  if ( cache->budget > 0 && (apr_size_t) finfo->size > cache->budget )
+    return;
+
+  entry = malloc( sizeof(jxtl_data_cache_entry_t) + key_len );
+  if ( !entry )
+    return;
+
+  memcpy( entry->key, key, key_len + 1 );
+  entry->size = finfo->size;
+  entry->mtime = finfo->mtime;
+  entry->hash = hash;
+  entry->doc = json_doc_retain( doc );
+  apr_hash_set( cache->entries, entry->key, APR_HASH_KEY_STRING, entry );
+  cache_push_front( cache, entry );
+  cache->used += (apr_size_t) entry->size;
+
+  while ( cache->budget > 0 && cache->used > cache->budget &&
+          cache->tail != entry ) {
+    cache_drop( cache, cache->tail );
+  }
+}
+
+static json_doc_t *data_cache_get( jxtl_data_cache_t *cache, char how,
+                                   const char *path )
+{
+  apr_pool_t *tmp_mp;
+  apr_finfo_t finfo;
+  apr_finfo_t loaded_finfo;
+  apr_uint64_t hash = 0;
+  apr_uint64_t loaded_hash = 0;
+  int use_hash = ( cache->flags & JXTL_DATA_CACHE_HASH );
+  char *key;
+  jxtl_data_cache_entry_t *entry;
+  json_doc_t *doc = NULL;
+
+  /* Standard input can't be checked for changes. */
+  if ( strcmp( path, "-" ) == 0 )
+    return load_doc( how, path, NULL, NULL );
+
+  apr_pool_create( &tmp_mp, NULL );
+  key = apr_psprintf( tmp_mp, "%c%s", how, path );
+
+  /* Only used to see if the entry is still current. */
+  if ( apr_stat( &finfo, path, APR_FINFO_SIZE | APR_FINFO_MTIME,
+                 tmp_mp ) != APR_SUCCESS ||
+       ( use_hash && !hash_file( tmp_mp, path, &hash ) ) ) {
+    apr_pool_destroy( tmp_mp );
+    return NULL;
+  }
+
+  cache_lock( cache );
+  entry = apr_hash_get( cache->entries, key, APR_HASH_KEY_STRING );
+  if ( entry_is_current( cache, entry, &finfo, hash ) ) {
+    cache_unlink( cache, entry );
+    cache_push_front( cache, entry );
+    doc = json_doc_retain( entry->doc );
+  }
+  cache_unlock( cache );
+
+  /*
+   * Parse without the lock so lookups of other files aren't held up.  The
+   * entry describes the file as it was parsed, which may have changed since
+   * it was looked at.
+   */
+  if ( !doc && ( doc = load_doc( how, path, &loaded_finfo,
+                                 ( use_hash ) ? &loaded_hash : NULL ) ) ) {
+    cache_lock( cache );
+    entry = apr_hash_get( cache->entries, key, APR_HASH_KEY_STRING );
+    if ( entry_is_current( cache, entry, &loaded_finfo, loaded_hash ) ) {
+      /* Another thread loaded the same file meanwhile, share its copy. */
+      json_doc_release( doc );
+      cache_unlink( cache, entry );
+      cache_push_front( cache, entry );
+      doc = json_doc_retain( entry->doc );
+    }
+    else {
+      if ( entry )
+        cache_drop( cache, entry );
+      cache_insert( cache, key, doc, &loaded_finfo, loaded_hash );
+    }
+    cache_unlock( cache );
+  }
+
+  apr_pool_destroy( tmp_mp );
+
+  return doc;
+}
+
+json_doc_t *jxtl_data_cache_get_json( jxtl_data_cache_t *cache,
+                                      const char *json_file )
+{
+  return data_cache_get( cache, LOAD_JSON, json_file );
+}
+
+json_doc_t *jxtl_data_cache_get_xml( jxtl_data_cache_t *cache,
+                                     const char *xml_file, int skip_root )
+{
+  return data_cache_get( cache, ( skip_root ) ? LOAD_XML_SKIP_ROOT : LOAD_XML,
+                         xml_file );
+}
+
+void jxtl_data_cache_clear( jxtl_data_cache_t *cache )
+{
+  cache_lock( cache );
+  while ( cache->head ) {
+    cache_drop( cache, cache->head );
+  }
+  cache_unlock( cache );
+}
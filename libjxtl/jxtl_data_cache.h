@@ -0,0 +1,104 @@
+/*
+ * jxtl_data_cache.h
+ *
+ * Description
+ *   Keeps dictionaries loaded from files so they are parsed once.
+ *
+ * Copyright 2010 Dan Rinehimer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef JXTL_DATA_CACHE_H
+#define JXTL_DATA_CACHE_H
+
+#include <apr_general.h>
+#include <apr_hash.h>
+#include <apr_pools.h>
+#if APR_HAS_THREADS
+#include <apr_thread_mutex.h>
+#endif
+
+#include "json_doc.h"
+
+/**
+ * Cache flag to also compare a hash of the file's contents before reusing a
+ * dictionary, for files that may be rewritten without changing their size or
+ * modification time.  Each lookup then reads the whole file.
+ */
+#define JXTL_DATA_CACHE_HASH 0x1
+
+/**
+ * Dictionaries are kept as documents (see json_doc.h), keyed by the path
+ * they were loaded from and how they were loaded.  One is reused as long as
+ * the file has the size and modification time it had when it was loaded.
+ *
+ * The budget is counted in bytes of the files loaded, which the compacted
+ * trees are roughly proportional to.  When it is exceeded the least recently
+ * used dictionaries are dropped.  Documents handed out stay valid until they
+ * are released, even after the cache drops them.
+ *
+ * A cache can be used from several threads.
+ */
+typedef struct jxtl_data_cache_t {
+  apr_pool_t *mp;
+  int flags;
+  /** The most bytes of files to keep, or 0 for no limit. */
+  apr_size_t budget;
+  /** The bytes of files kept. */
+  apr_size_t used;
+  apr_hash_t *entries;
+  /** The most recently used entry. */
+  struct jxtl_data_cache_entry_t *head;
+  /** The least recently used entry, dropped first. */
+  struct jxtl_data_cache_entry_t *tail;
+#if APR_HAS_THREADS
+  apr_thread_mutex_t *mutex;
+#endif
+} jxtl_data_cache_t;
+
+/**
+ * Create a cache.  Its dictionaries are released when mp is cleared or
+ * destroyed.
+ * @param mp Pool to allocate the cache from.
+ * @param budget The most bytes of files to keep, or 0 for no limit.
+ * @param flags 0 or JXTL_DATA_CACHE_HASH.
+ */
+jxtl_data_cache_t *jxtl_data_cache_create( apr_pool_t *mp,
+                                           apr_size_t budget, int flags );
+
+/**
+ * Get the dictionary in a JSON file, parsing it only if it isn't cached or
+ * the file changed.  Standard input ("-") is parsed every time.
+ * @param cache The cache.
+ * @param json_file The path of the file.
+ * @return A document with a reference for the caller, who releases it with
+ *         json_doc_release, or NULL if the file could not be read or parsed.
+ */
+json_doc_t *jxtl_data_cache_get_json( jxtl_data_cache_t *cache,
+                                      const char *json_file );
+
+/**
+ * Get the dictionary converted from an XML file, like
+ * jxtl_data_cache_get_json.
+ * @param skip_root Passed to xml_to_json.
+ */
+json_doc_t *jxtl_data_cache_get_xml( jxtl_data_cache_t *cache,
+                                     const char *xml_file, int skip_root );
+
+/**
+ * Drop every dictionary in the cache.
+ */
+void jxtl_data_cache_clear( jxtl_data_cache_t *cache );
+
+#endif
@@ -11,15 +11,15 @@
 #include "jxtl_path_lex.h"
 #include "parser.h"
 
-#define NODELIST_SIZE 1024
+#define NODELIST_SIZE 16
 
 static void jxtl_path_eval_internal( jxtl_path_expr_t *expr,
-                                     json_t *json,
-                                     apr_array_header_t *nodes,
+                                     jxtl_path_frame_t *frame,
+                                     jxtl_path_obj_t *obj,
                                      int predicate_depth );
 static void jxtl_path_test_node( jxtl_path_expr_t *expr,
-                                 json_t *json,
-                                 apr_array_header_t *nodes,
+                                 jxtl_path_frame_t *frame,
+                                 jxtl_path_obj_t *obj,
                                  int predicate_depth );
 
 static jxtl_path_obj_t *jxtl_path_obj_create( apr_pool_t *mp )
@@ -29,36 +29,59 @@ static jxtl_path_obj_t *jxtl_path_obj_create( apr_pool_t *mp )
   path_obj = apr_palloc( mp, sizeof(jxtl_path_obj_t) );
   path_obj->mp = mp;
   path_obj->nodes = apr_array_make( mp, NODELIST_SIZE, sizeof(json_t *) );
+  path_obj->frames = apr_array_make( mp, NODELIST_SIZE,
+                                     sizeof(jxtl_path_frame_t *) );
 
   return path_obj;
 }
 
+jxtl_path_frame_t *jxtl_path_frame_create( apr_pool_t *mp,
+                                           jxtl_path_frame_t *parent,
+                                           json_t *json )
+{
+  jxtl_path_frame_t *frame;
+
+  frame = apr_palloc( mp, sizeof(jxtl_path_frame_t) );
+  frame->json = json;
+  frame->parent = parent;
+
+  return frame;
+}
+
+static void jxtl_path_push( jxtl_path_obj_t *obj, jxtl_path_frame_t *frame )
+{
+  APR_ARRAY_PUSH( obj->nodes, json_t * ) = frame->json;
+  APR_ARRAY_PUSH( obj->frames, jxtl_path_frame_t * ) = frame;
+}
+
 /**
  * Finish a predicate.  If it evaluated to true and the expression is done,
  * push the node on the result stack.  If it evaluated to true and the
  * expression is not done, recursively evaluate.  If it's false, do nothing.
  */
 static void jxtl_finish_predicate( jxtl_path_expr_t *expr,
-                                   json_t *json,
-                                   apr_array_header_t *nodes,
+                                   jxtl_path_frame_t *frame,
+                                   jxtl_path_obj_t *obj,
                                    int predicate_nodes,
                                    int predicate_depth )
 {
   int result;
   result = ( expr->predicate->negate ) ? !predicate_nodes : predicate_nodes;
   if ( result && !expr->next ) {
-    APR_ARRAY_PUSH( nodes, json_t * ) = json;
+    jxtl_path_push( obj, frame );
   }
   else if ( result && expr->next ) {
-    jxtl_path_eval_internal( expr->next, json, nodes, predicate_depth );
+    jxtl_path_eval_internal( expr->next, frame, obj, predicate_depth );
   }
 }
 
 static void jxtl_path_test_node( jxtl_path_expr_t *expr,
-                                 json_t *json,
-                                 apr_array_header_t *nodes,
+                                 jxtl_path_frame_t *frame,
+                                 jxtl_path_obj_t *obj,
                                  int predicate_depth )
 {
+  json_t *json = frame->json;
+
   if ( json && expr ) {
     if ( expr->predicate ) {
       /*
@@ -68,31 +91,34 @@ static void jxtl_path_test_node( jxtl_path_expr_t *expr,
        */
       apr_pool_t *mp;
       apr_pool_create( &mp, NULL );
-      apr_array_header_t *predicate_nodes = apr_array_make( mp, NODELIST_SIZE,
-                                                            sizeof(json_t *) );
+      jxtl_path_obj_t *predicate_obj = jxtl_path_obj_create( mp );
       if ( json->type == JSON_ARRAY ) {
         int i;
-        json_t *tmp_json;
+        jxtl_path_frame_t *tmp_frame;
         for ( i = 0; i < json->value.array->nelts; i++ ) {
-          APR_ARRAY_CLEAR( predicate_nodes );
-          tmp_json = APR_ARRAY_IDX( json->value.array, i, json_t * );
-          jxtl_path_eval_internal( expr->predicate, tmp_json, predicate_nodes,
+          APR_ARRAY_CLEAR( predicate_obj->nodes );
+          APR_ARRAY_CLEAR( predicate_obj->frames );
+          tmp_frame = jxtl_path_frame_create( obj->mp, frame,
+                                              APR_ARRAY_IDX( json->value.array,
+                                                             i, json_t * ) );
+          jxtl_path_eval_internal( expr->predicate, tmp_frame, predicate_obj,
                                    predicate_depth + 1 );
-          jxtl_finish_predicate( expr, tmp_json, nodes,
-                                 predicate_nodes->nelts, predicate_depth );
+          jxtl_finish_predicate( expr, tmp_frame, obj,
+                                 predicate_obj->nodes->nelts,
+                                 predicate_depth );
         }
       }
       else {
-        jxtl_path_eval_internal( expr->predicate, json, predicate_nodes,
+        jxtl_path_eval_internal( expr->predicate, frame, predicate_obj,
                                  predicate_depth + 1 );
-        jxtl_finish_predicate( expr, json, nodes, predicate_nodes->nelts,
+        jxtl_finish_predicate( expr, frame, obj, predicate_obj->nodes->nelts,
                                predicate_depth );
       }
       apr_pool_destroy( mp );
     }
     else if ( expr->next ) {
       /* No predicate, but expression keeps going. */
-      jxtl_path_eval_internal( expr->next, json, nodes, predicate_depth );
+      jxtl_path_eval_internal( expr->next, frame, obj, predicate_depth );
     }
     else {
       /* This is the end of the expression, push on whatever nodes are left. */
@@ -101,14 +127,15 @@ static void jxtl_path_test_node( jxtl_path_expr_t *expr,
         json_t *tmp_json;
         for ( i = 0; i < json->value.array->nelts; i++ ) {
           tmp_json = APR_ARRAY_IDX( json->value.array, i, json_t * );
-          APR_ARRAY_PUSH( nodes, json_t * ) = tmp_json;
+          jxtl_path_push( obj, jxtl_path_frame_create( obj->mp, frame,
+                                                       tmp_json ) );
         }
       }
       else {
         if ( ( predicate_depth == 0 ) ||
              ( !JSON_IS_BOOLEAN( json ) ) ||
              ( JSON_IS_TRUE_BOOLEAN( json ) ) ) {
-          APR_ARRAY_PUSH( nodes, json_t * ) = json;
+          jxtl_path_push( obj, frame );
         }
       }
     }
@@ -116,12 +143,14 @@ static void jxtl_path_test_node( jxtl_path_expr_t *expr,
 }
 
 static void jxtl_path_eval_internal( jxtl_path_expr_t *expr,
-                                     json_t *json,
-                                     apr_array_header_t *nodes,
+                                     jxtl_path_frame_t *frame,
+                                     jxtl_path_obj_t *obj,
                                      int predicate_depth )
 {
   int i;
+  json_t *json = frame->json;
   json_t *tmp_json = NULL;
+  jxtl_path_frame_t *tmp_frame = NULL;
   apr_hash_index_t *idx;
 
   if ( !json )
@@ -133,43 +162,62 @@ static void jxtl_path_eval_internal( jxtl_path_expr_t *expr,
   if ( json->type == JSON_ARRAY ) {
     for ( i = 0; i < json->value.array->nelts; i++ ) {
       tmp_json = APR_ARRAY_IDX( json->value.array, i, json_t * );
-      jxtl_path_eval_internal( expr, tmp_json, nodes, predicate_depth );
+      jxtl_path_eval_internal( expr,
+                               jxtl_path_frame_create( obj->mp, frame,
+                                                       tmp_json ),
+                               obj, predicate_depth );
     }
     return;
   }
 
   switch ( expr->type ) {
   case JXTL_PATH_ROOT_OBJ:
-    for( tmp_json = json; tmp_json && tmp_json->parent;
-         tmp_json = tmp_json->parent );
+    for ( tmp_frame = frame; tmp_frame->parent;
+          tmp_frame = tmp_frame->parent );
     break;
 
   case JXTL_PATH_PARENT_OBJ:
-    tmp_json = json->parent;
-    if ( tmp_json && tmp_json->type == JSON_ARRAY ) {
-      tmp_json = tmp_json->parent;
+    tmp_frame = frame->parent;
+    if ( tmp_frame && tmp_frame->json->type == JSON_ARRAY ) {
+      tmp_frame = tmp_frame->parent;
     }
     break;
 
   case JXTL_PATH_CURRENT_OBJ:
-    tmp_json = json;
+    tmp_frame = frame;
     break;
 
   case JXTL_PATH_ANY_OBJ:
-    if ( json && json->type == JSON_OBJECT ) {
-      for ( idx = apr_hash_first( NULL, json->value.object ); idx;
+    if ( json->type == JSON_OBJECT ) {
+      for ( idx = apr_hash_first( obj->mp, json->value.object ); idx;
             idx = apr_hash_next( idx ) ) {
         apr_hash_this( idx, NULL, NULL, (void **) &tmp_json );
-        jxtl_path_test_node( expr, tmp_json, nodes, predicate_depth );
+        jxtl_path_test_node( expr,
+                             jxtl_path_frame_create( obj->mp, frame,
+                                                     tmp_json ),
+                             obj, predicate_depth );
       }
     }
     return;
     break;
 
   case JXTL_PATH_LOOKUP:
-    if ( json && json->type == JSON_OBJECT ) {
-      tmp_json = apr_hash_get( json->value.object, expr->identifier,
-                               APR_HASH_KEY_STRING );
+    if ( json->type == JSON_OBJECT ) {
+      if ( JSON_HAS_SLOTS( json ) && expr->slot >= 0 &&
+           expr->slot < json->len ) {
+        tmp_json = json->value.schema_object.slots[expr->slot];
+      }
+      /*
+       * The slot is only right if the object was loaded with the schema that
+       * the expression was resolved with, which shares its names.
+       */
+      if ( !tmp_json || JSON_NAME( tmp_json ) != expr->identifier ) {
+        tmp_json = apr_hash_get( json->value.object, expr->identifier,
+                                 APR_HASH_KEY_STRING );
+      }
+      if ( tmp_json ) {
+        tmp_frame = jxtl_path_frame_create( obj->mp, frame, tmp_json );
+      }
     }
     break;
 
@@ -177,14 +225,79 @@ static void jxtl_path_eval_internal( jxtl_path_expr_t *expr,
     break;
   }
 
-  jxtl_path_test_node( expr, tmp_json, nodes, predicate_depth );
+  if ( tmp_frame ) {
+    jxtl_path_test_node( expr, tmp_frame, obj, predicate_depth );
+  }
+}
+
+static jxtl_path_schema_frame_t *schema_frame_create(
+  apr_pool_t *mp,
+  jxtl_path_schema_frame_t *parent,
+  json_schema_t *schema )
+{
+  jxtl_path_schema_frame_t *frame;
+
+  frame = apr_palloc( mp, sizeof(jxtl_path_schema_frame_t) );
+  frame->schema = schema;
+  frame->parent = parent;
+
+  return frame;
+}
+
+jxtl_path_schema_frame_t *jxtl_path_resolve_schema(
+  apr_pool_t *mp,
+  jxtl_path_expr_t *expr,
+  jxtl_path_schema_frame_t *frame )
+{
+  json_schema_t *schema;
+
+  for ( ; expr && frame && frame->schema; expr = expr->next ) {
+    switch ( expr->type ) {
+    case JXTL_PATH_ROOT_OBJ:
+      for ( ; frame->parent; frame = frame->parent );
+      break;
+
+    case JXTL_PATH_PARENT_OBJ:
+      frame = frame->parent;
+      break;
+
+    case JXTL_PATH_CURRENT_OBJ:
+      break;
+
+    case JXTL_PATH_LOOKUP:
+      schema = json_schema_get_property( frame->schema, expr->identifier );
+      if ( schema ) {
+        expr->slot = schema->slot;
+        expr->identifier = schema->name;
+        /* Arrays are looked through, so the result is one element. */
+        if ( schema->type == JSON_ARRAY ) {
+          schema = schema->items;
+        }
+      }
+      frame = schema_frame_create( mp, frame, schema );
+      break;
+
+    default:
+      /* Any property could match, so the schema isn't known. */
+      frame = NULL;
+      break;
+    }
+
+    if ( frame && expr->predicate ) {
+      jxtl_path_resolve_schema( mp, expr->predicate, frame );
+    }
+  }
+
+  return ( expr ) ? NULL : frame;
 }
 
 /**
- * Evaluate a pre-compiled expression.  Returns the number of nodes.
+ * Evaluate a pre-compiled expression starting from frame.  Returns the number
+ * of nodes.
  */
-int jxtl_path_compiled_eval( apr_pool_t *mp, jxtl_path_expr_t *expr,
-                             json_t *json, jxtl_path_obj_t **obj_ptr )
+int jxtl_path_compiled_eval_frame( apr_pool_t *mp, jxtl_path_expr_t *expr,
+                                   jxtl_path_frame_t *frame,
+                                   jxtl_path_obj_t **obj_ptr )
 {
   jxtl_path_obj_t *obj;
 
@@ -195,12 +308,25 @@ int jxtl_path_compiled_eval( apr_pool_t *mp, jxtl_path_expr_t *expr,
   }
 
   obj = jxtl_path_obj_create( mp );
-  jxtl_path_eval_internal( expr, json, obj->nodes, 0 );
+  jxtl_path_eval_internal( expr, frame, obj, 0 );
   *obj_ptr = obj;
 
   return obj->nodes->nelts;
 }
 
+/**
+ * Evaluate a pre-compiled expression with json as the root.  Returns the
+ * number of nodes.
+ */
+int jxtl_path_compiled_eval( apr_pool_t *mp, jxtl_path_expr_t *expr,
+                             json_t *json, jxtl_path_obj_t **obj_ptr )
+{
+  return jxtl_path_compiled_eval_frame( mp, expr,
+                                        jxtl_path_frame_create( mp, NULL,
+                                                                json ),
+                                        obj_ptr );
+}
+
 /**
  * Evaluate the given path expression in the context of json.
  * Returns the number of nodes selected or -1 if there was an error parsing
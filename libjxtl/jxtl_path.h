@@ -6,6 +6,7 @@
 
 #include "parser.h"
 #include "json.h"
+#include "json_schema.h"
 #include "jxtl_path_expr.h"
 
 /*
@@ -23,9 +24,34 @@ typedef struct jxtl_path_callback_t {
   void *user_data;
 } jxtl_path_callback_t;
 
+/**
+ * One level of the evaluation stack.  Nodes don't know their parents (so that
+ * they can be shared), so the evaluator and the template expander record how
+ * each node was reached.  This is what ".." and "/" are resolved against.
+ */
+typedef struct jxtl_path_frame_t {
+  /** The node at this level. */
+  json_t *json;
+  /** The frame this node was reached from, NULL for the root. */
+  struct jxtl_path_frame_t *parent;
+} jxtl_path_frame_t;
+
+/**
+ * The schema of one level of the evaluation stack, used to resolve
+ * expressions before they are evaluated.
+ */
+typedef struct jxtl_path_schema_frame_t {
+  /** The schema of the node at this level, or NULL if it isn't known. */
+  json_schema_t *schema;
+  /** The level above, NULL for the root. */
+  struct jxtl_path_schema_frame_t *parent;
+} jxtl_path_schema_frame_t;
+
 typedef struct jxtl_path_obj_t {
   apr_pool_t *mp;
   apr_array_header_t *nodes;
+  /** The frame of each entry in nodes. */
+  apr_array_header_t *frames;
 } jxtl_path_obj_t;
 
 parser_t *jxtl_path_parser_create( apr_pool_t *mp );
@@ -38,4 +64,39 @@ int jxtl_path_eval( apr_pool_t *mp, const char *path, json_t *json,
 int jxtl_path_compiled_eval( apr_pool_t *mp, jxtl_path_expr_t *expr,
                              json_t *json, jxtl_path_obj_t **obj_ptr );
 
+/**
+ * Create a new frame for json on top of parent.
+ * @param mp Pool to allocate the frame from.
+ * @param parent The frame json was reached from, or NULL if json is the root.
+ * @param json The node.
+ * @return The new frame.
+ */
+jxtl_path_frame_t *jxtl_path_frame_create( apr_pool_t *mp,
+                                           jxtl_path_frame_t *parent,
+                                           json_t *json );
+
+/**
+ * Evaluate a pre-compiled expression in the context of frame->json, using the
+ * frame's ancestry for parent and root lookups.
+ * @return The number of nodes selected.
+ */
+int jxtl_path_compiled_eval_frame( apr_pool_t *mp, jxtl_path_expr_t *expr,
+                                   jxtl_path_frame_t *frame,
+                                   jxtl_path_obj_t **obj_ptr );
+
+/**
+ * Resolve the identifiers of a compiled expression to slots.  Identifiers
+ * that are properties in the schema are replaced by the schema's name, and
+ * evaluation looks them up by slot in objects loaded with the same schema.
+ * Everything else is still looked up by name.
+ * @param mp Pool to allocate frames from.
+ * @param expr The expression.
+ * @param frame The schema of the node expr will be evaluated on.
+ * @return The schema of the nodes expr selects.
+ */
+jxtl_path_schema_frame_t *jxtl_path_resolve_schema(
+  apr_pool_t *mp,
+  jxtl_path_expr_t *expr,
+  jxtl_path_schema_frame_t *frame );
+
 #endif
@@ -52,6 +52,7 @@ static void create_expr( path_data_t *data,
   expr = apr_palloc( data->mp, sizeof( jxtl_path_expr_t ) );
   expr->type = type;
   expr->identifier = identifier;
+  expr->slot = -1;
   expr->root = ( data->root ) ? data->root : expr;
   expr->next = NULL;
   expr->predicate = NULL;
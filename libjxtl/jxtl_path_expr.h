@@ -39,6 +39,11 @@ typedef struct jxtl_path_expr_t {
   jxtl_path_expr_type type;
   /** A name to lookup. */
   char *identifier;
+  /**
+   * Slot of identifier in objects loaded with a schema, or -1.  Set by
+   * jxtl_path_resolve_schema.
+   */
+  int slot;
   /** The beginning of this expression. */
   struct jxtl_path_expr_t *root;
   /** Next expression. */
@@ -19,6 +19,9 @@
  * limitations under the License.
  */
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <apr_buckets.h>
 #include <apr_hash.h>
 #include <apr_general.h>
@@ -32,6 +35,9 @@
 #include "jxtl_path_expr.h"
 #include "jxtl_template.h"
 #include "json.h"
+#include "json_compress.h"
+#include "json_edit.h"
+#include "json_number.h"
 
 /**
  * Structure to hold data during parsing.  One of these will be passed to the
@@ -110,6 +116,7 @@ static int jxtl_section_start( void *user_data, char *expr )
                                                   &section->expr );
   section->content = apr_array_make( data->mp, 1024,
                                      sizeof(jxtl_content_t *) );
+  section->cacheable = FALSE;
   jxtl_content_push( data, JXTL_SECTION, section );
   APR_ARRAY_PUSH( data->content_array,
                   apr_array_header_t * ) = data->current_array;
@@ -285,17 +292,305 @@ static void jxtl_format( void *user_data, char *format )
   data->last_section_or_value->format = apr_pstrdup( data->mp, format );
 }
 
+/***************************************************************************
+  Compilation of the content into a program
+ ***************************************************************************/
+
+/** Where content is printed, which decides how its text is trimmed. */
+typedef enum section_print_type {
+  PRINT_NORMAL,
+  PRINT_SECTION,
+  PRINT_SEPARATOR
+} section_print_type;
+
+typedef enum jxtl_op_type {
+  /** Print text. */
+  JXTL_OP_TEXT,
+  /** Start a loop over the nodes a section selects, or skip the section. */
+  JXTL_OP_SECTION,
+  /** Start a loop over the nodes a value selects, or skip the value. */
+  JXTL_OP_VALUE,
+  /** Print the node of the innermost loop. */
+  JXTL_OP_PRINT,
+  /**
+   * End the body of the innermost loop.  After its last node the loop is
+   * finished, otherwise the separator or the body follows for the next node.
+   */
+  JXTL_OP_NEXT,
+  /** End the separator of the innermost loop and start the next node. */
+  JXTL_OP_REPEAT,
+  /** Go to jump if the expression of an if is false. */
+  JXTL_OP_BRANCH,
+  /** Go to jump. */
+  JXTL_OP_JUMP
+} jxtl_op_type;
+
+/**
+ * One instruction of a compiled template.  A loop is laid out as its
+ * JXTL_OP_SECTION or JXTL_OP_VALUE, its body (a JXTL_OP_PRINT for a value),
+ * its JXTL_OP_NEXT and, if it has one, its separator followed by a
+ * JXTL_OP_REPEAT.
+ */
+typedef struct jxtl_op_t {
+  jxtl_op_type type;
+  /** The text of a JXTL_OP_TEXT, trimmed the way it is printed. */
+  char *text;
+  /** The length of the text. */
+  apr_size_t len;
+  /** The expression of a loop or a branch. */
+  jxtl_path_expr_t *expr;
+  /** The section of a JXTL_OP_SECTION, for the cache. */
+  jxtl_section_t *section;
+  /**
+   * The format of a loop, its own or the one of the content it is in.  Its
+   * body and separator have the same one.
+   */
+  char *format;
+  /** If a loop has a separator. */
+  int separator;
+  /** The JXTL_OP_NEXT of a loop. */
+  int next;
+  /**
+   * The instruction after a loop, or after the content of a branch that
+   * isn't taken, or the one a JXTL_OP_JUMP goes to.
+   */
+  int jump;
+} jxtl_op_t;
+
+/**
+ * The state of a loop that is being expanded.
+ */
+typedef struct jxtl_loop_t {
+  /** The instruction that started it. */
+  int start;
+  jxtl_path_obj_t *path_obj;
+  /** The node being expanded. */
+  int index;
+  /** The frame it was started from. */
+  jxtl_path_frame_t *frame;
+} jxtl_loop_t;
+
+typedef struct jxtl_program_t {
+  /** The instructions, as jxtl_op_t. */
+  apr_array_header_t *ops;
+  /** A stack as deep as loops are nested. */
+  jxtl_loop_t *loops;
+  int depth;
+} jxtl_program_t;
+
+#define PROGRAM_OP( program, i ) \
+  ( &APR_ARRAY_IDX( (program)->ops, i, jxtl_op_t ) )
+
+/**
+ * Append an instruction to a program.
+ * @return Its index.
+ */
+static int program_push( jxtl_program_t *program, jxtl_op_type type,
+                         char *format )
+{
+  jxtl_op_t *op = apr_array_push( program->ops );
+
+  op->type = type;
+  op->text = NULL;
+  op->len = 0;
+  op->expr = NULL;
+  op->section = NULL;
+  op->format = format;
+  op->separator = FALSE;
+  op->next = -1;
+  op->jump = -1;
+
+  return program->ops->nelts - 1;
+}
+
+static void compile_content( jxtl_program_t *program,
+                             apr_array_header_t *content_array,
+                             char *format, section_print_type print_type,
+                             int depth );
+
+/**
+ * Compile a text.  The content of sections and ifs drops a newline at its
+ * start and at its end, which only depends on where the text is, so the
+ * text is trimmed here once rather than each time it is printed.
+ * @param first If the text starts the content it is in.
+ * @param last If the text ends the content it is in.
+ */
+static void compile_text( jxtl_program_t *program, char *text, char *format,
+                          section_print_type print_type, int first,
+                          int last )
+{
+  int index = program_push( program, JXTL_OP_TEXT, format );
+  jxtl_op_t *op = PROGRAM_OP( program, index );
+
+  op->text = text;
+  op->len = strlen( text );
+
+  if ( print_type == PRINT_SECTION && first && op->text[0] == '\n' ) {
+    op->text++;
+    op->len--;
+  }
+  if ( print_type == PRINT_SECTION && last && op->len > 0 &&
+       op->text[op->len - 1] == '\n' ) {
+    op->len--;
+  }
+}
+
+/**
+ * Compile a section or a value, which loop over the nodes they select.
+ */
+static void compile_loop( jxtl_program_t *program, jxtl_content_t *content,
+                          char *format, int depth )
+{
+  int start, next;
+  jxtl_op_t *op;
+
+  if ( content->format )
+    format = content->format;
+
+  if ( depth + 1 > program->depth )
+    program->depth = depth + 1;
+
+  if ( content->type == JXTL_SECTION ) {
+    start = program_push( program, JXTL_OP_SECTION, format );
+    op = PROGRAM_OP( program, start );
+    op->section = content->value;
+    op->expr = op->section->expr;
+    compile_content( program, op->section->content, format, PRINT_SECTION,
+                     depth + 1 );
+  }
+  else {
+    start = program_push( program, JXTL_OP_VALUE, format );
+    PROGRAM_OP( program, start )->expr = content->value;
+    program_push( program, JXTL_OP_PRINT, format );
+  }
+
+  next = program_push( program, JXTL_OP_NEXT, format );
+  if ( content->separator ) {
+    compile_content( program, content->separator, format, PRINT_SEPARATOR,
+                     depth + 1 );
+    program_push( program, JXTL_OP_REPEAT, format );
+  }
+
+  op = PROGRAM_OP( program, start );
+  op->separator = ( content->separator != NULL );
+  op->next = next;
+  op->jump = program->ops->nelts;
+  PROGRAM_OP( program, next )->jump = program->ops->nelts;
+}
+
+/**
+ * Compile the ifs of an if block into branches over their content, each
+ * followed by a jump past the rest of the block.
+ */
+static void compile_if_block( jxtl_program_t *program,
+                              apr_array_header_t *if_block, char *format,
+                              int depth )
+{
+  int i;
+  int branch;
+  int jump;
+  int jumps = -1;
+  jxtl_if_t *jxtl_if;
+
+  for ( i = 0; i < if_block->nelts; i++ ) {
+    jxtl_if = APR_ARRAY_IDX( if_block, i, jxtl_if_t * );
+    branch = -1;
+    if ( jxtl_if->expr ) {
+      branch = program_push( program, JXTL_OP_BRANCH, format );
+      PROGRAM_OP( program, branch )->expr = jxtl_if->expr;
+    }
+    compile_content( program, jxtl_if->content, format, PRINT_SECTION,
+                     depth );
+    if ( i + 1 < if_block->nelts ) {
+      /* Chain the jumps through their targets until the end is known. */
+      jump = program_push( program, JXTL_OP_JUMP, format );
+      PROGRAM_OP( program, jump )->jump = jumps;
+      jumps = jump;
+    }
+    if ( branch >= 0 ) {
+      PROGRAM_OP( program, branch )->jump = program->ops->nelts;
+    }
+  }
+
+  for ( ; jumps >= 0; jumps = jump ) {
+    jump = PROGRAM_OP( program, jumps )->jump;
+    PROGRAM_OP( program, jumps )->jump = program->ops->nelts;
+  }
+}
+
+/**
+ * Compile an array of content.
+ * @param format The format of the content it is in.
+ * @param print_type How the content is printed, which decides how its text
+ *        is trimmed.
+ * @param depth How many loops the content is in.
+ */
+static void compile_content( jxtl_program_t *program,
+                             apr_array_header_t *content_array,
+                             char *format, section_print_type print_type,
+                             int depth )
+{
+  int i;
+  jxtl_content_t *content;
+
+  for ( i = 0; i < content_array->nelts; i++ ) {
+    content = APR_ARRAY_IDX( content_array, i, jxtl_content_t * );
+    switch ( content->type ) {
+    case JXTL_TEXT:
+      compile_text( program, content->value, format, print_type, ( i == 0 ),
+                    ( i + 1 == content_array->nelts ) );
+      break;
+
+    case JXTL_SECTION:
+    case JXTL_VALUE:
+      compile_loop( program, content, format, depth );
+      break;
+
+    case JXTL_IF:
+      compile_if_block( program, content->value, format, depth );
+      break;
+    }
+  }
+}
+
+/**
+ * Lower the content of a template into a flat program, which is expanded
+ * with an explicit stack instead of by recursion.  Formats are resolved, so
+ * that each instruction has the one it is printed with.
+ */
+static jxtl_program_t *compile_program( apr_pool_t *mp,
+                                        apr_array_header_t *content )
+{
+  jxtl_program_t *program = apr_palloc( mp, sizeof(jxtl_program_t) );
+
+  program->ops = apr_array_make( mp, 64, sizeof(jxtl_op_t) );
+  program->depth = 0;
+  compile_content( program, content, NULL, PRINT_NORMAL, 0 );
+  program->loops = apr_palloc( mp, sizeof(jxtl_loop_t) *
+                                   ( program->depth + 1 ) );
+
+  return program;
+}
+
 static jxtl_template_t *jxtl_template_create( apr_pool_t *mp,
                                               apr_array_header_t *content )
 {
   jxtl_template_t *template;
   template = apr_palloc( mp, sizeof(jxtl_template_t) );
+  template->mp = mp;
   apr_pool_create( &template->expand_mp, NULL );
   template->content = content;
+  template->program = compile_program( mp, content );
   template->flush_func = NULL;
   template->flush_data = NULL;
   template->formats = apr_hash_make( mp );
   template->format_data = NULL;
+  template->cache = NULL;
+  template->use_cache = FALSE;
+  template->records = NULL;
+  template->inflate_buf = NULL;
+  template->inflate_size = 0;
+  template->status = TRUE;
 
   return template;
 }
@@ -382,13 +677,6 @@ int jxtl_parser_parse_buffer_to_template( apr_pool_t* mp, parser_t *parser,
   Expansion definitions and functions
  ***************************************************************************/
 
-/** Constants used for calling the expand functions */
-typedef enum section_print_type {
-  PRINT_NORMAL,
-  PRINT_SECTION,
-  PRINT_SEPARATOR
-} section_print_type;
-
 static apr_status_t flush_to_file( apr_bucket_brigade *bb, void *ctx )
 {
   apr_bucket *e;
@@ -408,6 +696,26 @@ static apr_status_t flush_to_file( apr_bucket_brigade *bb, void *ctx )
   return APR_SUCCESS;
 }
 
+/**
+ * Decompress a compressed string into the template's buffer, growing it if
+ * the string doesn't fit.
+ * @return The text, or NULL if it couldn't be decompressed.
+ */
+static char *inflate_string( jxtl_template_t *template, json_t *json )
+{
+  apr_size_t size = JSON_STRING_LENGTH( json ) + 1;
+
+  if ( size > template->inflate_size ) {
+    template->inflate_size = ( size > template->inflate_size * 2 ) ?
+                             size : template->inflate_size * 2;
+    template->inflate_buf = apr_palloc( template->expand_mp,
+                                        template->inflate_size );
+  }
+
+  return ( json_decompress( json, template->inflate_buf ) ) ?
+         template->inflate_buf : NULL;
+}
+
 static void print_json_value( json_t *json,
                               char *format,
                               apr_pool_t *mp,
@@ -415,10 +723,28 @@ static void print_json_value( json_t *json,
 {
   char *value = NULL;
   jxtl_format_func format_func = NULL;
+  char number_buf[JSON_NUMBER_BUFFER_SIZE];
+  apr_size_t len;
+  json_t plain;
 
   if ( !json )
     return;
 
+  /*
+   * Decompress a compressed string into a plain copy for as long as it takes
+   * to print it.  Format callbacks are handed the copy.
+   */
+  if ( JSON_IS_STRING( json ) && JSON_IS_COMPRESSED_STRING( json ) ) {
+    plain = *json;
+    plain.len = JSON_STRING_LENGTH( json );
+    if ( !( plain.value.string = inflate_string( template, json ) ) ) {
+      fprintf( stderr, "error:  could not decompress a string\n" );
+      template->status = FALSE;
+      return;
+    }
+    json = &plain;
+  }
+
   if ( format ) {
     format_func = apr_hash_get( template->formats, format,
                                 APR_HASH_KEY_STRING );
@@ -427,6 +753,24 @@ static void print_json_value( json_t *json,
   if ( format_func ) {
     value = format_func( json, format, template->format_data );
   }
+  else if ( JSON_IS_STRING( json ) ) {
+    apr_brigade_write( template->bb, template->flush_func,
+                       template->flush_data, JSON_STRING_VALUE( json ),
+                       json->len );
+  }
+  else if ( ( JSON_IS_INTEGER( json ) || JSON_IS_NUMBER( json ) ) &&
+            JSON_HAS_LEXEME( json ) ) {
+    apr_brigade_write( template->bb, template->flush_func,
+                       template->flush_data, json->value.lexeme.text,
+                       json->len );
+  }
+  else if ( JSON_IS_INTEGER( json ) || JSON_IS_NUMBER( json ) ) {
+    len = ( JSON_IS_INTEGER( json ) ) ?
+      json_format_integer( number_buf, json->value.integer ) :
+      json_format_number( number_buf, json->value.number );
+    apr_brigade_write( template->bb, template->flush_func,
+                       template->flush_data, number_buf, len );
+  }
   else {
     value = json_get_string_value( mp, json );
   }
@@ -437,65 +781,192 @@ static void print_json_value( json_t *json,
   }
 }
 
-static void print_text( char *text,
-                        jxtl_content_t *prev_content,
-                        jxtl_content_t *next_content,
-                        section_print_type print_type,
-                        jxtl_template_t *template )
+static void expand_program( apr_pool_t *mp, jxtl_template_t *template,
+                            int start, int end, jxtl_path_frame_t *frame,
+                            jxtl_loop_t *loops );
+
+/**
+ * The output of a section for one node.  The text follows the structure.
+ */
+typedef struct jxtl_cache_entry_t {
+  /** The node, which is also the key of the first entry in the cache. */
+  json_t *json;
+  jxtl_section_t *section;
+  char *format;
+  /** The generation of the edit the text was made in. */
+  apr_uint64_t generation;
+  apr_size_t len;
+  /** The entry of another section for the same node. */
+  struct jxtl_cache_entry_t *next;
+} jxtl_cache_entry_t;
+
+typedef struct jxtl_cache_t {
+  apr_pool_t *mp;
+  json_edit_t *edit;
+  jxtl_template_t *template;
+  /** Lists of entries, by node. */
+  apr_hash_t *entries;
+} jxtl_cache_t;
+
+#define CACHE_ENTRY_TEXT( entry ) ( (char *) ( (entry) + 1 ) )
+
+static void cache_free_entries( jxtl_cache_entry_t *entry )
 {
-  char *text_ptr = text;
-  int len = strlen( text_ptr );
+  jxtl_cache_entry_t *next;
 
-  if ( ( print_type == PRINT_SECTION ) && ( !prev_content ) &&
-       ( text_ptr[0] == '\n' ) ) {
-    text_ptr++;
-    len--;
+  for ( ; entry; entry = next ) {
+    next = entry->next;
+    free( entry );
   }
-  if ( ( print_type == PRINT_SECTION ) && ( !next_content ) &&
-       ( text_ptr[len - 1] == '\n' ) ) {
-    len--;
+}
+
+/**
+ * Edit listener that drops the entries of nodes taken out of the tree.
+ */
+static void cache_forget( void *data, json_t *json )
+{
+  jxtl_cache_t *cache = (jxtl_cache_t *) data;
+  jxtl_cache_entry_t *entry;
+
+  entry = apr_hash_get( cache->entries, &json, sizeof(json_t *) );
+  if ( entry ) {
+    apr_hash_set( cache->entries, &json, sizeof(json_t *), NULL );
+    cache_free_entries( entry );
   }
-  apr_brigade_printf( template->bb, template->flush_func,
-                      template->flush_data, "%.*s", len, text_ptr );
 }
 
-static void expand_content( apr_pool_t *mp,
-                            jxtl_template_t *template,
-                            apr_array_header_t *content_array,
-                            json_t *json,
-                            char *prev_format,
-                            section_print_type print_type );
+static apr_status_t cache_template_cleanup( void *data );
 
 /**
- * Print a saved section
+ * Free the entries of a cache when its pool goes, which is a child of the
+ * edit's, and detach it from the template.
  */
-static void expand_section( apr_pool_t *mp,
-                            jxtl_template_t *template,
-                            jxtl_section_t *section,
-                            apr_array_header_t *separator,
-                            json_t *json,
-                            char *format,
-                            section_print_type print_type )
+static apr_status_t cache_cleanup( void *data )
 {
-  int i;
-  int num_items;
-  json_t *json_value;
-  jxtl_path_obj_t *path_obj;
+  jxtl_cache_t *cache = (jxtl_cache_t *) data;
+  apr_hash_index_t *idx;
+  jxtl_cache_entry_t *entry;
+
+  for ( idx = apr_hash_first( NULL, cache->entries ); idx;
+        idx = apr_hash_next( idx ) ) {
+    apr_hash_this( idx, NULL, NULL, (void **) &entry );
+    cache_free_entries( entry );
+  }
 
-  if ( !json )
-    return;
+  if ( cache->template->cache == cache ) {
+    cache->template->cache = NULL;
+    cache->template->use_cache = FALSE;
+  }
+  apr_pool_cleanup_kill( cache->template->mp, cache, cache_template_cleanup );
+
+  return APR_SUCCESS;
+}
+
+/**
+ * Drop a cache when the template's pool goes before the edit's.  The edit
+ * stops telling the cache about nodes that leave its tree.
+ */
+static apr_status_t cache_template_cleanup( void *data )
+{
+  jxtl_cache_t *cache = (jxtl_cache_t *) data;
+
+  json_edit_remove_listener( cache->edit, cache_forget, cache );
+  apr_pool_destroy( cache->mp );
+
+  return APR_SUCCESS;
+}
+
+/**
+ * Print a section for the node in frame from the cache, if the node hasn't
+ * changed since the section was printed for it.  Otherwise print it and
+ * keep a copy of the output.
+ * @param start The JXTL_OP_SECTION of the section.
+ * @param loops The stack for the loops in the section.
+ */
+static void expand_cached_section( apr_pool_t *mp,
+                                   jxtl_template_t *template,
+                                   int start,
+                                   jxtl_path_frame_t *frame,
+                                   jxtl_loop_t *loops )
+{
+  jxtl_cache_t *cache = template->cache;
+  jxtl_op_t *op = PROGRAM_OP( template->program, start );
+  jxtl_section_t *section = op->section;
+  char *format = op->format;
+  json_t *json = frame->json;
+  jxtl_cache_entry_t *first, *entry, *new_entry, **entry_ptr;
+  apr_bucket_brigade *bb;
+  brigade_flush_func flush_func;
+  void *flush_data;
+  apr_off_t length;
+  apr_size_t len;
 
-  num_items = jxtl_path_compiled_eval( mp, section->expr, json, &path_obj );
-  for ( i = 0; i < path_obj->nodes->nelts; i++ ) {
-    json_value = APR_ARRAY_IDX( path_obj->nodes, i, json_t * );
-    expand_content( mp, template, section->content, json_value, format,
-                    PRINT_SECTION );
-    /* Only print the separator if it's not the last one */
-    if ( separator && ( i + 1 < num_items ) ) {
-      expand_content( mp, template, separator, json_value, format,
-                      PRINT_SEPARATOR );
+  first = apr_hash_get( cache->entries, &json, sizeof(json_t *) );
+  for ( entry_ptr = &first; *entry_ptr; entry_ptr = &(*entry_ptr)->next ) {
+    if ( (*entry_ptr)->section == section &&
+         (*entry_ptr)->format == format ) {
+      break;
     }
   }
+  entry = *entry_ptr;
+
+  if ( entry && entry->generation >= json_edit_stamp( cache->edit, json ) ) {
+    apr_brigade_write( template->bb, template->flush_func,
+                       template->flush_data, CACHE_ENTRY_TEXT( entry ),
+                       entry->len );
+    return;
+  }
+
+  /* Expand into a brigade of our own, without flushing, to copy it. */
+  bb = template->bb;
+  flush_func = template->flush_func;
+  flush_data = template->flush_data;
+  template->bb = apr_brigade_create( mp, bb->bucket_alloc );
+  template->flush_func = NULL;
+  template->flush_data = NULL;
+
+  expand_program( mp, template, start + 1, op->next, frame, loops );
+
+  apr_brigade_length( template->bb, 1, &length );
+  new_entry = malloc( sizeof(jxtl_cache_entry_t) + length );
+  if ( new_entry ) {
+    len = length;
+    apr_brigade_flatten( template->bb, CACHE_ENTRY_TEXT( new_entry ),
+                         &len );
+    apr_brigade_destroy( template->bb );
+  }
+  else {
+    APR_BRIGADE_CONCAT( bb, template->bb );
+  }
+
+  template->bb = bb;
+  template->flush_func = flush_func;
+  template->flush_data = flush_data;
+
+  if ( !new_entry )
+    return;
+
+  new_entry->json = json;
+  new_entry->section = section;
+  new_entry->format = format;
+  new_entry->generation = cache->edit->generation;
+  new_entry->len = len;
+  /* The key is in the first entry, which may change. */
+  apr_hash_set( cache->entries, &json, sizeof(json_t *), NULL );
+  if ( entry ) {
+    new_entry->next = entry->next;
+    *entry_ptr = new_entry;
+    free( entry );
+  }
+  else {
+    new_entry->next = first;
+    first = new_entry;
+  }
+  apr_hash_set( cache->entries, &first->json, sizeof(json_t *), first );
+
+  apr_brigade_write( template->bb, template->flush_func,
+                     template->flush_data, CACHE_ENTRY_TEXT( new_entry ),
+                     new_entry->len );
 }
 
 /**
@@ -505,13 +976,14 @@ static void expand_section( apr_pool_t *mp,
  * 3) If there was exactly one node and it is a boolean and it's value is true.
  * 4) Anything else is false.
  */
-static int is_true_if( apr_pool_t *mp, jxtl_if_t *jxtl_if, json_t *json )
+static int is_true_if( apr_pool_t *mp, jxtl_path_expr_t *expr,
+                       jxtl_path_frame_t *frame )
 {
   json_t *tmp_json;
   int result = FALSE;
   jxtl_path_obj_t *path_obj;
 
-  jxtl_path_compiled_eval( mp, jxtl_if->expr, json, &path_obj );
+  jxtl_path_compiled_eval_frame( mp, expr, frame, &path_obj );
 
   if ( path_obj->nodes->nelts > 1 ) {
     result = TRUE;
@@ -522,91 +994,283 @@ static int is_true_if( apr_pool_t *mp, jxtl_if_t *jxtl_if, json_t *json )
                JSON_IS_TRUE_BOOLEAN( tmp_json ) );
   }
 
-  return jxtl_if->expr->negate ? !result : result;
+  return expr->negate ? !result : result;
+}
+
+/**
+ * Start the body of a loop for its current node.  A section that is cached
+ * is printed here, see expand_cached_section.
+ * @param frame Set to the frame of the node.
+ * @return The instruction to go on with.
+ */
+static int start_loop_body( apr_pool_t *mp, jxtl_template_t *template,
+                            jxtl_loop_t *loop, jxtl_path_frame_t **frame )
+{
+  jxtl_op_t *op = PROGRAM_OP( template->program, loop->start );
+
+  *frame = APR_ARRAY_IDX( loop->path_obj->frames, loop->index,
+                          jxtl_path_frame_t * );
+
+  if ( template->use_cache && op->section && op->section->cacheable ) {
+    expand_cached_section( mp, template, loop->start, *frame, loop + 1 );
+    return op->next;
+  }
+
+  return loop->start + 1;
+}
+
+/**
+ * Run the instructions of the template's program from start up to end.
+ * @param frame The node the instructions are expanded for.
+ * @param loops The stack for the loops started on the way, which has to be
+ *        as deep as they are nested.
+ */
+static void expand_program( apr_pool_t *mp, jxtl_template_t *template,
+                            int start, int end, jxtl_path_frame_t *frame,
+                            jxtl_loop_t *loops )
+{
+  jxtl_op_t *ops = (jxtl_op_t *) template->program->ops->elts;
+  jxtl_op_t *op;
+  jxtl_loop_t *loop = loops - 1;
+  jxtl_path_obj_t *path_obj;
+  int pc = start;
+
+  while ( pc < end ) {
+    op = &ops[pc];
+    switch ( op->type ) {
+    case JXTL_OP_TEXT:
+      apr_brigade_write( template->bb, template->flush_func,
+                         template->flush_data, op->text, op->len );
+      pc++;
+      break;
+
+    case JXTL_OP_SECTION:
+    case JXTL_OP_VALUE:
+      if ( ( op->type == JXTL_OP_SECTION && !frame->json ) ||
+           !jxtl_path_compiled_eval_frame( mp, op->expr, frame,
+                                           &path_obj ) ) {
+        pc = op->jump;
+        break;
+      }
+      loop++;
+      loop->start = pc;
+      loop->path_obj = path_obj;
+      loop->index = 0;
+      loop->frame = frame;
+      pc = start_loop_body( mp, template, loop, &frame );
+      break;
+
+    case JXTL_OP_PRINT:
+      print_json_value( APR_ARRAY_IDX( loop->path_obj->nodes, loop->index,
+                                       json_t * ),
+                        op->format, mp, template );
+      pc++;
+      break;
+
+    case JXTL_OP_NEXT:
+      /* Only print the separator if it's not the last one */
+      if ( loop->index + 1 >= loop->path_obj->nodes->nelts ) {
+        frame = loop->frame;
+        loop--;
+        pc = op->jump;
+      }
+      else if ( ops[loop->start].separator ) {
+        pc++;
+      }
+      else {
+        loop->index++;
+        pc = start_loop_body( mp, template, loop, &frame );
+      }
+      break;
+
+    case JXTL_OP_REPEAT:
+      loop->index++;
+      pc = start_loop_body( mp, template, loop, &frame );
+      break;
+
+    case JXTL_OP_BRANCH:
+      pc = ( is_true_if( mp, op->expr, frame ) ) ? pc + 1 : op->jump;
+      break;
+
+    case JXTL_OP_JUMP:
+      pc = op->jump;
+      break;
+    }
+  }
+}
+
+void jxtl_template_register_format( jxtl_template_t *template,
+                                    const char *format_name,
+                                    jxtl_format_func func )
+{
+  apr_hash_set( template->formats, format_name, APR_HASH_KEY_STRING, func );
 }
 
-static void expand_content( apr_pool_t *mp,
-                            jxtl_template_t *template,
-                            apr_array_header_t *content_array,
-                            json_t *json,
-                            char *prev_format,
-                            section_print_type print_type )
+void jxtl_template_set_format_data( jxtl_template_t *template,
+                                    void *format_data )
+{
+  template->format_data = format_data;
+}
+
+/**
+ * Resolve the expressions in content_array, which is expanded for nodes that
+ * have the schema in frame.
+ */
+static void resolve_content( apr_pool_t *mp,
+                             apr_array_header_t *content_array,
+                             jxtl_path_schema_frame_t *frame )
 {
   int i, j;
-  jxtl_content_t *content, *prev_content, *next_content;
-  jxtl_section_t *tmp_section;
-  json_t *json_value;
+  jxtl_content_t *content;
+  jxtl_section_t *section;
   jxtl_if_t *jxtl_if;
   apr_array_header_t *if_block;
-  jxtl_path_obj_t *path_obj;
-  char *format;
+  jxtl_path_schema_frame_t *value_frame;
 
-  prev_content = NULL;
-  next_content = NULL;
-
-  for ( i = 0; i < content_array->nelts; i++ ) {
+  for ( i = 0; content_array && i < content_array->nelts; i++ ) {
     content = APR_ARRAY_IDX( content_array, i, jxtl_content_t * );
-    next_content = ( i + 1 < content_array->nelts ) ?
-                   APR_ARRAY_IDX( content_array, i + 1, jxtl_content_t * ) :
-                   NULL;
     switch ( content->type ) {
-    case JXTL_TEXT:
-      print_text( content->value, prev_content, next_content, print_type,
-                  template );
+    case JXTL_SECTION:
+      section = (jxtl_section_t *) content->value;
+      value_frame = jxtl_path_resolve_schema( mp, section->expr, frame );
+      resolve_content( mp, section->content, value_frame );
+      resolve_content( mp, content->separator, value_frame );
       break;
 
+    case JXTL_IF:
+      if_block = (apr_array_header_t *) content->value;
+      for ( j = 0; j < if_block->nelts; j++ ) {
+        jxtl_if = APR_ARRAY_IDX( if_block, j, jxtl_if_t * );
+        jxtl_path_resolve_schema( mp, jxtl_if->expr, frame );
+        resolve_content( mp, jxtl_if->content, frame );
+      }
+      break;
+
+    case JXTL_VALUE:
+      value_frame = jxtl_path_resolve_schema( mp, content->value, frame );
+      resolve_content( mp, content->separator, value_frame );
+      break;
+
+    default:
+      break;
+    }
+  }
+}
+
+void jxtl_template_set_schema( jxtl_template_t *template,
+                               json_schema_t *schema )
+{
+  apr_pool_t *tmp_mp;
+  jxtl_path_schema_frame_t frame;
+
+  apr_pool_create( &tmp_mp, NULL );
+
+  frame.schema = schema;
+  frame.parent = NULL;
+  resolve_content( tmp_mp, template->content, &frame );
+
+  apr_pool_destroy( tmp_mp );
+}
+
+/**
+ * If an expression only looks at or below the node it is evaluated for.
+ */
+static int expr_is_relative( jxtl_path_expr_t *expr )
+{
+  for ( ; expr; expr = expr->next ) {
+    if ( ( expr->type == JXTL_PATH_ROOT_OBJ ) ||
+         ( expr->type == JXTL_PATH_PARENT_OBJ ) ||
+         ( expr->predicate && !expr_is_relative( expr->predicate ) ) ) {
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+/**
+ * Mark the sections in content_array whose output only depends on the node
+ * they are expanded for.
+ * @return TRUE if all of content_array only depends on the node it is
+ *         expanded for.
+ */
+static int mark_cacheable( apr_array_header_t *content_array )
+{
+  int i, j;
+  int result = TRUE;
+  jxtl_content_t *content;
+  jxtl_section_t *section;
+  jxtl_if_t *jxtl_if;
+  apr_array_header_t *if_block;
+
+  for ( i = 0; content_array && i < content_array->nelts; i++ ) {
+    content = APR_ARRAY_IDX( content_array, i, jxtl_content_t * );
+    switch ( content->type ) {
     case JXTL_SECTION:
-      tmp_section = (jxtl_section_t *) content->value;
-      format = ( content->format ) ? content->format : prev_format;
-      expand_section( mp, template, tmp_section, content->separator, json,
-                      format, PRINT_SECTION );
+      section = (jxtl_section_t *) content->value;
+      section->cacheable = mark_cacheable( section->content );
+      if ( !section->cacheable || !expr_is_relative( section->expr ) ) {
+        result = FALSE;
+      }
+      if ( !mark_cacheable( content->separator ) ) {
+        result = FALSE;
+      }
       break;
 
     case JXTL_IF:
-      /*
-       * Loop through all of the ifs until we find a true one and then break
-       * the loop.
-       */
       if_block = (apr_array_header_t *) content->value;
       for ( j = 0; j < if_block->nelts; j++ ) {
         jxtl_if = APR_ARRAY_IDX( if_block, j, jxtl_if_t * );
-        if ( !jxtl_if->expr || ( is_true_if( mp, jxtl_if, json ) ) ) {
-          expand_content( mp, template, jxtl_if->content, json, prev_format,
-                          PRINT_SECTION );
-          break;
+        if ( !expr_is_relative( jxtl_if->expr ) ) {
+          result = FALSE;
+        }
+        if ( !mark_cacheable( jxtl_if->content ) ) {
+          result = FALSE;
         }
       }
       break;
 
     case JXTL_VALUE:
-      format = ( content->format ) ? content->format : prev_format;
-      if ( jxtl_path_compiled_eval( mp, content->value, json, &path_obj ) ) {
-        for ( j = 0; j < path_obj->nodes->nelts; j++ ) {
-          json_value = APR_ARRAY_IDX( path_obj->nodes, j, json_t * );
-          print_json_value( json_value, format, mp, template );
-          if ( content->separator && ( j + 1 < path_obj->nodes->nelts ) ) {
-            expand_content( mp, template, content->separator, json_value,
-                            format, PRINT_SEPARATOR );
-          }
-        }
+      if ( !expr_is_relative( content->value ) ||
+           !mark_cacheable( content->separator ) ) {
+        result = FALSE;
       }
       break;
+
+    default:
+      break;
     }
-    prev_content = content;
   }
-}
 
-void jxtl_template_register_format( jxtl_template_t *template,
-                                    const char *format_name,
-                                    jxtl_format_func func )
-{
-  apr_hash_set( template->formats, format_name, APR_HASH_KEY_STRING, func );
+  return result;
 }
 
-void jxtl_template_set_format_data( jxtl_template_t *template,
-                                    void *format_data )
+void jxtl_template_set_edit( jxtl_template_t *template, json_edit_t *edit )
 {
-  template->format_data = format_data;
+  apr_pool_t *mp;
+  jxtl_cache_t *cache = template->cache;
+
+  if ( cache ) {
+    json_edit_remove_listener( cache->edit, cache_forget, cache );
+    apr_pool_destroy( cache->mp );
+  }
+
+  if ( !edit )
+    return;
+
+  mark_cacheable( template->content );
+
+  apr_pool_create( &mp, edit->mp );
+  cache = apr_palloc( mp, sizeof(jxtl_cache_t) );
+  cache->mp = mp;
+  cache->edit = edit;
+  cache->template = template;
+  cache->entries = apr_hash_make( mp );
+  apr_pool_cleanup_register( mp, cache, cache_cleanup,
+                             apr_pool_cleanup_null );
+  apr_pool_cleanup_register( template->mp, cache, cache_template_cleanup,
+                             apr_pool_cleanup_null );
+  json_edit_add_listener( edit, cache_forget, cache );
+  template->cache = cache;
 }
 
 void expand_template( jxtl_template_t *template, json_t *json,
@@ -615,14 +1279,234 @@ void expand_template( jxtl_template_t *template, json_t *json,
   apr_bucket_alloc_t *bucket_alloc;
 
   apr_pool_clear( template->expand_mp );
+  template->inflate_buf = NULL;
+  template->inflate_size = 0;
+  template->status = TRUE;
 
   template->flush_func = flush_func;
   template->flush_data = flush_data;
+  template->use_cache = ( template->cache &&
+                          template->cache->edit->root == json );
+  bucket_alloc = apr_bucket_alloc_create( template->expand_mp );
+  template->bb = apr_brigade_create( template->expand_mp, bucket_alloc );
+
+  expand_program( template->expand_mp, template, 0,
+                  template->program->ops->nelts,
+                  jxtl_path_frame_create( template->expand_mp, NULL, json ),
+                  template->program->loops );
+}
+
+/**
+ * State of an expansion one record at a time.
+ */
+typedef struct jxtl_records_t {
+  /** The JXTL_OP_SECTION of the section in the template's program. */
+  int start;
+  /** The last step of the section's path. */
+  jxtl_path_expr_t *step;
+  /** Pool for expanding one record. */
+  apr_pool_t *mp;
+  /**
+   * The separator expanded for the last record, printed if another record
+   * follows.
+   */
+  apr_bucket_brigade *separator_bb;
+} jxtl_records_t;
+
+/**
+ * Find the section of a template that can be expanded one record at a time.
+ * @return Its index in the template's content, or -1.
+ */
+static int find_record_section( jxtl_template_t *template )
+{
+  int i;
+  int index = -1;
+  jxtl_content_t *content;
+  jxtl_section_t *section;
+  jxtl_path_expr_t *expr;
+
+  for ( i = 0; i < template->content->nelts; i++ ) {
+    content = APR_ARRAY_IDX( template->content, i, jxtl_content_t * );
+    if ( content->type == JXTL_TEXT ) {
+      continue;
+    }
+    else if ( content->type != JXTL_SECTION || index >= 0 ) {
+      return -1;
+    }
+    index = i;
+  }
+
+  if ( index < 0 )
+    return -1;
+
+  content = APR_ARRAY_IDX( template->content, index, jxtl_content_t * );
+  section = content->value;
+  expr = section->expr;
+  if ( !expr || expr->negate )
+    return -1;
+
+  if ( expr->type == JXTL_PATH_ROOT_OBJ && !expr->predicate )
+    expr = expr->next;
+
+  for ( ; expr; expr = expr->next ) {
+    if ( expr->type != JXTL_PATH_LOOKUP ||
+         ( expr->predicate && ( expr->next ||
+                                !expr_is_relative( expr->predicate ) ) ) ) {
+      return -1;
+    }
+  }
+
+  /* This also marks sections for the cache, which only matters with one. */
+  if ( !mark_cacheable( section->content ) ||
+       !mark_cacheable( content->separator ) ) {
+    return -1;
+  }
+
+  return index;
+}
+
+apr_array_header_t *jxtl_template_record_path( apr_pool_t *mp,
+                                               jxtl_template_t *template )
+{
+  int index = find_record_section( template );
+  jxtl_content_t *content;
+  jxtl_path_expr_t *expr;
+  apr_array_header_t *path;
+
+  if ( index < 0 )
+    return NULL;
+
+  content = APR_ARRAY_IDX( template->content, index, jxtl_content_t * );
+  path = apr_array_make( mp, 4, sizeof(const char *) );
+  for ( expr = ( (jxtl_section_t *) content->value )->expr; expr;
+        expr = expr->next ) {
+    if ( expr->type == JXTL_PATH_LOOKUP ) {
+      APR_ARRAY_PUSH( path, const char * ) = expr->identifier;
+    }
+  }
+
+  return path;
+}
+
+void jxtl_template_start_records( jxtl_template_t *template,
+                                  apr_file_t *out )
+{
+  apr_bucket_alloc_t *bucket_alloc;
+  jxtl_records_t *records;
+  jxtl_op_t *op;
+  jxtl_path_expr_t *expr;
+
+  apr_pool_clear( template->expand_mp );
+  template->inflate_buf = NULL;
+  template->inflate_size = 0;
+  template->status = TRUE;
+
+  template->flush_func = flush_to_file;
+  template->flush_data = out;
+  template->use_cache = FALSE;
   bucket_alloc = apr_bucket_alloc_create( template->expand_mp );
   template->bb = apr_brigade_create( template->expand_mp, bucket_alloc );
 
-  expand_content( template->expand_mp, template, template->content, json,
-                  NULL, PRINT_NORMAL );
+  records = apr_palloc( template->expand_mp, sizeof(jxtl_records_t) );
+  /* The section is the only loop outside of its own. */
+  for ( records->start = 0;
+        PROGRAM_OP( template->program, records->start )->type !=
+          JXTL_OP_SECTION;
+        records->start++ );
+  op = PROGRAM_OP( template->program, records->start );
+  for ( expr = op->expr; expr->next; expr = expr->next );
+  records->step = expr;
+  apr_pool_create( &records->mp, template->expand_mp );
+  records->separator_bb = NULL;
+  template->records = records;
+
+  expand_program( template->expand_mp, template, 0, records->start, NULL,
+                  template->program->loops );
+}
+
+/**
+ * Print output that was held back in another brigade.  It is copied rather
+ * than moved, so that it doesn't bring buffers that keep the output from
+ * being flushed.
+ */
+static void print_held_back( jxtl_template_t *template,
+                             apr_bucket_brigade *bb )
+{
+  apr_bucket *e;
+  const char *str;
+  apr_size_t str_len;
+
+  for ( e = APR_BRIGADE_FIRST( bb ); e != APR_BRIGADE_SENTINEL( bb );
+        e = APR_BUCKET_NEXT( e ) ) {
+    apr_bucket_read( e, &str, &str_len, APR_BLOCK_READ );
+    apr_brigade_write( template->bb, template->flush_func,
+                       template->flush_data, str, str_len );
+  }
+
+  apr_brigade_cleanup( bb );
+}
+
+void jxtl_template_expand_record( jxtl_template_t *template,
+                                  json_t *record )
+{
+  int i;
+  jxtl_records_t *records = template->records;
+  jxtl_op_t *op = PROGRAM_OP( template->program, records->start );
+  jxtl_loop_t *loops = template->program->loops + 1;
+  jxtl_path_obj_t *path_obj;
+  jxtl_path_frame_t *value_frame;
+  apr_bucket_brigade *bb;
+
+  jxtl_path_compiled_eval_frame( records->mp, records->step,
+                                 jxtl_path_frame_create( records->mp, NULL,
+                                                         record ),
+                                 &path_obj );
+
+  for ( i = 0; i < path_obj->frames->nelts; i++ ) {
+    value_frame = APR_ARRAY_IDX( path_obj->frames, i, jxtl_path_frame_t * );
+    if ( records->separator_bb ) {
+      print_held_back( template, records->separator_bb );
+    }
+
+    expand_program( records->mp, template, records->start + 1, op->next,
+                    value_frame, loops );
+
+    /*
+     * Whether another record follows isn't known yet, so the separator is
+     * expanded for this one now and held back.
+     */
+    if ( op->separator ) {
+      if ( !records->separator_bb ) {
+        records->separator_bb = apr_brigade_create( template->expand_mp,
+                                                    template->bb->bucket_alloc );
+      }
+      bb = template->bb;
+      template->bb = records->separator_bb;
+      template->flush_func = NULL;
+      /* The separator is followed by its JXTL_OP_REPEAT. */
+      expand_program( records->mp, template, op->next + 1, op->jump - 1,
+                      value_frame, loops );
+      template->bb = bb;
+      template->flush_func = flush_to_file;
+    }
+  }
+
+  apr_pool_clear( records->mp );
+}
+
+void jxtl_template_end_records( jxtl_template_t *template )
+{
+  jxtl_records_t *records = template->records;
+
+  if ( records->separator_bb ) {
+    apr_brigade_cleanup( records->separator_bb );
+  }
+  expand_program( template->expand_mp, template,
+                  PROGRAM_OP( template->program, records->start )->jump,
+                  template->program->ops->nelts, NULL,
+                  template->program->loops );
+  flush_to_file( template->bb, template->flush_data );
+  template->records = NULL;
 }
 
 int jxtl_template_expand_to_file( jxtl_template_t *template, json_t *json,
@@ -630,7 +1514,7 @@ int jxtl_template_expand_to_file( jxtl_template_t *template, json_t *json,
 {
   expand_template( template, json, flush_to_file, out );
   flush_to_file( template->bb, out );
-  return APR_SUCCESS;
+  return ( template->status ) ? APR_SUCCESS : APR_EGENERAL;
 }
 
 char *jxtl_template_expand_to_buffer( apr_pool_t *user_mp,
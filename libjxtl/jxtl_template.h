@@ -27,6 +27,8 @@
 #include <apr_pools.h>
 #include <apr_tables.h>
 
+#include "json_edit.h"
+#include "json_schema.h"
 #include "jxtl_path_expr.h"
 
 typedef enum jxtl_content_type {
@@ -57,19 +59,42 @@ typedef struct jxtl_section_t {
   jxtl_path_expr_t *expr;
   /** Array of the content in the section. */
   apr_array_header_t *content;
+  /**
+   * If the content only looks below the node it is expanded for, so its
+   * output can be cached by node.  Set by jxtl_template_set_edit.
+   */
+  int cacheable;
 } jxtl_section_t;
 
 typedef apr_status_t ( *brigade_flush_func )( apr_bucket_brigade *bb,
                                               void *ctx );
 
 typedef struct jxtl_template_t {
+  /** Pool the template is allocated from. */
+  apr_pool_t *mp;
   apr_pool_t *expand_mp;
   apr_array_header_t *content;
+  /** The content compiled into instructions, which is what is expanded. */
+  struct jxtl_program_t *program;
   apr_bucket_brigade *bb;
   brigade_flush_func flush_func;
   void *flush_data;
   apr_hash_t *formats;
   void *format_data;
+  /** Section output kept between expansions, see jxtl_template_set_edit. */
+  struct jxtl_cache_t *cache;
+  /** If the cache is used by the expansion in progress. */
+  int use_cache;
+  /** State of an expansion one record at a time. */
+  struct jxtl_records_t *records;
+  /**
+   * Compressed strings are decompressed here to be printed.  It is allocated
+   * from expand_mp and reused for the rest of the expansion.
+   */
+  char *inflate_buf;
+  apr_size_t inflate_size;
+  /** FALSE once a value of the expansion in progress couldn't be printed. */
+  int status;
 } jxtl_template_t;
 
 typedef char * ( *jxtl_format_func )( json_t *value, char *format,
@@ -101,6 +126,29 @@ void jxtl_template_register_format( jxtl_template_t *template,
 void jxtl_template_set_format_data( jxtl_template_t *template,
                                     void *format_data );
 
+/**
+ * Compile the template's expressions against the schema of the data it will
+ * be expanded with, so that known properties are looked up by slot.  The
+ * template still works with data that doesn't match the schema.
+ * @param template The template.
+ * @param schema The schema, which has to outlive the template.
+ */
+void jxtl_template_set_schema( jxtl_template_t *template,
+                               json_schema_t *schema );
+
+/**
+ * Keep the output of sections between expansions of the tree that edit
+ * changes, and reuse it for nodes that haven't changed since.  Only sections
+ * whose content never leaves the node they are expanded for (no "/" or ".."
+ * in any expression inside them) are kept, and format callbacks have to give
+ * the same output for the same value.  Expanding any other tree doesn't use
+ * the cache.  The cache lives in edit's pool, and is dropped when either
+ * that pool or the template's is cleared or destroyed.
+ * @param template The template.
+ * @param edit The edit, or NULL to stop caching.
+ */
+void jxtl_template_set_edit( jxtl_template_t *template, json_edit_t *edit );
+
 /**
  * Generic template expansion function.  This function is called by
  * jxtl_template_expand_to_file and jxtl_template_expand_to_buffer.
@@ -108,8 +156,46 @@ void jxtl_template_set_format_data( jxtl_template_t *template,
 void expand_template( jxtl_template_t *template, json_t *json,
                       brigade_flush_func flush_func, void *flush_data );
 
+/**
+ * Find out if a template can be expanded one record at a time.  It can if it
+ * is text around a single section over a path of plain names from the top of
+ * the tree, a predicate on the last name aside, and nothing inside the
+ * section looks above the node it is expanded for (no "/" or "..").
+ * @param mp Pool to allocate the path from.
+ * @param template The template.
+ * @return The names of the path as const char *, or NULL if the template
+ *         needs the whole tree.
+ */
+apr_array_header_t *jxtl_template_record_path( apr_pool_t *mp,
+                                               jxtl_template_t *template );
+
+/**
+ * Start expanding a template to a file one record at a time, by printing the
+ * text before its section.  The template must have a record path.
+ */
+void jxtl_template_start_records( jxtl_template_t *template,
+                                  apr_file_t *out );
+
+/**
+ * Expand the section of a template for the next record.
+ * @param template The template.
+ * @param record An object with the record as its only property, named after
+ *        the last name of the record path.
+ */
+void jxtl_template_expand_record( jxtl_template_t *template,
+                                  json_t *record );
+
+/**
+ * Finish expanding a template one record at a time, by printing the text
+ * after its section.  The output is flushed.
+ */
+void jxtl_template_end_records( jxtl_template_t *template );
+
 /**
  * Expand a template to a file.
+ * @return APR_SUCCESS, or APR_EGENERAL if a compressed string couldn't be
+ *         decompressed.  The error is reported on stderr and the string is
+ *         left out.
  */
 int jxtl_template_expand_to_file( jxtl_template_t *template, json_t *json,
                                   apr_file_t *file );
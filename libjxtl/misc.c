@@ -19,11 +19,13 @@
  * limitations under the License.
  */
 
+#include <errno.h>
 #include <stdlib.h>
 #include <apr_errno.h>
 #include <apr_general.h>
 #include <apr_getopt.h>
 #include <apr_file_io.h>
+#include <apr_lib.h>
 #include <apr_pools.h>
 #include <apr_strings.h>
 
@@ -63,6 +65,21 @@ int open_apr_output_file( apr_pool_t *mp, const char *file_name,
   return ( status == APR_SUCCESS );
 }
 
+int parse_option_number( const char *arg, apr_int64_t min, apr_int64_t max,
+                         apr_int64_t *value )
+{
+  char *end;
+
+  /* Signs and spaces, which strtol would skip, aren't allowed either. */
+  if ( !apr_isdigit( *arg ) )
+    return FALSE;
+
+  errno = 0;
+  *value = apr_strtoi64( arg, &end, 10 );
+
+  return ( errno == 0 && *end == '\0' && *value >= min && *value <= max );
+}
+
 void print_usage( const char *prog_name,
                   const apr_getopt_option_t *options )
 {
@@ -36,6 +36,17 @@ int open_apr_input_file( apr_pool_t *mp, const char *file_name,
 int open_apr_output_file( apr_pool_t *mp, const char *file_name,
                           apr_file_t **file );
 
+/**
+ * Parse the argument of an option that takes a number.
+ * @param arg The argument, which has to be only decimal digits.
+ * @param min The smallest value allowed.
+ * @param max The largest value allowed.
+ * @param value Set to the number.
+ * @return TRUE if arg is a number between min and max.
+ */
+int parse_option_number( const char *arg, apr_int64_t min, apr_int64_t max,
+                         apr_int64_t *value );
+
 /**
  * Generic function to print the usage of program based on its options.
  */
@@ -51,6 +51,7 @@ parser_t *parser_create( apr_pool_t *mp,
   parser_t *parser = apr_palloc( mp, sizeof(parser_t) );
   parser->mp = mp;
   parser->user_data = NULL;
+  parser->flags = 0;
   parser->get_filename = get_filename;
   parser->flex_init = flex_init;
   parser->flex_set_extra = flex_set_extra;
@@ -90,6 +91,16 @@ void *parser_get_user_data( parser_t *parser )
   return parser->user_data;
 }
 
+void parser_set_flags( parser_t *parser, int flags )
+{
+  parser->flags = flags;
+}
+
+int parser_get_flags( parser_t *parser )
+{
+  return parser->flags;
+}
+
 char *parser_get_error( parser_t *parser )
 {
   /* Make sure we NULL terminate it before returning. */
@@ -77,6 +77,8 @@ struct parser_t {
   str_buf_t *err_buf;
   /* User data. */
   void *user_data;
+  /* Options specific to the kind of parser. */
+  int flags;
   const char * ( *get_filename )( struct parser_t * );
   /* Pointers to scanner and parser functions. */
   flex_init_func flex_init;
@@ -137,6 +139,20 @@ void parser_set_user_data( parser_t *parser, void *user_data );
  */
 void *parser_get_user_data( parser_t *parser );
 
+/**
+ * Set options that are specific to the kind of parser, such as
+ * JSON_PARSER_RAW_NUMBERS.
+ * @param parser A parser.
+ * @param flags The options.
+ */
+void parser_set_flags( parser_t *parser, int flags );
+
+/**
+ * @param parser A parser.
+ * @return The options set on the parser.
+ */
+int parser_get_flags( parser_t *parser );
+
 /**
  * Return the error saved off.
  * @param parser A parser.
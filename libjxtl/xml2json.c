@@ -1,24 +1,64 @@
+#include <apr_atomic.h>
+#include <apr_file_info.h>
+#include <apr_file_io.h>
 #include <apr_general.h>
-#include <apr_lib.h>
+#if APR_HAS_MMAP
+#include <apr_mmap.h>
+#endif
 #include <apr_pools.h>
 #include <apr_strings.h>
+#if APR_HAS_THREADS
+#include <apr_thread_proc.h>
+#endif
 #include <apr_xml.h>
 #include <expat.h>
+#include <limits.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "apr_macros.h"
 #include "json.h"
+#include "json_compress.h"
+#include "json_schema.h"
+#include "json_slab.h"
+#include "json_text_writer.h"
 #include "json_writer.h"
 #include "xml2json.h"
 #include "str_buf.h"
 
+/* The characters apr_isspace accepts in the C locale: \t through \r, and
+   space. */
+#define XML_IS_SPACE( c )                                               \
+  ( (c) == ' ' || (unsigned int) ( (unsigned char) (c) - '\t' ) < 5 )
+
 static int str_is_whitespace( const char *str, int len )
 {
-  const char *c = str;
-  
+#ifdef __SSE2__
+  const __m128i space = _mm_set1_epi8( ' ' );
+  const __m128i tab = _mm_set1_epi8( '\t' );
+  const __m128i four = _mm_set1_epi8( 4 );
+  __m128i chunk;
+  __m128i controls;
+
+  for ( ; len >= 16; str += 16, len -= 16 ) {
+    chunk = _mm_loadu_si128( (const __m128i *) str );
+    controls = _mm_sub_epi8( chunk, tab );
+    if ( _mm_movemask_epi8(
+           _mm_or_si128( _mm_cmpeq_epi8( chunk, space ),
+                         _mm_cmpeq_epi8( _mm_min_epu8( controls, four ),
+                                         controls ) ) ) != 0xffff ) {
+      return FALSE;
+    }
+  }
+#endif
+
   while ( len-- > 0 ) {
-    if ( !apr_isspace( *c ) ) {
+    if ( !XML_IS_SPACE( *str ) ) {
       return FALSE;
     }
-    c++;
+    str++;
   }
 
   return TRUE;
@@ -27,19 +67,30 @@ static int str_is_whitespace( const char *str, int len )
 /**
  * When we have a string to write, check to see if it is a valid boolean value
  * in JSON.  It's possible we may do number checking here in the future.
+ * Only "true" and "false" are booleans, with a lowercase first letter.
+ * @return TRUE if str is a boolean, with its value in boolean.
  */
-static void write_xml_strn( json_writer_t *writer, const char *str, int len )
+static int xml_str_is_boolean( const char *str, int len, int *boolean )
 {
-  if ( *str != 't' && *str != 'f' ) {
-    /* Handle the majority of the cases and avoid unnecessary function call to
-       compare the strings. */
-    json_writer_write_strn( writer, str, len );
+  if ( len == 4 && str[0] == 't' && strncasecmp( str + 1, "rue", 3 ) == 0 ) {
+    *boolean = TRUE;
+    return TRUE;
   }
-  else if ( strncasecmp( str, "true", len ) == 0 ) {
-    json_writer_write_boolean( writer, TRUE );
+  else if ( len == 5 && str[0] == 'f' &&
+            strncasecmp( str + 1, "alse", 4 ) == 0 ) {
+    *boolean = FALSE;
+    return TRUE;
   }
-  else if ( strncasecmp( str, "false", len ) == 0 ) {
-    json_writer_write_boolean( writer, FALSE );
+
+  return FALSE;
+}
+
+static void write_xml_strn( json_writer_t *writer, const char *str, int len )
+{
+  int boolean;
+
+  if ( xml_str_is_boolean( str, len, &boolean ) ) {
+    json_writer_write_boolean( writer, boolean );
   }
   else {
     json_writer_write_strn( writer, str, len );
@@ -52,12 +103,234 @@ static void write_xml_str( json_writer_t *writer, const char *src  )
 }
 
 
+/*
+ * Filters.  Patterns are kept in a tree with a node for each step.  While a
+ * document is read, the nodes that the open elements could match are kept on
+ * a stack, a set for each element.
+ */
+
+typedef struct xml_filter_node_t {
+  /** The nodes for the next steps, by name. */
+  apr_hash_t *children;
+  /** The node for a "*" step, or NULL. */
+  struct xml_filter_node_t *any;
+  /** Whether a pattern ends here, keeping everything in what it matches. */
+  int keep;
+} xml_filter_node_t;
+
+struct xml_filter_t {
+  apr_pool_t *mp;
+  xml_filter_node_t *root;
+};
+
+/** The mark of an element that is kept with everything in it. */
+#define FILTER_KEEP_ALL -1
+
+typedef struct xml_filter_state_t {
+  /** The filter, or NULL if everything is kept. */
+  xml_filter_t *filter;
+  /** The sets of nodes the open elements that are kept matched. */
+  apr_array_header_t *nodes;
+  /** Where the set of each open element starts in nodes, or
+      FILTER_KEEP_ALL. */
+  apr_array_header_t *marks;
+  /** The depth in an element that is skipped, or 0. */
+  int skipping;
+} xml_filter_state_t;
+
+static xml_filter_node_t *filter_node_create( apr_pool_t *mp )
+{
+  xml_filter_node_t *node = apr_palloc( mp, sizeof(xml_filter_node_t) );
+
+  node->children = apr_hash_make( mp );
+  node->any = NULL;
+  node->keep = FALSE;
+
+  return node;
+}
+
+xml_filter_t *xml_filter_create( apr_pool_t *mp )
+{
+  xml_filter_t *filter = apr_palloc( mp, sizeof(xml_filter_t) );
+
+  filter->mp = mp;
+  filter->root = filter_node_create( mp );
+
+  return filter;
+}
+
+int xml_filter_add( xml_filter_t *filter, const char *path )
+{
+  xml_filter_node_t *node = filter->root;
+  xml_filter_node_t *next;
+  const char *step = path;
+  const char *step_end;
+  apr_size_t len;
+
+  do {
+    step_end = strchr( step, '/' );
+    len = ( step_end ) ? (apr_size_t) ( step_end - step ) : strlen( step );
+    if ( len == 0 )
+      return FALSE;
+
+    if ( len == 1 && *step == '*' ) {
+      if ( !node->any )
+        node->any = filter_node_create( filter->mp );
+      node = node->any;
+    }
+    else {
+      if ( !( next = apr_hash_get( node->children, step, len ) ) ) {
+        next = filter_node_create( filter->mp );
+        apr_hash_set( node->children, apr_pstrmemdup( filter->mp, step, len ),
+                      len, next );
+      }
+      node = next;
+    }
+
+    step = step_end + 1;
+  } while ( step_end );
+
+  node->keep = TRUE;
+
+  return TRUE;
+}
+
+static void filter_state_init( xml_filter_state_t *state,
+                               xml_filter_t *filter, apr_pool_t *mp )
+{
+  state->filter = filter;
+  state->skipping = 0;
+  if ( filter ) {
+    state->nodes = apr_array_make( mp, 64, sizeof(xml_filter_node_t *) );
+    state->marks = apr_array_make( mp, 64, sizeof(int) );
+    APR_ARRAY_PUSH( state->nodes, xml_filter_node_t * ) = filter->root;
+    APR_ARRAY_PUSH( state->marks, int ) = 0;
+  }
+}
+
+/**
+ * Match an element that starts.
+ * @param same_level Whether the element is the root that is left out of the
+ *        tree, whose content matches where the element would.
+ * @return TRUE if the element is kept, at least as a container for what is
+ *         kept in it.
+ */
+static int filter_enter( xml_filter_state_t *state, const char *name,
+                         int same_level )
+{
+  xml_filter_node_t **nodes;
+  xml_filter_node_t *node;
+  int mark;
+  int start;
+  int keep = FALSE;
+  int i;
+
+  if ( state->skipping ) {
+    state->skipping++;
+    return FALSE;
+  }
+
+  mark = APR_ARRAY_TAIL( state->marks, int );
+  if ( mark == FILTER_KEEP_ALL ) {
+    APR_ARRAY_PUSH( state->marks, int ) = FILTER_KEEP_ALL;
+    return TRUE;
+  }
+
+  start = state->nodes->nelts;
+  for ( i = mark; i < start; i++ ) {
+    /* Pushing may move the array. */
+    nodes = (xml_filter_node_t **) state->nodes->elts;
+    if ( same_level ) {
+      APR_ARRAY_PUSH( state->nodes, xml_filter_node_t * ) = nodes[i];
+      continue;
+    }
+    if ( ( node = apr_hash_get( nodes[i]->children, name,
+                                APR_HASH_KEY_STRING ) ) ) {
+      APR_ARRAY_PUSH( state->nodes, xml_filter_node_t * ) = node;
+      keep |= node->keep;
+    }
+    if ( ( node = nodes[i]->any ) ) {
+      APR_ARRAY_PUSH( state->nodes, xml_filter_node_t * ) = node;
+      keep |= node->keep;
+    }
+  }
+
+  if ( state->nodes->nelts == start ) {
+    state->skipping = 1;
+    return FALSE;
+  }
+
+  if ( keep ) {
+    state->nodes->nelts = start;
+    APR_ARRAY_PUSH( state->marks, int ) = FILTER_KEEP_ALL;
+  }
+  else {
+    APR_ARRAY_PUSH( state->marks, int ) = start;
+  }
+
+  return TRUE;
+}
+
+/**
+ * @return TRUE if the element that ends was kept.
+ */
+static int filter_leave( xml_filter_state_t *state )
+{
+  int mark;
+
+  if ( state->skipping ) {
+    state->skipping--;
+    return FALSE;
+  }
+
+  mark = *(int *) apr_array_pop( state->marks );
+  if ( mark != FILTER_KEEP_ALL ) {
+    state->nodes->nelts = mark;
+  }
+
+  return TRUE;
+}
+
+/**
+ * @return TRUE if an attribute of the innermost element that is kept is
+ *         kept as well.
+ */
+static int filter_keeps_attribute( xml_filter_state_t *state,
+                                   const char *name )
+{
+  xml_filter_node_t **nodes = (xml_filter_node_t **) state->nodes->elts;
+  int mark = APR_ARRAY_TAIL( state->marks, int );
+  int i;
+
+  if ( mark == FILTER_KEEP_ALL )
+    return TRUE;
+
+  for ( i = mark; i < state->nodes->nelts; i++ ) {
+    if ( nodes[i]->any ||
+         apr_hash_get( nodes[i]->children, name, APR_HASH_KEY_STRING ) ) {
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+/**
+ * Only the text of elements that are kept with everything in them is kept.
+ * Elements that are only containers are converted as if they had no text.
+ */
+#define FILTER_KEEPS_TEXT( state )                                      \
+  ( !(state)->filter ||                                                 \
+    ( !(state)->skipping &&                                             \
+      APR_ARRAY_TAIL( (state)->marks, int ) == FILTER_KEEP_ALL ) )
+
 typedef struct xml_converter_t {
   json_writer_t *writer;
   int skip_root;
   str_buf_t *str_buf;
   int first_elem;
   int status;
+  xml_filter_state_t filter;
 }xml_converter_t;
 
 static void start_handler( void *converter_ptr, const char *name,
@@ -66,20 +339,28 @@ static void start_handler( void *converter_ptr, const char *name,
   xml_converter_t *converter = converter_ptr;
   json_writer_t *writer = converter->writer;
   str_buf_t *str_buf = converter->str_buf;
-  json_writer_ctx_t *context = json_writer_get_context( writer );
-  json_writer_ctx_state state = json_writer_ctx_get_state( context );
+  json_writer_ctx_t *context = writer->context;
+  json_writer_ctx_state state;
+  int started = FALSE;
 
-  if ( str_buf->data_len > 0 &&
-       !str_is_whitespace( str_buf->data, str_buf->data_len ) ) {
-    converter->status = FALSE;
-    fprintf( stderr, "Error: mixed content found in %s\ncontent:\n%.*s",
-             json_writer_ctx_get_prop( context ), str_buf->data_len,
-             str_buf->data );
+  if ( converter->filter.filter &&
+       !filter_enter( &converter->filter, name,
+                      converter->first_elem && converter->skip_root ) ) {
+    return;
   }
 
-  STR_BUF_CLEAR( str_buf );
+  if ( str_buf->data_len > 0 ) {
+    if ( !str_is_whitespace( str_buf->data, str_buf->data_len ) ) {
+      converter->status = FALSE;
+      fprintf( stderr, "Error: mixed content found in %s\ncontent:\n%.*s",
+               json_writer_ctx_get_prop( context ), str_buf->data_len,
+               str_buf->data );
+    }
+    STR_BUF_CLEAR( str_buf );
+  }
 
   if ( !converter->first_elem || !converter->skip_root ) {
+    state = json_writer_ctx_get_state( context );
     if ( state == JSON_INITIAL || state == JSON_PROPERTY ) {
       json_writer_start_object( writer );
     }
@@ -88,13 +369,18 @@ static void start_handler( void *converter_ptr, const char *name,
 
   converter->first_elem = FALSE;
 
-  if ( *atts ) {
-    json_writer_start_object( writer );
-    while ( *atts ) {
-      json_writer_start_property( writer, *atts++ );
-      write_xml_str( writer, *atts++ );
-      json_writer_end_property( writer );
+  for ( ; *atts; atts += 2 ) {
+    if ( converter->filter.filter &&
+         !filter_keeps_attribute( &converter->filter, atts[0] ) ) {
+      continue;
+    }
+    if ( !started ) {
+      json_writer_start_object( writer );
+      started = TRUE;
     }
+    json_writer_start_property( writer, atts[0] );
+    write_xml_str( writer, atts[1] );
+    json_writer_end_property( writer );
   }
 }
 
@@ -103,8 +389,15 @@ static void end_handler( void *converter_ptr, const char *name )
   xml_converter_t *converter = converter_ptr;
   json_writer_t *writer = converter->writer;
   str_buf_t *str_buf = converter->str_buf;
-  json_writer_ctx_t *context = json_writer_get_context( writer );
-  json_writer_ctx_state state = json_writer_ctx_get_state( context );
+  json_writer_ctx_t *context;
+  json_writer_ctx_state state;
+
+  if ( converter->filter.filter && !filter_leave( &converter->filter ) ) {
+    return;
+  }
+
+  context = json_writer_get_context( writer );
+  state = json_writer_ctx_get_state( context );
 
   if ( state == JSON_PROPERTY ) {
     if ( str_buf->data_len > 0 ) {
@@ -131,46 +424,1493 @@ static void cdata_handler( void *converter_ptr, const char *data, int len )
 {
   xml_converter_t *converter = converter_ptr;
 
-  str_buf_write( converter->str_buf, data, len );
+  if ( FILTER_KEEPS_TEXT( &converter->filter ) ) {
+    str_buf_write( converter->str_buf, data, len );
+  }
 }
 
-int xml_to_json( apr_pool_t *mp, apr_file_t *xml_file, int skip_root,
-                 json_t **json )
+/**
+ * How a document is handed to expat.
+ */
+typedef struct xml_read_sizes_t {
+  /** Bytes handed to expat at a time. */
+  apr_size_t buffer_size;
+  /** Bytes of a regular file mapped at a time. */
+  apr_size_t map_size;
+} xml_read_sizes_t;
+
+static const xml_read_sizes_t default_sizes = {
+  XML_TO_JSON_BUFFER_SIZE, XML_TO_JSON_MAP_SIZE
+};
+
+/**
+ * Hand text that is in memory to expat in slices, like a mapped window.
+ * @param slice_size How much to hand to expat at a time.
+ * @param final Whether the text is the end of the document.
+ * @return The last status from expat.
+ */
+static int xml_parse_memory( XML_Parser xp, const char *data, apr_size_t len,
+                             apr_size_t slice_size, int final )
+{
+  apr_size_t slice;
+  int xml_stat;
+
+  do {
+    slice = ( len > slice_size ) ? slice_size : len;
+    len -= slice;
+    xml_stat = XML_Parse( xp, data, (int) slice, ( final && len == 0 ) );
+    data += slice;
+  } while ( len > 0 && xml_stat == XML_STATUS_OK );
+
+  return xml_stat;
+}
+
+#if APR_HAS_MMAP
+/**
+ * Parse a regular file from its current position by mapping it a window at
+ * a time.  expat copies what it is given into a buffer of its own, so each
+ * window is handed to it in slices to keep that buffer small.
+ * @param pos The position to start from, set to where parsing stopped.
+ * @return The last status from expat, or -1 if the file couldn't be mapped
+ *         and nothing was parsed.
+ */
+static int xml_parse_mapped( apr_pool_t *mp, XML_Parser xp,
+                             apr_file_t *xml_file, apr_off_t *pos,
+                             apr_off_t size, const xml_read_sizes_t *sizes )
+{
+  apr_mmap_t *mm;
+  apr_off_t offset;
+  apr_off_t end;
+  const char *data;
+  int xml_stat = -1;
+
+  while ( *pos < size ) {
+    offset = *pos - ( *pos % sizes->map_size );
+    end = ( size - offset > sizes->map_size ) ?
+          offset + sizes->map_size : size;
+    if ( apr_mmap_create( &mm, xml_file, offset, (apr_size_t) ( end - offset ),
+                          APR_MMAP_READ, mp ) != APR_SUCCESS ) {
+      break;
+    }
+
+    data = (const char *) mm->mm + ( *pos - offset );
+    xml_stat = xml_parse_memory( xp, data, (apr_size_t) ( end - *pos ),
+                                 sizes->buffer_size, ( end == size ) );
+    *pos = end;
+
+    apr_mmap_delete( mm );
+    if ( xml_stat != XML_STATUS_OK )
+      break;
+  }
+
+  return xml_stat;
+}
+#endif
+
+/**
+ * Parse all of a file.  Regular files are mapped, anything else is read
+ * straight into expat's buffer.  If a window of a regular file can't be
+ * mapped, the rest of it is read instead.
+ * @return The last status from expat.
+ */
+static int xml_parse_file( apr_pool_t *mp, XML_Parser xp,
+                           apr_file_t *xml_file, const xml_read_sizes_t *sizes )
 {
-  xml_converter_t converter;
-  json_writer_t *writer;
-  XML_Parser xp;
-  apr_pool_t *tmp_mp;
   apr_status_t read_val;
   int xml_stat;
-  char buffer[4096];
+  void *buffer;
   apr_size_t len;
+#if APR_HAS_MMAP
+  apr_finfo_t finfo;
+  apr_off_t pos = 0;
+
+  if ( apr_file_info_get( &finfo, APR_FINFO_TYPE | APR_FINFO_SIZE,
+                          xml_file ) == APR_SUCCESS &&
+       finfo.filetype == APR_REG &&
+       apr_file_seek( xml_file, APR_CUR, &pos ) == APR_SUCCESS &&
+       pos < finfo.size ) {
+    xml_stat = xml_parse_mapped( mp, xp, xml_file, &pos, finfo.size, sizes );
+    if ( xml_stat != -1 ) {
+      /* Carry on from where the windows stopped, reading the rest if one of
+         them couldn't be mapped. */
+      if ( apr_file_seek( xml_file, APR_SET, &pos ) != APR_SUCCESS )
+        return XML_STATUS_ERROR;
+      if ( xml_stat != XML_STATUS_OK || pos == finfo.size )
+        return xml_stat;
+    }
+  }
+#endif
+
+  do {
+    if ( !( buffer = XML_GetBuffer( xp, (int) sizes->buffer_size ) ) )
+      return XML_STATUS_ERROR;
+    len = sizes->buffer_size;
+    read_val = apr_file_read( xml_file, buffer, &len );
+    xml_stat = XML_ParseBuffer( xp, len, ( read_val != APR_SUCCESS ) );
+  } while ( ( read_val == APR_SUCCESS ) && ( xml_stat == XML_STATUS_OK ) );
+
+  return xml_stat;
+}
+
+struct xml2json_t {
+  XML_Parser xp;
+  /** Holds the state of one document, cleared after it. */
+  apr_pool_t *tmp_mp;
+  xml_filter_t *filter;
+  xml_read_sizes_t sizes;
+};
+
+static apr_status_t xml2json_cleanup( void *data )
+{
+  xml2json_t *x = data;
+
+  XML_ParserFree( x->xp );
+  return APR_SUCCESS;
+}
+
+xml2json_t *xml2json_create( apr_pool_t *mp )
+{
+  xml2json_t *x = apr_palloc( mp, sizeof(xml2json_t) );
+
+  if ( !( x->xp = XML_ParserCreate( NULL ) ) )
+    return NULL;
+  apr_pool_create( &x->tmp_mp, mp );
+  x->filter = NULL;
+  x->sizes = default_sizes;
+  apr_pool_cleanup_register( mp, x, xml2json_cleanup, apr_pool_cleanup_null );
+
+  return x;
+}
+
+void xml2json_set_filter( xml2json_t *x, xml_filter_t *filter )
+{
+  x->filter = filter;
+}
+
+void xml2json_set_read_sizes( xml2json_t *x, apr_size_t buffer_size,
+                              apr_size_t map_size )
+{
+  if ( !buffer_size )
+    buffer_size = XML_TO_JSON_BUFFER_SIZE;
+  /* expat takes lengths as ints. */
+  x->sizes.buffer_size = ( buffer_size > INT_MAX ) ? INT_MAX : buffer_size;
+  if ( map_size ) {
+    /* Windows start at multiples of the size, which mmap needs to be
+       aligned to pages. */
+    x->sizes.map_size = APR_ALIGN( map_size, XML_TO_JSON_MAP_ALIGN );
+  }
+  else {
+    x->sizes.map_size = XML_TO_JSON_MAP_SIZE;
+  }
+}
+
+/**
+ * A document in memory, made of pieces that are parsed one after the other.
+ */
+typedef struct xml_pieces_t {
+  const char *data[3];
+  apr_size_t len[3];
+  int count;
+} xml_pieces_t;
+
+/**
+ * Parse a document with the converter's parser and get both ready for the
+ * next one.  Resetting drops the handlers, so they are set every time.
+ * @param xml_file The document, or NULL to parse pieces.
+ * @param pieces The document if xml_file is NULL.
+ * @return The last status from expat.
+ */
+static int xml2json_parse( xml2json_t *x, apr_file_t *xml_file,
+                           xml_pieces_t *pieces, void *user_data,
+                           XML_StartElementHandler start_func,
+                           XML_EndElementHandler end_func,
+                           XML_CharacterDataHandler cdata_func )
+{
+  int xml_stat = XML_STATUS_OK;
+  int i;
+
+  XML_SetUserData( x->xp, user_data );
+  XML_SetElementHandler( x->xp, start_func, end_func );
+  XML_SetCharacterDataHandler( x->xp, cdata_func );
+
+  if ( xml_file ) {
+    xml_stat = xml_parse_file( x->tmp_mp, x->xp, xml_file, &x->sizes );
+  }
+  else {
+    for ( i = 0; i < pieces->count && xml_stat == XML_STATUS_OK; i++ ) {
+      xml_stat = xml_parse_memory( x->xp, pieces->data[i], pieces->len[i],
+                                   x->sizes.buffer_size,
+                                   ( i == pieces->count - 1 ) );
+    }
+  }
+
+  XML_ParserReset( x->xp, NULL );
+
+  return xml_stat;
+}
+
+static int xml2json_convert_input( xml2json_t *x, apr_pool_t *mp,
+                                   apr_file_t *xml_file,
+                                   xml_pieces_t *pieces, int skip_root,
+                                   json_t **json )
+{
+  xml_converter_t converter;
+  json_writer_t *writer;
+  int xml_stat;
   int status;
 
-  apr_pool_create( &tmp_mp, NULL );
-  writer = json_writer_create( tmp_mp, mp );
+  writer = json_writer_create( x->tmp_mp, mp );
   converter.writer = writer;
   converter.skip_root = skip_root;
-  converter.str_buf = str_buf_create( tmp_mp, 4096 );
+  converter.str_buf = str_buf_create( x->tmp_mp, 4096 );
   converter.first_elem = TRUE;
   converter.status = TRUE;
+  filter_state_init( &converter.filter, x->filter, x->tmp_mp );
 
-  xp = XML_ParserCreate( NULL );
-  XML_SetUserData( xp, &converter );
-  XML_SetElementHandler( xp, start_handler, end_handler );
-  XML_SetCharacterDataHandler( xp, cdata_handler );
-
-  do {
-    len = sizeof(buffer);
-    read_val = apr_file_read( xml_file, buffer, &len );
-    xml_stat = XML_Parse( xp, buffer, len, 0 );
-  }while ( ( read_val == APR_SUCCESS ) && ( xml_stat == XML_STATUS_OK ) );
+  xml_stat = xml2json_parse( x, xml_file, pieces, &converter, start_handler,
+                             end_handler, cdata_handler );
 
   *json = writer->json;
-  apr_pool_destroy( tmp_mp );
-  XML_ParserFree( xp );
+  if ( !*json && x->filter ) {
+    /* Nothing was kept. */
+    *json = json_create_object( mp );
+  }
+  apr_pool_clear( x->tmp_mp );
 
   status = ( ( xml_stat == XML_STATUS_OK ) && ( converter.status == TRUE ) );
 
   return status;
 }
+
+int xml2json_convert( xml2json_t *x, apr_pool_t *mp, apr_file_t *xml_file,
+                      int skip_root, json_t **json )
+{
+  return xml2json_convert_input( x, mp, xml_file, NULL, skip_root, json );
+}
+
+int xml_to_json_filtered( apr_pool_t *mp, apr_file_t *xml_file,
+                          int skip_root, xml_filter_t *filter, json_t **json )
+{
+  apr_pool_t *tmp_mp;
+  xml2json_t *x;
+  int status = FALSE;
+
+  apr_pool_create( &tmp_mp, NULL );
+  if ( ( x = xml2json_create( tmp_mp ) ) ) {
+    xml2json_set_filter( x, filter );
+    status = xml2json_convert( x, mp, xml_file, skip_root, json );
+  }
+  apr_pool_destroy( tmp_mp );
+
+  return status;
+}
+
+int xml_to_json( apr_pool_t *mp, apr_file_t *xml_file, int skip_root,
+                 json_t **json )
+{
+  apr_pool_t *tmp_mp;
+  xml2json_t *x;
+  int status = FALSE;
+
+  apr_pool_create( &tmp_mp, NULL );
+  if ( ( x = xml2json_create( tmp_mp ) ) ) {
+    status = xml2json_convert( x, mp, xml_file, skip_root, json );
+  }
+  apr_pool_destroy( tmp_mp );
+
+  return status;
+}
+
+int xml_to_json_buffer( apr_pool_t *mp, const char *xml, apr_size_t len,
+                        int skip_root, json_t **json )
+{
+  apr_pool_t *tmp_mp;
+  xml2json_t *x;
+  xml_pieces_t pieces;
+  int status = FALSE;
+
+  pieces.data[0] = xml;
+  pieces.len[0] = len;
+  pieces.count = 1;
+
+  apr_pool_create( &tmp_mp, NULL );
+  if ( ( x = xml2json_create( tmp_mp ) ) ) {
+    status = xml2json_convert_input( x, mp, NULL, &pieces, skip_root, json );
+  }
+  apr_pool_destroy( tmp_mp );
+
+  return status;
+}
+
+/*
+ * Threaded conversion.  The content of the root element is split between
+ * top-level elements into ranges, each of which is converted on its own as
+ * the content of a copy of the root.  The objects they become are then
+ * merged in document order.
+ */
+
+/** Ranges to split the document into for each thread. */
+#define XML_SPLIT_RANGES_PER_THREAD 4
+
+/**
+ * @return The position just past the first str at or after p, or NULL.
+ */
+static const char *scan_past( const char *p, const char *end,
+                              const char *str )
+{
+  apr_size_t len = strlen( str );
+
+  for ( ; end - p >= (apr_ssize_t) len; p++ ) {
+    if ( !( p = memchr( p, *str, end - p - len + 1 ) ) )
+      return NULL;
+    if ( memcmp( p, str, len ) == 0 )
+      return p + len;
+  }
+
+  return NULL;
+}
+
+/**
+ * Skip a start or end tag.  Attribute values may contain '>'.
+ * @return The position just past the tag, or NULL.
+ */
+static const char *scan_tag( const char *p, const char *end )
+{
+  char quote = 0;
+
+  for ( ; p < end; p++ ) {
+    if ( quote ) {
+      if ( *p == quote )
+        quote = 0;
+    }
+    else if ( *p == '"' || *p == '\'' ) {
+      quote = *p;
+    }
+    else if ( *p == '>' ) {
+      return p + 1;
+    }
+  }
+
+  return NULL;
+}
+
+/**
+ * Ranges that don't start with the XML declaration are read as UTF-8, so
+ * the document has to be in UTF-8 as well.
+ */
+static int xml_decl_is_utf8( const char *p, const char *end )
+{
+  const char *value;
+
+  if ( end - p < 6 || memcmp( p, "<?xml", 5 ) != 0 || !XML_IS_SPACE( p[5] ) )
+    return TRUE;
+
+  if ( !( value = scan_past( p, end, "encoding" ) ) )
+    return TRUE;
+
+  while ( value < end && ( XML_IS_SPACE( *value ) || *value == '=' ) )
+    value++;
+
+  return ( end - value > 6 && ( *value == '"' || *value == '\'' ) &&
+           strncasecmp( value + 1, "UTF-8", 5 ) == 0 &&
+           value[6] == *value );
+}
+
+/**
+ * Find where to split a document.  The document type declaration may define
+ * entities that the other ranges would need, so documents with one aren't
+ * split.
+ * @param starts The offsets of the top-level elements that start each range
+ *        after the first, as apr_size_t.
+ * @param num_ranges How many ranges to aim for.
+ * @param root_name The name of the root element, not NUL terminated.
+ * @return TRUE if the document can be split into at least two ranges.
+ */
+static int xml_split( const char *doc, apr_size_t len, int num_ranges,
+                      apr_array_header_t *starts, const char **root_name,
+                      apr_size_t *root_name_len )
+{
+  const char *p = doc;
+  const char *end = doc + len;
+  const char *tag_end;
+  const char *content;
+  const char *text = NULL;
+  apr_size_t step;
+  apr_size_t next;
+  int depth = 0;
+
+  if ( len >= 3 && memcmp( p, "\xef\xbb\xbf", 3 ) == 0 )
+    p += 3;
+
+  for ( ;; ) {
+    while ( p < end && XML_IS_SPACE( *p ) )
+      p++;
+    if ( end - p < 4 || *p != '<' ) {
+      return FALSE;
+    }
+    else if ( p[1] == '?' ) {
+      if ( !( tag_end = scan_past( p + 2, end, "?>" ) ) ||
+           !xml_decl_is_utf8( p, tag_end ) )
+        return FALSE;
+      p = tag_end;
+    }
+    else if ( memcmp( p, "<!--", 4 ) == 0 ) {
+      if ( !( p = scan_past( p + 4, end, "-->" ) ) )
+        return FALSE;
+    }
+    else if ( p[1] == '!' ) {
+      return FALSE;
+    }
+    else {
+      break;
+    }
+  }
+
+  *root_name = ++p;
+  while ( p < end && !XML_IS_SPACE( *p ) && *p != '/' && *p != '>' )
+    p++;
+  *root_name_len = p - *root_name;
+  if ( !( p = scan_tag( p, end ) ) || p[-2] == '/' )
+    return FALSE;
+
+  content = p;
+  step = ( end - content ) / num_ranges;
+  next = step;
+
+  while ( ( p = memchr( p, '<', end - p ) ) ) {
+    if ( end - p < 2 ) {
+      return FALSE;
+    }
+    else if ( p[1] == '/' ) {
+      if ( depth == 0 )
+        break;
+      depth--;
+      tag_end = scan_tag( p, end );
+    }
+    else if ( p[1] == '?' ) {
+      tag_end = scan_past( p + 2, end, "?>" );
+    }
+    else if ( end - p >= 4 && memcmp( p, "<!--", 4 ) == 0 ) {
+      tag_end = scan_past( p + 4, end, "-->" );
+    }
+    else if ( end - p >= 9 && memcmp( p, "<![CDATA[", 9 ) == 0 ) {
+      tag_end = scan_past( p + 9, end, "]]>" );
+    }
+    else if ( p[1] == '!' ) {
+      return FALSE;
+    }
+    else {
+      /* Every range starts with an element, and the text before the split
+         would be left at the end of a range, where mixed content isn't
+         noticed. */
+      if ( depth == 0 && text && (apr_size_t) ( p - content ) >= next ) {
+        if ( !str_is_whitespace( text, p - text ) )
+          return FALSE;
+        APR_ARRAY_PUSH( starts, apr_size_t ) = p - doc;
+        next = ( p - content ) + step;
+      }
+      if ( ( tag_end = scan_tag( p, end ) ) && tag_end[-2] != '/' )
+        depth++;
+    }
+
+    if ( !tag_end )
+      return FALSE;
+    p = tag_end;
+    if ( depth == 0 )
+      text = p;
+  }
+
+  return ( p && starts->nelts > 0 );
+}
+
+typedef struct xml_split_job_t {
+  const char *doc;
+  apr_size_t len;
+  apr_array_header_t *starts;
+  /** Tags around the ranges that don't have the real ones. */
+  const char *open_tag;
+  const char *close_tag;
+  /** The object converted from each range. */
+  json_t **results;
+  volatile apr_uint32_t next_range;
+  volatile apr_uint32_t failures;
+} xml_split_job_t;
+
+typedef struct xml_split_worker_t {
+  xml_split_job_t *job;
+  /** Holds the objects the worker converts, which are part of the result. */
+  apr_pool_t *mp;
+} xml_split_worker_t;
+
+static void xml_convert_ranges( xml_split_worker_t *worker )
+{
+  xml_split_job_t *job = worker->job;
+  apr_uint32_t num_ranges = job->starts->nelts + 1;
+  apr_pool_t *tmp_mp;
+  xml2json_t *x;
+  xml_pieces_t pieces;
+  apr_size_t start;
+  apr_size_t end;
+  apr_uint32_t i;
+
+  apr_pool_create( &tmp_mp, worker->mp );
+  x = xml2json_create( tmp_mp );
+
+  while ( ( i = apr_atomic_inc32( &job->next_range ) ) < num_ranges ) {
+    start = ( i == 0 ) ? 0 : APR_ARRAY_IDX( job->starts, i - 1, apr_size_t );
+    end = ( i == num_ranges - 1 ) ? job->len :
+                                    APR_ARRAY_IDX( job->starts, i, apr_size_t );
+    pieces.count = 0;
+    if ( i > 0 ) {
+      pieces.data[pieces.count] = job->open_tag;
+      pieces.len[pieces.count++] = strlen( job->open_tag );
+    }
+    pieces.data[pieces.count] = job->doc + start;
+    pieces.len[pieces.count++] = end - start;
+    if ( i < num_ranges - 1 ) {
+      pieces.data[pieces.count] = job->close_tag;
+      pieces.len[pieces.count++] = strlen( job->close_tag );
+    }
+
+    if ( !x || !xml2json_convert_input( x, worker->mp, NULL, &pieces, TRUE,
+                                        &job->results[i] ) ||
+         !job->results[i] || !JSON_IS_OBJECT( job->results[i] ) ) {
+      apr_atomic_inc32( &job->failures );
+    }
+  }
+
+  apr_pool_destroy( tmp_mp );
+}
+
+#if APR_HAS_THREADS
+static void * APR_THREAD_FUNC xml_split_worker( apr_thread_t *thread,
+                                                void *data )
+{
+  xml_convert_ranges( (xml_split_worker_t *) data );
+  apr_thread_exit( thread, APR_SUCCESS );
+  return NULL;
+}
+#endif
+
+/**
+ * Add the properties converted from a range to the object converted from the
+ * ranges before it, making arrays of repeated names like json_add does.
+ */
+static void xml_merge( apr_pool_t *mp, json_t *obj, json_t *range )
+{
+  apr_hash_index_t *idx;
+  json_t *value;
+  json_t *prev;
+  json_t *array;
+
+  for ( idx = apr_hash_first( NULL, range->value.object ); idx;
+        idx = apr_hash_next( idx ) ) {
+    apr_hash_this( idx, NULL, NULL, (void **) &value );
+    prev = apr_hash_get( obj->value.object, JSON_NAME( value ),
+                         APR_HASH_KEY_STRING );
+    if ( !prev ) {
+      apr_hash_set( obj->value.object, JSON_NAME( value ),
+                    APR_HASH_KEY_STRING, value );
+      continue;
+    }
+
+    /* Only repeated names are converted to arrays. */
+    if ( JSON_IS_ARRAY( prev ) ) {
+      array = prev;
+    }
+    else {
+      array = json_create_array( mp );
+      JSON_NAME( array ) = JSON_NAME( prev );
+      JSON_NAME( prev ) = NULL;
+      APR_ARRAY_PUSH( array->value.array, json_t * ) = prev;
+      apr_hash_set( obj->value.object, JSON_NAME( array ),
+                    APR_HASH_KEY_STRING, array );
+    }
+
+    if ( JSON_IS_ARRAY( value ) ) {
+      apr_array_cat( array->value.array, value->value.array );
+    }
+    else {
+      JSON_NAME( value ) = NULL;
+      APR_ARRAY_PUSH( array->value.array, json_t * ) = value;
+    }
+  }
+}
+
+/**
+ * Convert a document in memory on several threads.
+ * @return TRUE or FALSE like xml_to_json, or -1 if the document can't be
+ *         split.
+ */
+static int xml_to_json_split( apr_pool_t *mp, const char *doc, apr_size_t len,
+                              int skip_root, json_t **json, int threads )
+{
+  apr_pool_t *tmp_mp;
+  xml_split_job_t job;
+  xml_split_worker_t *workers;
+  const char *root_name;
+  apr_size_t root_name_len;
+  apr_size_t compress = json_compress_get( mp );
+  json_t *root;
+  int num_ranges;
+  int i;
+  int status;
+#if APR_HAS_THREADS
+  apr_thread_t **thread_ids;
+  apr_status_t thread_status;
+#endif
+
+  apr_pool_create( &tmp_mp, NULL );
+  job.starts = apr_array_make( tmp_mp, threads * XML_SPLIT_RANGES_PER_THREAD,
+                               sizeof(apr_size_t) );
+  if ( !xml_split( doc, len, threads * XML_SPLIT_RANGES_PER_THREAD,
+                   job.starts, &root_name, &root_name_len ) ) {
+    apr_pool_destroy( tmp_mp );
+    return -1;
+  }
+
+  num_ranges = job.starts->nelts + 1;
+  job.doc = doc;
+  job.len = len;
+  job.open_tag = apr_psprintf( tmp_mp, "<%.*s>", (int) root_name_len,
+                               root_name );
+  job.close_tag = apr_psprintf( tmp_mp, "</%.*s>", (int) root_name_len,
+                                root_name );
+  job.results = apr_pcalloc( tmp_mp, sizeof(json_t *) * num_ranges );
+  apr_atomic_set32( &job.next_range, 0 );
+  apr_atomic_set32( &job.failures, 0 );
+
+  if ( threads > num_ranges ) {
+    threads = num_ranges;
+  }
+
+  workers = apr_palloc( tmp_mp, sizeof(xml_split_worker_t) * threads );
+  for ( i = 0; i < threads; i++ ) {
+    workers[i].job = &job;
+    apr_pool_create( &workers[i].mp, mp );
+    if ( compress > 0 ) {
+      json_compress_attach( compress, workers[i].mp );
+    }
+  }
+
+#if APR_HAS_THREADS
+  thread_ids = apr_pcalloc( tmp_mp, sizeof(apr_thread_t *) * threads );
+  for ( i = 1; i < threads; i++ ) {
+    if ( apr_thread_create( &thread_ids[i], NULL, xml_split_worker,
+                            &workers[i], tmp_mp ) != APR_SUCCESS ) {
+      /* The threads that did start pick up its share. */
+      thread_ids[i] = NULL;
+    }
+  }
+#endif
+
+  xml_convert_ranges( &workers[0] );
+
+#if APR_HAS_THREADS
+  for ( i = 1; i < threads; i++ ) {
+    if ( thread_ids[i] ) {
+      apr_thread_join( &thread_status, thread_ids[i] );
+    }
+  }
+#endif
+
+  status = ( apr_atomic_read32( &job.failures ) == 0 );
+  *json = NULL;
+
+  if ( status ) {
+    root = job.results[0];
+    for ( i = 1; i < num_ranges; i++ ) {
+      xml_merge( mp, root, job.results[i] );
+    }
+
+    if ( skip_root ) {
+      *json = root;
+    }
+    else {
+      *json = json_create_object( mp );
+      JSON_NAME( root ) = apr_pstrmemdup( mp, root_name, root_name_len );
+      apr_hash_set( (*json)->value.object, JSON_NAME( root ),
+                    APR_HASH_KEY_STRING, root );
+    }
+  }
+
+  apr_pool_destroy( tmp_mp );
+
+  return status;
+}
+
+int xml_to_json_threaded( apr_pool_t *mp, apr_file_t *xml_file, int skip_root,
+                          json_t **json, int threads )
+{
+#if APR_HAS_MMAP
+  apr_pool_t *tmp_mp;
+  apr_finfo_t finfo;
+  apr_mmap_t *mm;
+  apr_off_t pos = 0;
+  int status = -1;
+
+  /* A slab or schema is shared state the threads can't update. */
+  if ( threads > 1 && !json_slab_get( mp ) && !json_schema_get( mp ) &&
+       apr_file_info_get( &finfo, APR_FINFO_TYPE | APR_FINFO_SIZE,
+                          xml_file ) == APR_SUCCESS &&
+       finfo.filetype == APR_REG &&
+       apr_file_seek( xml_file, APR_CUR, &pos ) == APR_SUCCESS &&
+       finfo.size - pos >= XML_TO_JSON_SPLIT_SIZE ) {
+    apr_pool_create( &tmp_mp, NULL );
+    if ( apr_mmap_create( &mm, xml_file, 0, (apr_size_t) finfo.size,
+                          APR_MMAP_READ, tmp_mp ) == APR_SUCCESS ) {
+      status = xml_to_json_split( mp, (const char *) mm->mm + pos,
+                                  (apr_size_t) ( finfo.size - pos ),
+                                  skip_root, json, threads );
+      apr_mmap_delete( mm );
+    }
+    apr_pool_destroy( tmp_mp );
+
+    if ( status != -1 ) {
+      pos = finfo.size;
+      apr_file_seek( xml_file, APR_SET, &pos );
+      return status;
+    }
+  }
+#endif
+
+  return xml_to_json( mp, xml_file, skip_root, json );
+}
+
+/*
+ * Record conversion.  Elements outside the records are only followed to
+ * find the records; each record is converted with the handlers above into a
+ * tree of its own, which is handed to the callback and freed.
+ */
+typedef struct xml_records_t {
+  /** First, so that cdata_handler can be given the records. */
+  xml_converter_t converter;
+  /** Pool the tree of the current record is allocated from. */
+  apr_pool_t *record_mp;
+  apr_array_header_t *path;
+  int skip_root;
+  xml_record_func func;
+  void *data;
+  /** Depth of the element being parsed, the root is 1. */
+  int xml_depth;
+  /** How many names of the path the open elements match. */
+  int matched;
+  /** Depth of the record being converted, or 0. */
+  int record_depth;
+  /**
+   * If the element outside the records that is ending has no attributes or
+   * children.
+   */
+  int leaf;
+  int status;
+} xml_records_t;
+
+static void records_start_handler( void *records_ptr, const char *name,
+                                   const char **atts )
+{
+  xml_records_t *records = records_ptr;
+  str_buf_t *str_buf = records->converter.str_buf;
+  const char *step;
+  int depth;
+
+  records->xml_depth++;
+  /* Like end_handler, text is only dropped at the end of a plain leaf. */
+  records->leaf = !*atts;
+
+  if ( records->record_depth ) {
+    start_handler( &records->converter, name, atts );
+    return;
+  }
+
+  if ( str_buf->data_len > 0 &&
+       !str_is_whitespace( str_buf->data, str_buf->data_len ) ) {
+    records->status = FALSE;
+    fprintf( stderr, "Error: mixed content found before %s\ncontent:\n%.*s",
+             name, str_buf->data_len, str_buf->data );
+  }
+  STR_BUF_CLEAR( str_buf );
+
+  /* The depth of the element in the tree xml_to_json would build. */
+  depth = records->xml_depth - ( records->skip_root ? 1 : 0 );
+  if ( depth > 0 && depth == records->matched + 1 &&
+       depth <= records->path->nelts &&
+       ( step = APR_ARRAY_IDX( records->path, depth - 1, const char * ) ) &&
+       ( strcmp( step, "*" ) == 0 || strcmp( name, step ) == 0 ) ) {
+    records->matched = depth;
+    if ( depth == records->path->nelts ) {
+      records->record_depth = records->xml_depth;
+      records->converter.writer = json_writer_create( records->record_mp,
+                                                      records->record_mp );
+      records->converter.first_elem = TRUE;
+      start_handler( &records->converter, name, atts );
+    }
+  }
+}
+
+static void records_end_handler( void *records_ptr, const char *name )
+{
+  xml_records_t *records = records_ptr;
+  int depth = records->xml_depth - ( records->skip_root ? 1 : 0 );
+
+  if ( records->record_depth ) {
+    end_handler( &records->converter, name );
+    if ( records->xml_depth == records->record_depth ) {
+      /* Stop at the first error, the way xml_to_json gives up on the tree. */
+      if ( records->status && records->converter.status ) {
+        records->func( records->data, records->converter.writer->json );
+      }
+      records->record_depth = 0;
+      apr_pool_clear( records->record_mp );
+    }
+  }
+  else if ( records->leaf ) {
+    STR_BUF_CLEAR( records->converter.str_buf );
+  }
+
+  if ( !records->record_depth ) {
+    if ( depth > 0 && depth == records->matched ) {
+      records->matched--;
+    }
+    records->leaf = FALSE;
+  }
+
+  records->xml_depth--;
+}
+
+int xml2json_convert_records( xml2json_t *x, apr_file_t *xml_file,
+                              int skip_root, apr_array_header_t *path,
+                              xml_record_func func, void *data )
+{
+  xml_records_t records;
+  int xml_stat;
+  int status;
+
+  apr_pool_create( &records.record_mp, x->tmp_mp );
+  records.converter.writer = NULL;
+  records.converter.skip_root = FALSE;
+  records.converter.str_buf = str_buf_create( x->tmp_mp, 4096 );
+  records.converter.first_elem = TRUE;
+  records.converter.status = TRUE;
+  filter_state_init( &records.converter.filter, NULL, x->tmp_mp );
+  records.path = path;
+  records.skip_root = skip_root;
+  records.func = func;
+  records.data = data;
+  records.xml_depth = 0;
+  records.matched = 0;
+  records.record_depth = 0;
+  records.leaf = FALSE;
+  records.status = TRUE;
+
+  xml_stat = xml2json_parse( x, xml_file, NULL, &records,
+                             records_start_handler, records_end_handler,
+                             cdata_handler );
+
+  apr_pool_clear( x->tmp_mp );
+
+  status = ( ( xml_stat == XML_STATUS_OK ) && ( records.status == TRUE ) &&
+             ( records.converter.status == TRUE ) );
+
+  return status;
+}
+
+int xml_to_json_records( apr_file_t *xml_file, int skip_root,
+                         apr_array_header_t *path, xml_record_func func,
+                         void *data )
+{
+  apr_pool_t *tmp_mp;
+  xml2json_t *x;
+  int status = FALSE;
+
+  apr_pool_create( &tmp_mp, NULL );
+  if ( ( x = xml2json_create( tmp_mp ) ) ) {
+    status = xml2json_convert_records( x, xml_file, skip_root, path, func,
+                                       data );
+  }
+  apr_pool_destroy( tmp_mp );
+
+  return status;
+}
+
+/*
+ * Streaming conversion.  Elements are written to a JSON text writer as they
+ * are parsed.  Whether an element becomes a single property or an array
+ * depends on whether the next sibling has the same name, so the value of
+ * each child element is recorded until its next sibling starts.  Records
+ * are written out once the total recorded exceeds the lookahead, at which
+ * point the element is committed to being a single value.
+ */
+
+typedef enum stream_event_type {
+  EV_START_OBJECT,
+  EV_END_OBJECT,
+  EV_START_ARRAY,
+  EV_END_ARRAY,
+  EV_START_PROPERTY,
+  EV_END_PROPERTY,
+  EV_STRING,
+  EV_TRUE,
+  EV_FALSE,
+  EV_NULL
+} stream_event_type;
+
+/* Where a child's value goes, and what the children so far have become. */
+typedef enum stream_group_state {
+  /** No child is open, and the last one doesn't need any more handling. */
+  GROUP_NONE,
+  /** The last child was recorded and is waiting for its next sibling. */
+  GROUP_PENDING,
+  /** Children named group_name are being written to an open array. */
+  GROUP_ARRAY,
+  /** A child is being written straight to a property. */
+  GROUP_OPEN
+} stream_group_state;
+
+/* The recorded value of an element. */
+typedef struct stream_record_t {
+  str_buf_t *name;
+  str_buf_t *events;
+  /** Depth of the element being recorded. */
+  int depth;
+} stream_record_t;
+
+typedef struct stream_frame_t {
+  /** If the object for the element has been started. */
+  int has_object;
+  /** If the element is the top level object, it doesn't have a name. */
+  int no_lookahead;
+  stream_group_state group;
+  /** Name of the last child. */
+  str_buf_t *group_name;
+  /** The record of the last child, if group is GROUP_PENDING. */
+  stream_record_t *pending;
+  /** The record of this element while it is being recorded, or NULL. */
+  stream_record_t *record;
+} stream_frame_t;
+
+typedef struct xml_stream_t {
+  apr_pool_t *mp;
+  json_text_writer_t *writer;
+  apr_hash_t *array_elements;
+  apr_size_t lookahead;
+  int skip_root;
+  int first_elem;
+  int status;
+  /** Number of open XML elements. */
+  int xml_depth;
+  /** Character data of the innermost element. */
+  str_buf_t *text;
+  /** One frame per open element; entries are reused. */
+  apr_array_header_t *frames;
+  int depth;
+  /** Records being written to, outermost first. */
+  apr_array_header_t *recording;
+  /** Unused records. */
+  apr_array_header_t *free_records;
+  /**
+   * Bytes held back, in the records in recording and in the pending record
+   * of a frame.  Only the innermost frame can have one, since starting or
+   * ending anything settles it first.
+   */
+  apr_size_t recorded;
+  xml_filter_state_t filter;
+} xml_stream_t;
+
+#define STREAM_FRAME( stream, i ) \
+  ( &APR_ARRAY_IDX( (stream)->frames, i, stream_frame_t ) )
+
+/** The sink that is the writer itself rather than a record. */
+#define SINK_WRITER -1
+
+/**
+ * Names and strings are recorded with their length and a terminating NUL, so
+ * that they can be replayed in place.
+ */
+static void record_event( stream_record_t *record, stream_event_type type,
+                          const char *str, apr_size_t len )
+{
+  str_buf_putc( record->events, (char) type );
+  if ( str ) {
+    str_buf_write( record->events, (const char *) &len, sizeof(len) );
+    str_buf_write( record->events, str, len );
+    str_buf_putc( record->events, '\0' );
+  }
+}
+
+/**
+ * Send an event to the record at index sink of the recording stack, or to
+ * the writer.  Names have to be NUL terminated.
+ */
+static void stream_emit_to( xml_stream_t *stream, int sink,
+                            stream_event_type type, const char *str,
+                            apr_size_t len )
+{
+  json_text_writer_t *writer = stream->writer;
+  stream_record_t *record;
+  apr_size_t start_len;
+
+  if ( sink != SINK_WRITER ) {
+    record = APR_ARRAY_IDX( stream->recording, sink, stream_record_t * );
+    start_len = record->events->data_len;
+    record_event( record, type, str, len );
+    stream->recorded += record->events->data_len - start_len;
+    return;
+  }
+
+  switch ( type ) {
+  case EV_START_OBJECT:
+    json_text_writer_start_object( writer );
+    break;
+  case EV_END_OBJECT:
+    json_text_writer_end_object( writer );
+    break;
+  case EV_START_ARRAY:
+    json_text_writer_start_array( writer );
+    break;
+  case EV_END_ARRAY:
+    json_text_writer_end_array( writer );
+    break;
+  case EV_START_PROPERTY:
+    json_text_writer_start_property( writer, str );
+    break;
+  case EV_END_PROPERTY:
+    json_text_writer_end_property( writer );
+    break;
+  case EV_STRING:
+    json_text_writer_write_strn( writer, str, len );
+    break;
+  case EV_TRUE:
+    json_text_writer_write_boolean( writer, TRUE );
+    break;
+  case EV_FALSE:
+    json_text_writer_write_boolean( writer, FALSE );
+    break;
+  case EV_NULL:
+    json_text_writer_write_null( writer );
+    break;
+  }
+}
+
+/**
+ * Play back the events in record to sink.
+ */
+static void stream_replay( xml_stream_t *stream, stream_record_t *record,
+                           int sink )
+{
+  const char *event = record->events->data;
+  const char *end = event + record->events->data_len;
+  stream_event_type type;
+  apr_size_t len;
+
+  while ( event < end ) {
+    type = (stream_event_type) *event++;
+    if ( type == EV_START_PROPERTY || type == EV_STRING ) {
+      memcpy( &len, event, sizeof(len) );
+      event += sizeof(len);
+      stream_emit_to( stream, sink, type, event, len );
+      event += len + 1;
+    }
+    else {
+      stream_emit_to( stream, sink, type, NULL, 0 );
+    }
+  }
+}
+
+static stream_record_t *stream_record_get( xml_stream_t *stream,
+                                           const char *name, int depth )
+{
+  stream_record_t *record;
+
+  if ( stream->free_records->nelts > 0 ) {
+    record = *(stream_record_t **) apr_array_pop( stream->free_records );
+    STR_BUF_CLEAR( record->name );
+    STR_BUF_CLEAR( record->events );
+  }
+  else {
+    record = apr_palloc( stream->mp, sizeof(stream_record_t) );
+    record->name = str_buf_create( stream->mp, 64 );
+    record->events = str_buf_create( stream->mp, 4096 );
+  }
+  str_buf_write( record->name, name, strlen( name ) + 1 );
+  record->depth = depth;
+
+  return record;
+}
+
+static void stream_record_release( xml_stream_t *stream,
+                                   stream_record_t *record )
+{
+  APR_ARRAY_PUSH( stream->free_records, stream_record_t * ) = record;
+}
+
+/**
+ * Write out the outermost records until the rest fit in the lookahead.  The
+ * elements they record are committed to being single properties.
+ */
+static void stream_commit( xml_stream_t *stream )
+{
+  stream_record_t *record;
+  int i;
+
+  while ( stream->recorded > stream->lookahead &&
+          stream->recording->nelts > 0 ) {
+    record = APR_ARRAY_IDX( stream->recording, 0, stream_record_t * );
+    for ( i = 1; i < stream->recording->nelts; i++ ) {
+      APR_ARRAY_IDX( stream->recording, i - 1, stream_record_t * ) =
+        APR_ARRAY_IDX( stream->recording, i, stream_record_t * );
+    }
+    stream->recording->nelts--;
+    stream->recorded -= record->events->data_len;
+
+    stream_emit_to( stream, SINK_WRITER, EV_START_PROPERTY,
+                    record->name->data, record->name->data_len - 1 );
+    stream_replay( stream, record, SINK_WRITER );
+
+    STREAM_FRAME( stream, record->depth )->record = NULL;
+    stream_record_release( stream, record );
+  }
+}
+
+/**
+ * Send an event to the innermost record, or the writer if nothing is being
+ * recorded.
+ */
+static void stream_emit( xml_stream_t *stream, stream_event_type type,
+                         const char *str, apr_size_t len )
+{
+  stream_emit_to( stream, stream->recording->nelts - 1, type, str, len );
+  if ( stream->recorded > stream->lookahead ) {
+    stream_commit( stream );
+  }
+}
+
+/**
+ * Play back a record to the innermost record, or the writer.
+ */
+static void stream_replay_here( xml_stream_t *stream,
+                                stream_record_t *record )
+{
+  stream_replay( stream, record, stream->recording->nelts - 1 );
+  if ( stream->recorded > stream->lookahead ) {
+    stream_commit( stream );
+  }
+}
+
+/**
+ * Write out the children of frame that are still waiting on their next
+ * sibling.
+ */
+static void stream_close_group( xml_stream_t *stream, stream_frame_t *frame )
+{
+  stream_record_t *record;
+
+  switch ( frame->group ) {
+  case GROUP_PENDING:
+    record = frame->pending;
+    frame->pending = NULL;
+    stream->recorded -= record->events->data_len;
+    stream_emit( stream, EV_START_PROPERTY, record->name->data,
+                 record->name->data_len - 1 );
+    stream_replay_here( stream, record );
+    stream_emit( stream, EV_END_PROPERTY, NULL, 0 );
+    stream_record_release( stream, record );
+    break;
+
+  case GROUP_ARRAY:
+    stream_emit( stream, EV_END_ARRAY, NULL, 0 );
+    stream_emit( stream, EV_END_PROPERTY, NULL, 0 );
+    break;
+
+  default:
+    break;
+  }
+  frame->group = GROUP_NONE;
+}
+
+static void stream_push_frame( xml_stream_t *stream, int no_lookahead )
+{
+  stream_frame_t *frame;
+
+  if ( stream->depth == stream->frames->nelts ) {
+    frame = apr_array_push( stream->frames );
+    frame->group_name = str_buf_create( stream->mp, 64 );
+  }
+  frame = STREAM_FRAME( stream, stream->depth++ );
+  frame->has_object = FALSE;
+  frame->no_lookahead = no_lookahead;
+  frame->group = GROUP_NONE;
+  STR_BUF_CLEAR( frame->group_name );
+  frame->pending = NULL;
+  frame->record = NULL;
+}
+
+static void stream_start_object( xml_stream_t *stream, stream_frame_t *frame )
+{
+  if ( !frame->has_object ) {
+    stream_emit( stream, EV_START_OBJECT, NULL, 0 );
+    frame->has_object = TRUE;
+  }
+}
+
+/**
+ * Start a child element, or attribute, of the innermost element.
+ */
+static void stream_start_child( xml_stream_t *stream, const char *name )
+{
+  stream_frame_t *parent = STREAM_FRAME( stream, stream->depth - 1 );
+  stream_record_t *record;
+  int same_name;
+
+  stream_start_object( stream, parent );
+
+  same_name = ( parent->group_name->data_len > 0 &&
+                strcmp( parent->group_name->data, name ) == 0 );
+
+  if ( parent->group == GROUP_PENDING && same_name ) {
+    /* The second of a run of siblings, they go in an array. */
+    record = parent->pending;
+    parent->pending = NULL;
+    stream->recorded -= record->events->data_len;
+    stream_emit( stream, EV_START_PROPERTY, name, strlen( name ) );
+    stream_emit( stream, EV_START_ARRAY, NULL, 0 );
+    stream_replay_here( stream, record );
+    stream_record_release( stream, record );
+    parent->group = GROUP_ARRAY;
+  }
+  else if ( parent->group != GROUP_ARRAY || !same_name ) {
+    if ( same_name ) {
+      fprintf( stderr, "Warning: \"%s\" is repeated after it was written, "
+               "writing it again\n", name );
+    }
+    stream_close_group( stream, parent );
+    STR_BUF_CLEAR( parent->group_name );
+    str_buf_write( parent->group_name, name, strlen( name ) + 1 );
+
+    if ( apr_hash_get( stream->array_elements, name, APR_HASH_KEY_STRING ) ) {
+      stream_emit( stream, EV_START_PROPERTY, name, strlen( name ) );
+      stream_emit( stream, EV_START_ARRAY, NULL, 0 );
+      parent->group = GROUP_ARRAY;
+    }
+    else if ( parent->no_lookahead ) {
+      stream_emit( stream, EV_START_PROPERTY, name, strlen( name ) );
+      parent->group = GROUP_OPEN;
+    }
+    else {
+      record = stream_record_get( stream, name, stream->depth );
+      APR_ARRAY_PUSH( stream->recording, stream_record_t * ) = record;
+      parent->group = GROUP_OPEN;
+      stream_push_frame( stream, FALSE );
+      STREAM_FRAME( stream, stream->depth - 1 )->record = record;
+      return;
+    }
+  }
+
+  stream_push_frame( stream, FALSE );
+}
+
+static void stream_write_value( xml_stream_t *stream, const char *str,
+                                int len )
+{
+  int boolean;
+
+  if ( xml_str_is_boolean( str, len, &boolean ) ) {
+    stream_emit( stream, ( boolean ) ? EV_TRUE : EV_FALSE, NULL, 0 );
+  }
+  else {
+    stream_emit( stream, EV_STRING, str, len );
+  }
+}
+
+/**
+ * End the innermost element.
+ */
+static void stream_end_child( xml_stream_t *stream )
+{
+  stream_frame_t *frame = STREAM_FRAME( stream, stream->depth - 1 );
+  stream_frame_t *parent;
+  stream_record_t *record;
+  str_buf_t *text = stream->text;
+
+  if ( frame->has_object ) {
+    stream_close_group( stream, frame );
+    stream_emit( stream, EV_END_OBJECT, NULL, 0 );
+  }
+  else if ( text->data_len > 0 ) {
+    stream_write_value( stream, text->data, text->data_len );
+  }
+  else {
+    stream_emit( stream, EV_NULL, NULL, 0 );
+  }
+  STR_BUF_CLEAR( text );
+
+  stream->depth--;
+  parent = STREAM_FRAME( stream, stream->depth - 1 );
+
+  /* Writing the value may have committed the record. */
+  record = frame->record;
+  if ( record ) {
+    /*
+     * Wait for the next sibling to see if this is the start of an array.
+     * The record still counts toward the lookahead while it waits.
+     */
+    stream->recording->nelts--;
+    parent->pending = record;
+    parent->group = GROUP_PENDING;
+  }
+  else if ( parent->group == GROUP_OPEN ) {
+    stream_emit( stream, EV_END_PROPERTY, NULL, 0 );
+    parent->group = GROUP_NONE;
+  }
+}
+
+static void stream_start_handler( void *stream_ptr, const char *name,
+                                  const char **atts )
+{
+  xml_stream_t *stream = stream_ptr;
+  str_buf_t *text = stream->text;
+  int started = FALSE;
+
+  if ( stream->filter.filter &&
+       !filter_enter( &stream->filter, name,
+                      stream->first_elem && stream->skip_root ) ) {
+    return;
+  }
+
+  if ( text->data_len > 0 && !str_is_whitespace( text->data,
+                                                  text->data_len ) ) {
+    stream->status = FALSE;
+    fprintf( stderr, "Error: mixed content found before %s\ncontent:\n%.*s",
+             name, text->data_len, text->data );
+  }
+  STR_BUF_CLEAR( text );
+  stream->xml_depth++;
+
+  if ( stream->first_elem ) {
+    stream->first_elem = FALSE;
+    if ( stream->skip_root ) {
+      stream_push_frame( stream, FALSE );
+    }
+    else {
+      stream_push_frame( stream, TRUE );
+      stream_start_child( stream, name );
+    }
+  }
+  else {
+    stream_start_child( stream, name );
+  }
+
+  for ( ; *atts; atts += 2 ) {
+    if ( stream->filter.filter &&
+         !filter_keeps_attribute( &stream->filter, atts[0] ) ) {
+      continue;
+    }
+    if ( !started ) {
+      stream_start_object( stream,
+                           STREAM_FRAME( stream, stream->depth - 1 ) );
+      started = TRUE;
+    }
+    stream_start_child( stream, atts[0] );
+    str_buf_append( text, atts[1] );
+    stream_end_child( stream );
+  }
+}
+
+static void stream_end_handler( void *stream_ptr, const char *name )
+{
+  xml_stream_t *stream = stream_ptr;
+  stream_frame_t *frame;
+
+  if ( stream->filter.filter && !filter_leave( &stream->filter ) ) {
+    return;
+  }
+
+  stream->xml_depth--;
+  if ( stream->xml_depth > 0 || !stream->skip_root ) {
+    stream_end_child( stream );
+  }
+
+  if ( stream->xml_depth == 0 ) {
+    /* The top level object is finished. */
+    frame = STREAM_FRAME( stream, 0 );
+    stream_start_object( stream, frame );
+    stream_close_group( stream, frame );
+    stream_emit( stream, EV_END_OBJECT, NULL, 0 );
+    stream->depth--;
+  }
+}
+
+static void stream_cdata_handler( void *stream_ptr, const char *data,
+                                  int len )
+{
+  xml_stream_t *stream = stream_ptr;
+
+  if ( FILTER_KEEPS_TEXT( &stream->filter ) ) {
+    str_buf_write( stream->text, data, len );
+  }
+}
+
+int xml2json_convert_stream( xml2json_t *x, apr_file_t *xml_file,
+                             int skip_root, json_text_writer_t *writer,
+                             apr_hash_t *array_elements,
+                             apr_size_t lookahead )
+{
+  xml_stream_t stream;
+  apr_pool_t *tmp_mp = x->tmp_mp;
+  int xml_stat;
+  int status;
+
+  stream.mp = tmp_mp;
+  stream.writer = writer;
+  stream.array_elements = ( array_elements ) ? array_elements :
+                                               apr_hash_make( tmp_mp );
+  stream.lookahead = lookahead;
+  stream.skip_root = skip_root;
+  stream.first_elem = TRUE;
+  stream.status = TRUE;
+  stream.xml_depth = 0;
+  stream.text = str_buf_create( tmp_mp, 4096 );
+  stream.frames = apr_array_make( tmp_mp, 64, sizeof(stream_frame_t) );
+  stream.depth = 0;
+  stream.recording = apr_array_make( tmp_mp, 64,
+                                     sizeof(stream_record_t *) );
+  stream.free_records = apr_array_make( tmp_mp, 64,
+                                        sizeof(stream_record_t *) );
+  stream.recorded = 0;
+  filter_state_init( &stream.filter, x->filter, tmp_mp );
+
+  xml_stat = xml2json_parse( x, xml_file, NULL, &stream,
+                             stream_start_handler,
+                             stream_end_handler, stream_cdata_handler );
+
+  if ( x->filter && stream.xml_depth == 0 && stream.first_elem &&
+       xml_stat == XML_STATUS_OK ) {
+    /* Nothing was kept. */
+    json_text_writer_start_object( writer );
+    json_text_writer_end_object( writer );
+  }
+
+  json_text_writer_flush( writer );
+  apr_pool_clear( tmp_mp );
+
+  status = ( ( xml_stat == XML_STATUS_OK ) && ( stream.status == TRUE ) );
+
+  return status;
+}
+
+int xml_to_json_stream( apr_file_t *xml_file, int skip_root,
+                        json_text_writer_t *writer,
+                        apr_hash_t *array_elements, apr_size_t lookahead )
+{
+  apr_pool_t *tmp_mp;
+  xml2json_t *x;
+  int status = FALSE;
+
+  apr_pool_create( &tmp_mp, NULL );
+  if ( ( x = xml2json_create( tmp_mp ) ) ) {
+    status = xml2json_convert_stream( x, xml_file, skip_root, writer,
+                                      array_elements, lookahead );
+  }
+  apr_pool_destroy( tmp_mp );
+
+  return status;
+}
@@ -1,10 +1,206 @@
 #ifndef XML2JSON_H
 #define XML2JSON_H
 
+#include <apr_hash.h>
 #include <apr_pools.h>
+#include <apr_tables.h>
 #include "json.h"
+#include "json_text_writer.h"
+
+/** Default number of bytes xml_to_json_stream may hold back. */
+#define XML_TO_JSON_LOOKAHEAD ( 1024 * 1024 )
+
+/**
+ * How many bytes of XML are handed to expat at a time.  Define it when
+ * building to change the default, or use xml2json_set_read_sizes.
+ */
+#ifndef XML_TO_JSON_BUFFER_SIZE
+#define XML_TO_JSON_BUFFER_SIZE ( 256 * 1024 )
+#endif
+
+/**
+ * How much of a regular file is mapped at a time.  A multiple of
+ * XML_TO_JSON_MAP_ALIGN.
+ */
+#ifndef XML_TO_JSON_MAP_SIZE
+#define XML_TO_JSON_MAP_SIZE ( 16 * 1024 * 1024 )
+#endif
+
+/** Map sizes are rounded up to a multiple of this, at least a page. */
+#define XML_TO_JSON_MAP_ALIGN ( 64 * 1024 )
+
+/**
+ * Documents smaller than this are converted on one thread by
+ * xml_to_json_threaded.
+ */
+#ifndef XML_TO_JSON_SPLIT_SIZE
+#define XML_TO_JSON_SPLIT_SIZE ( 1024 * 1024 )
+#endif
 
 int xml_to_json( apr_pool_t *mp, apr_file_t *xml_file, int skip_root,
                  json_t **json );
 
+/**
+ * Convert a document that is already in memory like xml_to_json.
+ * @param xml The document, which doesn't have to be NUL terminated.
+ * @param len The length of xml.
+ */
+int xml_to_json_buffer( apr_pool_t *mp, const char *xml, apr_size_t len,
+                        int skip_root, json_t **json );
+
+/**
+ * The parts of a document to convert, see xml_filter_add.
+ */
+typedef struct xml_filter_t xml_filter_t;
+
+/**
+ * Create a filter that keeps nothing until paths are added to it.
+ * @param mp Pool to allocate the filter from.
+ */
+xml_filter_t *xml_filter_create( apr_pool_t *mp );
+
+/**
+ * Keep the elements and attributes at a path, with everything in them.  The
+ * elements around them are kept as well, but only as containers: their text
+ * and the rest of their content are left out, and one with nothing kept in
+ * it becomes null.  Everything else is skipped while the XML is parsed,
+ * without being converted or buffered.
+ * @param filter The filter.
+ * @param path The names of properties from the top of the tree xml_to_json
+ *        would build, separated by '/'.  A "*" step matches any name.
+ * @return TRUE if the path was added, FALSE if it has an empty step.
+ */
+int xml_filter_add( xml_filter_t *filter, const char *path );
+
+/**
+ * Convert the parts of XML that a filter keeps, like xml_to_json.  If
+ * nothing is kept, json is an empty object.
+ */
+int xml_to_json_filtered( apr_pool_t *mp, apr_file_t *xml_file,
+                          int skip_root, xml_filter_t *filter,
+                          json_t **json );
+
+/**
+ * Convert XML like xml_to_json, on several threads.  The document is mapped
+ * and split between the elements under its root, and each part is converted
+ * with a parser of its own.  The parts are merged in document order, so
+ * elements with the same name are still gathered into arrays.  Documents
+ * that aren't regular files, are small, aren't UTF-8 or have a document type
+ * declaration are converted on the calling thread, as they are when a slab
+ * or schema is attached to mp.
+ * @param mp Pool to allocate the tree from.  The threads allocate from
+ *        subpools of it, so its allocator must be safe to use from several
+ *        threads, as the default one is.
+ * @param threads The number of threads to use, including the caller.
+ */
+int xml_to_json_threaded( apr_pool_t *mp, apr_file_t *xml_file,
+                          int skip_root, json_t **json, int threads );
+
+/**
+ * Called by xml_to_json_records for each record.
+ * @param data The data passed to xml_to_json_records.
+ * @param record An object with the record as its only property, named after
+ *        its element.  It is freed when this returns.
+ */
+typedef void ( *xml_record_func )( void *data, json_t *record );
+
+/**
+ * Convert the elements at one path of an XML document one at a time, in
+ * document order, instead of building a tree for the whole document.  Each
+ * record is converted the way xml_to_json would convert it.  The rest of the
+ * document is skipped, except that mixed content is still an error.
+ * @param xml_file The XML to convert.
+ * @param skip_root Whether the path starts below the root element.
+ * @param path The names of the elements from the top of the tree
+ *        xml_to_json would build down to the records, as const char *.  A
+ *        "*" step matches any name.
+ * @param func Called with each record.
+ * @param data Passed to func.
+ * @return TRUE if the XML was converted, FALSE otherwise.  Records before an
+ *         error have already been passed to func, none are after it.
+ */
+int xml_to_json_records( apr_file_t *xml_file, int skip_root,
+                         apr_array_header_t *path, xml_record_func func,
+                         void *data );
+
+/**
+ * Convert XML to JSON text while it is parsed, instead of building a tree.
+ * Properties are written in document order.  Runs of sibling elements with
+ * the same name become arrays, which is decided by holding back each element
+ * until its next sibling starts.  Once more than lookahead bytes are held
+ * back, the outermost element held back is written as a single property; a
+ * sibling with the same name that follows it, or any sibling that isn't
+ * adjacent to its namesakes, is written as a repeated property.  Everything
+ * held back counts, however deep, including an element waiting for its next
+ * sibling.
+ * @param xml_file The XML to convert.
+ * @param skip_root Whether to leave the root element out.
+ * @param writer The writer to write to.  It is flushed at the end.
+ * @param array_elements Names of elements that are always written as arrays,
+ *        without holding them back, or NULL.
+ * @param lookahead Bytes that may be held back, usually
+ *        XML_TO_JSON_LOOKAHEAD.
+ * @return TRUE if the XML was converted, FALSE otherwise.
+ */
+int xml_to_json_stream( apr_file_t *xml_file, int skip_root,
+                        json_text_writer_t *writer,
+                        apr_hash_t *array_elements, apr_size_t lookahead );
+
+/**
+ * A converter that keeps its expat parser and scratch memory between
+ * documents, for converting many of them in a row.  It must only be used by
+ * one thread at a time.
+ */
+typedef struct xml2json_t xml2json_t;
+
+/**
+ * Create a converter.  It is freed when mp is cleared or destroyed.
+ * @return The converter, or NULL if expat could not create a parser.
+ */
+xml2json_t *xml2json_create( apr_pool_t *mp );
+
+/**
+ * Convert only what a filter keeps with a converter from now on.
+ * @param x The converter.
+ * @param filter The filter, or NULL to convert everything.
+ */
+void xml2json_set_filter( xml2json_t *x, xml_filter_t *filter );
+
+/**
+ * Change how much XML a converter hands to expat at a time and how much of
+ * a regular file it maps at a time.  If a window can't be mapped, the rest
+ * of the file is read in pieces of buffer_size instead.
+ * @param x The converter.
+ * @param buffer_size Bytes handed to expat at a time, or 0 for
+ *        XML_TO_JSON_BUFFER_SIZE.
+ * @param map_size Bytes mapped at a time, rounded up to a multiple of
+ *        XML_TO_JSON_MAP_ALIGN, or 0 for XML_TO_JSON_MAP_SIZE.
+ */
+void xml2json_set_read_sizes( xml2json_t *x, apr_size_t buffer_size,
+                              apr_size_t map_size );
+
+/**
+ * Convert a document like xml_to_json, reusing a converter.
+ * @param x The converter.
+ * @param mp Pool to allocate the tree from.
+ */
+int xml2json_convert( xml2json_t *x, apr_pool_t *mp, apr_file_t *xml_file,
+                      int skip_root, json_t **json );
+
+/**
+ * Convert a document like xml_to_json_stream, reusing a converter.
+ */
+int xml2json_convert_stream( xml2json_t *x, apr_file_t *xml_file,
+                             int skip_root, json_text_writer_t *writer,
+                             apr_hash_t *array_elements,
+                             apr_size_t lookahead );
+
+/**
+ * Convert records like xml_to_json_records, reusing a converter.  The
+ * converter's filter isn't used.
+ */
+int xml2json_convert_records( xml2json_t *x, apr_file_t *xml_file,
+                              int skip_root, apr_array_header_t *path,
+                              xml_record_func func, void *data );
+
 #endif
@@ -19,6 +19,7 @@
  * limitations under the License.
  */
 
+#include <stdio.h>
 #include <apr_general.h>
 #include <apr_getopt.h>
 #include <apr_lib.h>
@@ -29,6 +30,9 @@
 #include "apr_macros.h"
 
 #include "json.h"
+#include "json_compress.h"
+#include "json_schema.h"
+#include "json_slab.h"
 #include "jxtl_path.h"
 #include "json_writer.h"
 #include "parser.h"
@@ -167,12 +171,16 @@ static char *format_json( json_t *json, char *format, void *format_data_ptr )
 void jxtl_init( int argc, char const * const *argv, apr_pool_t *mp,
                 const char **template_file, const char **json_file,
                 const char **xml_file, int *skip_root,
-                const char **output_file )
+                const char **output_file, int *share, int *compact,
+                int *huge_pages, int *raw_numbers, const char **schema_file,
+                apr_size_t *compress_size, int *records )
 {
   apr_getopt_t *options;
   apr_status_t ret;
   int ch;
   const char *arg;
+  int bad_number = FALSE;
+  apr_int64_t number;
   const apr_getopt_option_t jxtl_options[] = {
     { "template", 't', 1, "template file" },
     { "json", 'j', 1, "JSON data dictionary for template" },
@@ -180,6 +188,21 @@ void jxtl_init( int argc, char const * const *argv, apr_pool_t *mp,
     { "skiproot", 's', 0,
       "Skip the root element if using an XML data dictionary" },
     { "output", 'o', 1, "file to save output to" },
+    { "share", 'S', 0,
+      "Store identical values in the data dictionary only once" },
+    { "compact", 'C', 0,
+      "Copy the data dictionary into contiguous memory after loading" },
+    { "hugepages", 'H', 0,
+      "Allocate the data dictionary from huge page backed slabs" },
+    { "rawnumbers", 'r', 0,
+      "Print numbers from a JSON data dictionary exactly as written" },
+    { "schema", 'm', 1, "Schema of the data dictionary" },
+    { "compress", 'z', 1,
+      "Keep strings of at least this many bytes, 64 or more, compressed in "
+      "memory" },
+    { "records", 'R', 0,
+      "Expand the template for each record of the XML data dictionary while "
+      "it is read, if the template is a single section over the records" },
     { 0, 0, 0, 0 }
   };
 
@@ -188,6 +211,13 @@ void jxtl_init( int argc, char const * const *argv, apr_pool_t *mp,
   *xml_file = NULL;
   *skip_root = FALSE;
   *output_file = NULL;
+  *share = FALSE;
+  *compact = FALSE;
+  *huge_pages = FALSE;
+  *raw_numbers = FALSE;
+  *schema_file = NULL;
+  *compress_size = 0;
+  *records = FALSE;
 
   apr_getopt_init( &options, mp, argc, argv );
 
@@ -213,11 +243,47 @@ void jxtl_init( int argc, char const * const *argv, apr_pool_t *mp,
     case 't':
       *template_file = arg;
       break;
+
+    case 'S':
+      *share = TRUE;
+      break;
+
+    case 'C':
+      *compact = TRUE;
+      break;
+
+    case 'H':
+      *huge_pages = TRUE;
+      break;
+
+    case 'r':
+      *raw_numbers = TRUE;
+      break;
+
+    case 'm':
+      *schema_file = arg;
+      break;
+
+    case 'z':
+      if ( parse_option_number( arg, JSON_COMPRESS_MIN_SIZE,
+                                APR_SIZE_MAX / 2, &number ) ) {
+        *compress_size = (apr_size_t) number;
+      }
+      else {
+        bad_number = TRUE;
+      }
+      break;
+
+    case 'R':
+      *records = TRUE;
+      break;
     }
   }
 
-  if ( ( ret == APR_BADCH ) || ( *template_file == NULL ) ||
-       ( ( *json_file == NULL ) && ( *xml_file == NULL ) ) ) {
+  if ( ( ret == APR_BADCH ) || bad_number || ( *template_file == NULL ) ||
+       ( ( *json_file == NULL ) && ( *xml_file == NULL ) ) ||
+       ( *records && ( !*xml_file || *share || *compact || *huge_pages ||
+                       *raw_numbers || *compress_size ) ) ) {
     print_usage( argv[0], jxtl_options );
     exit( EXIT_FAILURE );
   }
@@ -225,28 +291,149 @@ void jxtl_init( int argc, char const * const *argv, apr_pool_t *mp,
 
 /**
  * Load data from either json_file or xml_file.  One of those has to be
- * non-null.
+ * non-null.  If share or compact is set, the data is loaded into a temporary
+ * pool and only the shared and/or compacted copy is kept in mp.  If
+ * huge_pages is set, the nodes are loaded into huge page backed slabs.  If
+ * raw_numbers is set, numbers keep the text they were written with.  If
+ * schema is non-null, the data is loaded with it.  Strings of at least
+ * compress_size bytes are kept compressed, unless it is 0.
  */
 static int load_data( apr_pool_t *mp, const char *json_file,
-                      const char *xml_file, int skip_root, json_t **obj )
+                      const char *xml_file, int skip_root, int share,
+                      int compact, int huge_pages, int raw_numbers,
+                      json_schema_t *schema, apr_size_t compress_size,
+                      json_t **obj )
 {
   int ret = FALSE;
   parser_t *json_parser;
   apr_status_t status;
   apr_file_t *file;
+  apr_pool_t *load_mp = mp;
+  apr_pool_t *share_mp;
+
+  if ( share || compact ) {
+    apr_pool_create( &load_mp, NULL );
+  }
+
+  if ( huge_pages ) {
+    json_slab_attach( json_slab_create( load_mp, JSON_SLAB_HUGE_PAGES ),
+                      load_mp );
+  }
+
+  if ( schema ) {
+    json_schema_attach( schema, load_mp );
+  }
+
+  if ( compress_size ) {
+    json_compress_attach( compress_size, load_mp );
+  }
 
   if ( xml_file ) {
-    ret = open_apr_input_file( mp, xml_file, &file );
+    ret = open_apr_input_file( load_mp, xml_file, &file );
     if ( ret ) {
-      ret = xml_to_json( mp, file, skip_root, obj );
+      ret = xml_to_json( load_mp, file, skip_root, obj );
     }
   }
   else {
-    ret = open_apr_input_file( mp, json_file, &file );
+    ret = open_apr_input_file( load_mp, json_file, &file );
     if ( ret ) {
-      json_parser = json_parser_create( mp );
-      ret = json_parser_parse_file_to_obj( mp, json_parser, file, obj );
+      json_parser = json_parser_create( load_mp );
+      if ( raw_numbers ) {
+        parser_set_flags( json_parser, JSON_PARSER_RAW_NUMBERS );
+      }
+      ret = json_parser_parse_file_to_obj( load_mp, json_parser, file, obj );
+    }
+  }
+
+  if ( ret && share ) {
+    share_mp = mp;
+    if ( compact ) {
+      apr_pool_create( &share_mp, NULL );
     }
+    *obj = json_share( share_mp, *obj );
+    apr_pool_destroy( load_mp );
+    load_mp = share_mp;
+  }
+
+  if ( ret && compact ) {
+    *obj = json_compact( *obj, mp );
+  }
+
+  if ( load_mp != mp ) {
+    apr_pool_destroy( load_mp );
+  }
+
+  return ret;
+}
+
+/**
+ * Compile the schema in schema_file.  A NULL schema_file is not an error and
+ * leaves schema NULL.
+ */
+static int load_schema( apr_pool_t *mp, const char *schema_file,
+                        json_schema_t **schema )
+{
+  int ret;
+  apr_file_t *file;
+  parser_t *json_parser;
+  json_t *json;
+
+  *schema = NULL;
+
+  if ( !schema_file ) {
+    return TRUE;
+  }
+
+  ret = open_apr_input_file( mp, schema_file, &file );
+  if ( ret ) {
+    json_parser = json_parser_create( mp );
+    ret = json_parser_parse_file_to_obj( mp, json_parser, file, &json );
+  }
+  if ( ret ) {
+    *schema = json_schema_create( mp, json );
+    ret = ( *schema != NULL );
+  }
+
+  return ret;
+}
+
+typedef struct record_data_t {
+  jxtl_template_t *template;
+  format_data_t *format_data;
+} record_data_t;
+
+static void expand_record( void *data_ptr, json_t *record )
+{
+  record_data_t *data = (record_data_t *) data_ptr;
+
+  jxtl_template_expand_record( data->template, record );
+  apr_pool_clear( data->format_data->mp );
+}
+
+/**
+ * Expand template for each record in xml_file as it is read, without loading
+ * the whole file.  Formats allocate from a pool that is cleared after each
+ * record.
+ */
+static int expand_xml_records( apr_pool_t *mp, jxtl_template_t *template,
+                               format_data_t *format_data,
+                               apr_array_header_t *record_path,
+                               const char *xml_file, int skip_root,
+                               apr_file_t *out )
+{
+  int ret;
+  apr_file_t *file;
+  record_data_t data;
+
+  ret = open_apr_input_file( mp, xml_file, &file );
+  if ( ret ) {
+    apr_pool_create( &format_data->mp, mp );
+    data.template = template;
+    data.format_data = format_data;
+    jxtl_template_start_records( template, out );
+    ret = xml_to_json_records( file, skip_root, record_path, expand_record,
+                               &data );
+    jxtl_template_end_records( template );
   }
 
   return ret;
@@ -260,22 +447,33 @@ int main( int argc, char const * const *argv )
   const char *xml_file = NULL;
   const char *out_file = NULL;
   int skip_root;
+  int share;
+  int compact;
+  int huge_pages;
+  int raw_numbers;
+  const char *schema_file;
+  json_schema_t *schema;
+  apr_size_t compress_size;
+  int records;
+  int ret = FALSE;
   json_t *json;
   parser_t *jxtl_parser;
   jxtl_template_t *template;
   format_data_t *format_data;
   apr_file_t *out;
   apr_file_t *template_file;
+  apr_array_header_t *record_path;
 
   apr_app_initialize( NULL, NULL, NULL );
   apr_pool_create( &mp, NULL );
 
   jxtl_init( argc, argv, mp, &template_file_name, &json_file, &xml_file,
-             &skip_root, &out_file );
+             &skip_root, &out_file, &share, &compact, &huge_pages,
+             &raw_numbers, &schema_file, &compress_size, &records );
 
   jxtl_parser = jxtl_parser_create( mp );
 
-  if ( load_data( mp, json_file, xml_file, skip_root, &json ) &&
+  if ( load_schema( mp, schema_file, &schema ) &&
        open_apr_output_file( mp, out_file, &out ) &&
        open_apr_input_file( mp, template_file_name, &template_file ) &&
        jxtl_parser_parse_file_to_template( mp, jxtl_parser, template_file,
@@ -288,11 +486,41 @@ int main( int argc, char const * const *argv )
     jxtl_template_register_format( template, "trn_field", format_trn_field);
     jxtl_template_register_format( template, "json", format_json );
     jxtl_template_set_format_data( template, format_data );
-    jxtl_template_expand_to_file( template, json, out );
+    if ( schema ) {
+      jxtl_template_set_schema( template, schema );
+    }
+
+    /*
+     * With -R, a template that only expands a section for each record of an
+     * XML file is expanded while the file is read.  Everything else needs
+     * the whole data dictionary loaded first.  Records already expanded
+     * have been written when an error in the XML is found, so the output is
+     * incomplete rather than empty.
+     */
+    record_path = ( records ) ? jxtl_template_record_path( mp, template ) :
+                                NULL;
+    if ( record_path ) {
+      ret = expand_xml_records( mp, template, format_data, record_path,
+                                xml_file, skip_root, out );
+      if ( !ret ) {
+        fprintf( stderr, "failed to read %s, the output is incomplete\n",
+                 xml_file );
+      }
+    }
+    else if ( load_data( mp, json_file, xml_file, skip_root, share, compact,
+                         huge_pages, raw_numbers, schema, compress_size,
+                         &json ) ) {
+      ret = ( jxtl_template_expand_to_file( template, json,
+                                            out ) == APR_SUCCESS );
+      if ( !ret ) {
+        fprintf( stderr, "failed to expand the template, the output is "
+                 "incomplete\n" );
+      }
+    }
   }
 
   apr_pool_destroy( mp );
   apr_terminate();
 
-  return 0;
+  return ( ret ) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
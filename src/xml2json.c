@@ -1,19 +1,39 @@
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <apr_atomic.h>
+#include <apr_file_info.h>
 #include <apr_getopt.h>
+#include <apr_hash.h>
 #include <apr_pools.h>
+#include <apr_strings.h>
+#include <apr_tables.h>
+#if APR_HAS_THREADS
+#include <apr_thread_proc.h>
+#endif
 
 #include "json.h"
 #include "xml2json.h"
+#include "json_text_writer.h"
 #include "json_writer.h"
 #include "misc.h"
 
 void xml2json_init( int argc, char const * const *argv, apr_pool_t *mp,
                     const char **xml_file, const char **output_file,
-                    int *preserve_root, int *indent )
+                    int *preserve_root, int *indent, int *stream,
+                    apr_hash_t *array_elements, apr_size_t *lookahead,
+                    int *threads, const char **output_dir, int *jobs,
+                    xml_filter_t **filter, apr_array_header_t **each,
+                    apr_array_header_t *inputs )
 {
   apr_getopt_t *options;
   apr_status_t ret;
+  int bad_path = FALSE;
+  int bad_number = FALSE;
+  apr_int64_t number;
+  const char *step;
+  const char *step_end;
   int ch;
   const char *arg;
   const apr_getopt_option_t xml2json_options[] = {
@@ -21,6 +41,24 @@ void xml2json_init( int argc, char const * const *argv, apr_pool_t *mp,
     { "output", 'o', 1, "file to save output to" },
     { "preserve-root", 'p', 0, "preserve the root element of XML file" },
     { "xml_file", 'x', 1, "XML file" },
+    { "stream", 's', 0,
+      "write the JSON while the XML is read, in constant memory" },
+    { "array", 'a', 1,
+      "element that is always an array when streaming, may be repeated" },
+    { "lookahead", 'l', 1,
+      "most bytes of elements to hold back when streaming, at all depths "
+      "together" },
+    { "threads", 't', 1, "threads to convert and write large files with" },
+    { "output-dir", 'd', 1,
+      "directory to write a JSON file to for each XML file or directory "
+      "of XML files given after the options" },
+    { "jobs", 'j', 1, "files to convert at once with -d" },
+    { "keep", 'k', 1,
+      "path of elements or attributes to keep, like item/name or */id, "
+      "may be repeated" },
+    { "each", 'e', 1,
+      "write each element at a path as a line of JSON, like item, or */* "
+      "for the elements two levels down" },
     { 0, 0, 0, 0 }
   };
 
@@ -28,6 +66,13 @@ void xml2json_init( int argc, char const * const *argv, apr_pool_t *mp,
   *preserve_root = FALSE;
   *output_file = "-";
   *indent = FALSE;
+  *stream = FALSE;
+  *lookahead = XML_TO_JSON_LOOKAHEAD;
+  *threads = 1;
+  *output_dir = NULL;
+  *jobs = 1;
+  *filter = NULL;
+  *each = NULL;
 
   apr_getopt_init( &options, mp, argc, argv );
 
@@ -49,15 +94,363 @@ void xml2json_init( int argc, char const * const *argv, apr_pool_t *mp,
     case 'x':
       *xml_file = arg;
       break;
+
+    case 's':
+      *stream = TRUE;
+      break;
+
+    case 'a':
+      apr_hash_set( array_elements, arg, APR_HASH_KEY_STRING, arg );
+      break;
+
+    case 'l':
+      /* The most that fits in both an apr_size_t and an apr_int64_t. */
+      if ( parse_option_number( arg, 0, APR_SIZE_MAX / 2, &number ) ) {
+        *lookahead = (apr_size_t) number;
+      }
+      else {
+        bad_number = TRUE;
+      }
+      break;
+
+    case 't':
+      if ( parse_option_number( arg, 1, INT_MAX, &number ) ) {
+        *threads = (int) number;
+      }
+      else {
+        bad_number = TRUE;
+      }
+      break;
+
+    case 'd':
+      *output_dir = arg;
+      break;
+
+    case 'j':
+      if ( parse_option_number( arg, 1, INT_MAX, &number ) ) {
+        *jobs = (int) number;
+      }
+      else {
+        bad_number = TRUE;
+      }
+      break;
+
+    case 'k':
+      if ( !*filter ) {
+        *filter = xml_filter_create( mp );
+      }
+      if ( !xml_filter_add( *filter, arg ) ) {
+        bad_path = TRUE;
+      }
+      break;
+
+    case 'e':
+      *each = apr_array_make( mp, 8, sizeof(const char *) );
+      for ( step = arg; step; step = ( step_end ) ? step_end + 1 : NULL ) {
+        step_end = strchr( step, '/' );
+        if ( step_end == step || !*step ) {
+          bad_path = TRUE;
+        }
+        APR_ARRAY_PUSH( *each, const char * ) =
+          ( step_end ) ? apr_pstrndup( mp, step, step_end - step ) : step;
+      }
+      break;
     }
   }
 
-  if ( ret == APR_BADCH ) {
+  while ( options->ind < argc ) {
+    APR_ARRAY_PUSH( inputs, const char * ) = argv[options->ind++];
+  }
+
+  if ( ret == APR_BADCH || bad_path || bad_number || ( *filter && *each ) ||
+       ( !*output_dir != !inputs->nelts ) ) {
     print_usage( argv[0], xml2json_options );
     exit( EXIT_FAILURE );
   }
 }
 
+/**
+ * Add an XML file to convert, or every .xml file in a directory.
+ */
+static int add_input( apr_pool_t *mp, const char *path,
+                      apr_array_header_t *inputs )
+{
+  apr_finfo_t finfo;
+  apr_dir_t *dir;
+  apr_size_t len;
+  char *file;
+
+  if ( apr_stat( &finfo, path, APR_FINFO_TYPE, mp ) != APR_SUCCESS ) {
+    fprintf( stderr, "could not read %s\n", path );
+    return FALSE;
+  }
+  else if ( finfo.filetype != APR_DIR ) {
+    APR_ARRAY_PUSH( inputs, const char * ) = path;
+    return TRUE;
+  }
+  else if ( apr_dir_open( &dir, path, mp ) != APR_SUCCESS ) {
+    fprintf( stderr, "could not read %s\n", path );
+    return FALSE;
+  }
+
+  while ( apr_dir_read( &finfo, APR_FINFO_NAME | APR_FINFO_TYPE,
+                        dir ) == APR_SUCCESS ) {
+    len = strlen( finfo.name );
+    if ( finfo.filetype == APR_REG && len > 4 &&
+         strcmp( finfo.name + len - 4, ".xml" ) == 0 &&
+         apr_filepath_merge( &file, path, finfo.name, 0,
+                             mp ) == APR_SUCCESS ) {
+      APR_ARRAY_PUSH( inputs, const char * ) = file;
+    }
+  }
+  apr_dir_close( dir );
+
+  return TRUE;
+}
+
+typedef struct line_writer_t {
+  apr_file_t *out;
+  str_buf_t *buf;
+} line_writer_t;
+
+/**
+ * Write a record converted by xml_to_json_records as a line of JSON.
+ */
+static void write_line( void *data, json_t *record )
+{
+  line_writer_t *lines = data;
+
+  STR_BUF_CLEAR( lines->buf );
+  json_dump_to_str_buf( lines->buf, record, 0 );
+  str_buf_putc( lines->buf, '\n' );
+  apr_file_write_full( lines->out, lines->buf->data, lines->buf->data_len,
+                       NULL );
+}
+
+/**
+ * Write each element at a path of a document as a line of JSON.
+ */
+static int write_lines( xml2json_t *x, apr_pool_t *mp, apr_file_t *xml_fp,
+                        apr_file_t *out_fp, int skip_root,
+                        apr_array_header_t *each )
+{
+  line_writer_t lines;
+
+  lines.out = out_fp;
+  lines.buf = str_buf_create( mp, 4096 );
+
+  return xml2json_convert_records( x, xml_fp, skip_root, each, write_line,
+                                   &lines );
+}
+
+/**
+ * Everything the workers of a batch share.  Only next_file and failures
+ * change once they start.
+ */
+typedef struct batch_t {
+  apr_array_header_t *inputs;
+  /** The output of each input, as named by batch_name_outputs. */
+  apr_array_header_t *outputs;
+  const char *output_dir;
+  int preserve_root;
+  int indent;
+  int stream;
+  apr_hash_t *array_elements;
+  apr_size_t lookahead;
+  int threads;
+  xml_filter_t *filter;
+  /** The path of the elements to write as lines, or NULL. */
+  apr_array_header_t *each;
+  volatile apr_uint32_t next_file;
+  volatile apr_uint32_t failures;
+} batch_t;
+
+typedef struct batch_worker_t {
+  batch_t *batch;
+  /** Holds the converter, which is reused for every file. */
+  apr_pool_t *mp;
+} batch_worker_t;
+
+/**
+ * The output for an input, named after it with .json in place of .xml.
+ */
+static char *batch_output_file( apr_pool_t *mp, const char *output_dir,
+                                const char *xml_file )
+{
+  const char *name = strrchr( xml_file, '/' );
+  apr_size_t len;
+  char *file;
+
+  name = ( name ) ? name + 1 : xml_file;
+  len = strlen( name );
+  if ( len > 4 && strcmp( name + len - 4, ".xml" ) == 0 ) {
+    len -= 4;
+  }
+  name = apr_pstrcat( mp, apr_pstrndup( mp, name, len ), ".json", NULL );
+
+  if ( apr_filepath_merge( &file, output_dir, name, 0, mp ) != APR_SUCCESS )
+    return NULL;
+
+  return file;
+}
+
+/**
+ * Name the output of every input.
+ * @return FALSE if two inputs would be written to the same file, which
+ *         would lose one of them, or an output couldn't be named.
+ */
+static int batch_name_outputs( apr_pool_t *mp, batch_t *batch )
+{
+  apr_hash_t *named = apr_hash_make( mp );
+  const char *xml_file;
+  char *out_file;
+  const char *other;
+  int status = TRUE;
+  int i;
+
+  batch->outputs = apr_array_make( mp, batch->inputs->nelts,
+                                   sizeof(const char *) );
+  for ( i = 0; i < batch->inputs->nelts; i++ ) {
+    xml_file = APR_ARRAY_IDX( batch->inputs, i, const char * );
+    out_file = batch_output_file( mp, batch->output_dir, xml_file );
+    if ( !out_file ) {
+      fprintf( stderr, "could not name the output of %s\n", xml_file );
+      status = FALSE;
+    }
+    else if ( ( other = apr_hash_get( named, out_file,
+                                      APR_HASH_KEY_STRING ) ) ) {
+      fprintf( stderr, "%s and %s would both be written to %s\n", other,
+               xml_file, out_file );
+      status = FALSE;
+    }
+    else {
+      apr_hash_set( named, out_file, APR_HASH_KEY_STRING, xml_file );
+    }
+    APR_ARRAY_PUSH( batch->outputs, const char * ) = out_file;
+  }
+
+  return status;
+}
+
+static int batch_convert( batch_t *batch, xml2json_t *x, apr_pool_t *mp,
+                          const char *xml_file, const char *out_file )
+{
+  apr_file_t *xml_fp;
+  apr_file_t *out_fp;
+  json_text_writer_t *writer;
+  json_t *json;
+
+  if ( apr_file_open( &xml_fp, xml_file, APR_READ | APR_BUFFERED, 0,
+                      mp ) != APR_SUCCESS ) {
+    return FALSE;
+  }
+  else if ( batch->each ) {
+    return ( open_apr_output_file( mp, out_file, &out_fp ) &&
+             write_lines( x, mp, xml_fp, out_fp, !batch->preserve_root,
+                          batch->each ) );
+  }
+  else if ( batch->stream ) {
+    return ( open_apr_output_file( mp, out_file, &out_fp ) &&
+             ( writer = json_text_writer_create_to_file( mp, out_fp,
+                                                         batch->indent ) ) &&
+             xml2json_convert_stream( x, xml_fp, !batch->preserve_root,
+                                      writer, batch->array_elements,
+                                      batch->lookahead ) );
+  }
+  else if ( xml2json_convert( x, mp, xml_fp, !batch->preserve_root, &json ) &&
+            open_apr_output_file( mp, out_file, &out_fp ) ) {
+    return json_dump_threaded( out_fp, json, batch->indent, batch->threads );
+  }
+
+  return FALSE;
+}
+
+static void batch_convert_files( batch_worker_t *worker )
+{
+  batch_t *batch = worker->batch;
+  apr_pool_t *file_mp;
+  xml2json_t *x;
+  apr_uint32_t i;
+  const char *xml_file;
+
+  if ( ( x = xml2json_create( worker->mp ) ) ) {
+    xml2json_set_filter( x, batch->filter );
+  }
+  apr_pool_create( &file_mp, worker->mp );
+
+  while ( ( i = apr_atomic_inc32( &batch->next_file ) ) <
+          (apr_uint32_t) batch->inputs->nelts ) {
+    xml_file = APR_ARRAY_IDX( batch->inputs, i, const char * );
+    if ( !x ||
+         !batch_convert( batch, x, file_mp, xml_file,
+                         APR_ARRAY_IDX( batch->outputs, i, const char * ) ) ) {
+      fprintf( stderr, "failed to convert %s\n", xml_file );
+      apr_atomic_inc32( &batch->failures );
+    }
+    apr_pool_clear( file_mp );
+  }
+}
+
+#if APR_HAS_THREADS
+static void * APR_THREAD_FUNC batch_worker( apr_thread_t *thread,
+                                            void *data )
+{
+  batch_convert_files( (batch_worker_t *) data );
+  apr_thread_exit( thread, APR_SUCCESS );
+  return NULL;
+}
+#endif
+
+/**
+ * Convert every input on jobs threads, the caller being one of them.
+ * @return The number of files that could not be converted.
+ */
+static int batch_run( apr_pool_t *mp, batch_t *batch, int jobs )
+{
+  batch_worker_t *workers;
+  int i;
+#if APR_HAS_THREADS
+  apr_thread_t **threads;
+  apr_status_t thread_status;
+#endif
+
+  if ( jobs < 1 ) {
+    jobs = 1;
+  }
+
+  apr_atomic_set32( &batch->next_file, 0 );
+  apr_atomic_set32( &batch->failures, 0 );
+
+  workers = apr_palloc( mp, sizeof(batch_worker_t) * jobs );
+  for ( i = 0; i < jobs; i++ ) {
+    workers[i].batch = batch;
+    apr_pool_create( &workers[i].mp, mp );
+  }
+
+#if APR_HAS_THREADS
+  threads = apr_pcalloc( mp, sizeof(apr_thread_t *) * jobs );
+  for ( i = 1; i < jobs; i++ ) {
+    if ( apr_thread_create( &threads[i], NULL, batch_worker, &workers[i],
+                            mp ) != APR_SUCCESS ) {
+      /* The threads that did start pick up its share. */
+      threads[i] = NULL;
+    }
+  }
+#endif
+
+  batch_convert_files( &workers[0] );
+
+#if APR_HAS_THREADS
+  for ( i = 1; i < jobs; i++ ) {
+    if ( threads[i] ) {
+      apr_thread_join( &thread_status, threads[i] );
+    }
+  }
+#endif
+
+  return apr_atomic_read32( &batch->failures );
+}
+
 int main( int argc, char const * const *argv )
 {
   json_t *json;
@@ -70,24 +463,92 @@ int main( int argc, char const * const *argv )
   const char *out_file;
   int preserve_root;
   int indent;
+  int stream;
+  apr_hash_t *array_elements;
+  apr_size_t lookahead;
+  int threads;
+  const char *output_dir;
+  int jobs;
+  apr_array_header_t *args;
+  batch_t batch;
+  int i;
+  xml_filter_t *filter;
+  apr_array_header_t *each;
+  xml2json_t *x;
+  json_text_writer_t *writer;
 
   apr_app_initialize( NULL, NULL, NULL );
   apr_pool_create( &mp, NULL );
 
+  array_elements = apr_hash_make( mp );
+  args = apr_array_make( mp, 16, sizeof(const char *) );
   xml2json_init( argc, argv, mp, &xml_file, &out_file, &preserve_root,
-                 &indent );
+                 &indent, &stream, array_elements, &lookahead, &threads,
+                 &output_dir, &jobs, &filter, &each, args );
+
+  if ( output_dir ) {
+    batch.inputs = apr_array_make( mp, args->nelts,
+                                   sizeof(const char *) );
+    batch.output_dir = output_dir;
+    batch.preserve_root = preserve_root;
+    batch.indent = indent;
+    batch.stream = stream;
+    batch.array_elements = array_elements;
+    batch.lookahead = lookahead;
+    batch.threads = threads;
+    batch.filter = filter;
+    batch.each = each;
 
-  if ( open_apr_input_file( mp, xml_file, &xml_fp ) &&
-       open_apr_output_file( mp, out_file, &out_fp ) &&
-       xml_to_json( mp, xml_fp, !preserve_root, &json ) ) {
-    json_dump( out_fp, json, indent );
     ret = 0;
+    for ( i = 0; i < args->nelts; i++ ) {
+      if ( !add_input( mp, APR_ARRAY_IDX( args, i, const char * ),
+                       batch.inputs ) ) {
+        ret = 1;
+      }
+    }
+    /* Nothing is converted if any outputs would collide. */
+    if ( !batch_name_outputs( mp, &batch ) ||
+         batch_run( mp, &batch, jobs ) > 0 ) {
+      ret = 1;
+    }
+  }
+  else if ( !( open_apr_input_file( mp, xml_file, &xml_fp ) &&
+          open_apr_output_file( mp, out_file, &out_fp ) ) ) {
+    ret = 1;
+  }
+  else if ( each ) {
+    ret = !( ( x = xml2json_create( mp ) ) &&
+             write_lines( x, mp, xml_fp, out_fp, !preserve_root, each ) );
+  }
+  else if ( stream && filter ) {
+    writer = json_text_writer_create_to_file( mp, out_fp, indent );
+    if ( ( x = xml2json_create( mp ) ) ) {
+      xml2json_set_filter( x, filter );
+    }
+    ret = ( !x || !xml2json_convert_stream( x, xml_fp, !preserve_root,
+                                            writer, array_elements,
+                                            lookahead ) );
+  }
+  else if ( stream ) {
+    writer = json_text_writer_create_to_file( mp, out_fp, indent );
+    ret = !xml_to_json_stream( xml_fp, !preserve_root, writer,
+                               array_elements, lookahead );
+  }
+  else if ( ( filter ) ?
+            xml_to_json_filtered( mp, xml_fp, !preserve_root, filter,
+                                  &json ) :
+            xml_to_json_threaded( mp, xml_fp, !preserve_root, &json,
+                                  threads ) ) {
+    ret = !json_dump_threaded( out_fp, json, indent, threads );
   }
   else {
-    fprintf( stderr, "failed to convert\n" );
     ret = 1;
   }
 
+  if ( ret && !output_dir ) {
+    fprintf( stderr, "failed to convert\n" );
+  }
+
   apr_pool_destroy( mp );
   apr_terminate();
 
@@ -0,0 +1,147 @@
+/*
+ * json_compare.c
+ *
+ * Description
+ *  Compare two JSON files by value.  The properties of an object may be in
+ *  any order.  This program will exit with status 0 if the files have the
+ *  same value and 1 if they differ or can't be read.
+ *
+ * Copyright 2017 Dan Rinehimer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <apr_general.h>
+#include <apr_hash.h>
+#include <apr_tables.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apr_macros.h"
+#include "json.h"
+#include "parser.h"
+#include "misc.h"
+
+/**
+ * Return TRUE if two trees have the same value.
+ */
+static int json_equal( json_t *a, json_t *b )
+{
+  apr_hash_index_t *idx;
+  json_t *a_value;
+  json_t *b_value;
+  int i;
+
+  if ( a->type != b->type ) {
+    return FALSE;
+  }
+
+  switch ( a->type ) {
+  case JSON_STRING:
+    return ( ( a->len == b->len ) &&
+             ( memcmp( JSON_STRING_VALUE( a ), JSON_STRING_VALUE( b ),
+                       a->len ) == 0 ) );
+  case JSON_INTEGER:
+    return ( a->value.integer == b->value.integer );
+  case JSON_NUMBER:
+    return ( a->value.number == b->value.number );
+  case JSON_BOOLEAN:
+    return ( a->value.boolean == b->value.boolean );
+  case JSON_NULL:
+    return TRUE;
+  case JSON_ARRAY:
+    if ( a->value.array->nelts != b->value.array->nelts ) {
+      return FALSE;
+    }
+    for ( i = 0; i < a->value.array->nelts; i++ ) {
+      if ( !json_equal( APR_ARRAY_IDX( a->value.array, i, json_t * ),
+                        APR_ARRAY_IDX( b->value.array, i, json_t * ) ) ) {
+        return FALSE;
+      }
+    }
+    return TRUE;
+  case JSON_OBJECT:
+    if ( apr_hash_count( a->value.object ) !=
+         apr_hash_count( b->value.object ) ) {
+      return FALSE;
+    }
+    for ( idx = apr_hash_first( NULL, a->value.object ); idx;
+          idx = apr_hash_next( idx ) ) {
+      apr_hash_this( idx, NULL, NULL, (void **) &a_value );
+      b_value = apr_hash_get( b->value.object, a_value->name,
+                              APR_HASH_KEY_STRING );
+      if ( !b_value || !json_equal( a_value, b_value ) ) {
+        return FALSE;
+      }
+    }
+    return TRUE;
+  }
+
+  return FALSE;
+}
+
+/**
+ * Parse a JSON file into a tree.
+ */
+static int read_json( apr_pool_t *mp, parser_t *parser, const char *path,
+                      json_t **json )
+{
+  apr_file_t *file;
+
+  if ( !open_apr_input_file( mp, path, &file ) ) {
+    return FALSE;
+  }
+
+  return json_parser_parse_file_to_obj( mp, parser, file, json );
+}
+
+int main( int argc, char const * const *argv )
+{
+  apr_pool_t *mp;
+  parser_t *json_parser;
+  json_t *a;
+  json_t *b;
+  int status;
+
+  if ( argc != 3 ) {
+    fprintf( stderr, "usage: %s file1.json file2.json\n", argv[0] );
+    return 1;
+  }
+
+  apr_app_initialize( NULL, NULL, NULL );
+  apr_pool_create( &mp, NULL );
+
+  json_parser = json_parser_create( mp );
+
+  if ( !read_json( mp, json_parser, argv[1], &a ) ) {
+    fprintf( stderr, "failed to read %s\n", argv[1] );
+    status = 1;
+  }
+  else if ( !read_json( mp, json_parser, argv[2], &b ) ) {
+    fprintf( stderr, "failed to read %s\n", argv[2] );
+    status = 1;
+  }
+  else if ( !json_equal( a, b ) ) {
+    fprintf( stderr, "%s and %s differ\n", argv[1], argv[2] );
+    status = 1;
+  }
+  else {
+    status = 0;
+  }
+
+  apr_pool_destroy( mp );
+  apr_terminate();
+
+  return status;
+}
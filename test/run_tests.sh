@@ -17,15 +17,222 @@ run_test() {
     rm $dir/test.output
 }
 
-rm -f t.json
+run_failing_test() {
+    local dir=$1
+    local args=$2
+    $jxtl $args -t $dir/input > $dir/test.output 2> /dev/null
+    if [ $? -eq 0 ] ; then
+        echo "jxtl with args $args should have failed in $dir"
+        exit 1
+    fi
+    rm $dir/test.output
+}
+
+rm -f t.json t_stream.json
 $xml2json < t.xml > t.json
 check_status "failed to convert test XML to JSON"
+$xml2json -s < t.xml > t_stream.json
+check_status "failed to stream test XML to JSON"
+
+# Options that take a number reject anything that isn't one, or is out of
+# range.
+for args in "-s -l 12x -x t.xml" "-s -l -1 -x t.xml" "-s -l +5 -x t.xml" \
+    "-s -l '' -x t.xml" "-d . -j 0 t.xml" "-d . -j -2 t.xml" \
+    "-d . -j 2x t.xml" "-t 0 -x t.xml" "-t -4 -x t.xml" "-t 4x -x t.xml" ; do
+    eval $xml2json $args > /dev/null 2>&1
+    if [ $? -eq 0 ] ; then
+        echo "xml2json should have rejected $args"
+        exit 1
+    fi
+done
+
+# The properties of an object are written in the order of its hash table,
+# which can change from run to run, so converted JSON is compared by value.
+# test_dump checks that dumps on several threads give the same text.
+compare_xml2json() {
+    local args=$1
+    local file=$2
+    local expected=$3
+    $xml2json $args > $file
+    check_status "xml2json with args $args had bad exit status"
+    $json_compare $expected $file
+    check_status "xml2json with args $args gave different output"
+    rm $file
+}
+
+# An array and an object with enough values to be split up when they are
+# written on several threads.  The file is also large enough, with enough
+# elements under its root, to be split up when it is converted with -t.
+rm -f t_large.xml t_large.json
+awk 'BEGIN {
+    print "<large>"
+    for ( i = 0; i < 20000; i++ )
+        printf "<item id=\"%d\"><name>item %d</name><tag>a</tag>" \
+               "<tag>b</tag></item>\n", i, i
+    printf "<map>"
+    for ( i = 0; i < 2000; i++ )
+        printf "<k%d>%d</k%d>", i, i, i
+    print "</map>\n</large>"
+}' > t_large.xml
+$xml2json -t 1 -x t_large.xml > t_large.json
+check_status "failed to convert large XML to JSON"
+compare_xml2json "-t 4 -x t_large.xml" t_large_test.json t_large.json
+$xml2json -i -t 1 -x t_large.xml > t_large_indent.json
+check_status "failed to convert large XML to indented JSON"
+compare_xml2json "-i -t 4 -x t_large.xml" t_large_test.json \
+    t_large_indent.json
+compare_xml2json "-t 3 -x t_large.xml" t_large_test.json t_large.json
+$xml2json -p -t 1 -x t_large.xml > t_large_root.json
+check_status "failed to convert large XML to JSON with its root"
+compare_xml2json "-p -t 4 -x t_large.xml" t_large_test.json t_large_root.json
+rm t_large_indent.json t_large_root.json
+
+# A directory of files converted on several jobs gives the same JSON as
+# the files converted one at a time.  A file that can't be converted makes
+# the batch fail without keeping the others from being converted.
+rm -rf t_batch t_batch_out
+mkdir t_batch t_batch_out
+cp t.xml t_large.xml t_batch
+$xml2json -d t_batch_out -j 2 t_batch
+check_status "failed to convert a batch of XML files"
+$json_compare t.json t_batch_out/t.json && \
+    $json_compare t_large.json t_batch_out/t_large.json
+check_status "batch conversion gave different output"
+$xml2json -s -d t_batch_out -j 2 t_batch/t.xml
+check_status "failed to stream a batch of XML files"
+cmp -s t_stream.json t_batch_out/t.json
+check_status "batch streaming gave different output"
+sed -n '1,30p' t.xml > t_batch/broken.xml
+rm -f t_batch_out/*
+$xml2json -d t_batch_out -j 2 t_batch 2> /dev/null
+if [ $? -eq 0 ] ; then
+    echo "batch conversion with a broken XML file should have failed"
+    exit 1
+fi
+$json_compare t.json t_batch_out/t.json && \
+    $json_compare t_large.json t_batch_out/t_large.json
+check_status "batch conversion with a broken XML file gave different output"
+# Inputs that would be written to the same file fail the batch before any
+# of them are converted.
+mkdir t_batch/sub
+cp t.xml t_batch/sub
+rm -f t_batch_out/*
+$xml2json -d t_batch_out -j 2 t_batch t_batch/sub 2> /dev/null
+if [ $? -eq 0 ] || [ -n "`ls t_batch_out`" ] ; then
+    echo "batch conversion with colliding outputs should have failed"
+    exit 1
+fi
+rm -rf t_batch t_batch_out
+
+# Compare two files of JSON, one value per line.  The last line may not end
+# in a newline.
+compare_json_lines() {
+    local expected=$1
+    local file=$2
+    local line
+    local i=0
+    if [ `grep -c '' $expected` -ne `grep -c '' $file` ] ; then
+        return 1
+    fi
+    while read -r line || [ -n "$line" ] ; do
+        i=$((i + 1))
+        echo "$line" > line_expected.json
+        sed -n "${i}p" $file > line_test.json
+        $json_compare line_expected.json line_test.json || return 1
+    done < $expected
+    rm -f line_expected.json line_test.json
+}
+
+# Directories with an args file hold the arguments to convert t.xml with and
+# the JSON that should give.
+for dir in `find . -mindepth 1 -type d` ; do
+    if [ -f $dir/args ] ; then
+        read -r -a args < $dir/args
+        $xml2json "${args[@]}" -x t.xml > $dir/test.output
+        check_status "xml2json with args ${args[*]} had bad exit status"
+        compare_json_lines $dir/output $dir/test.output
+        check_status "Failed test in $dir"
+        rm $dir/test.output
+    fi
+done
+
+# Lines written for a batch are the same as the lines for one file.
+rm -rf t_batch
+mkdir t_batch
+cp t.xml t_batch/a.xml
+cp t.xml t_batch/b.xml
+read -r -a args < e2/args
+$xml2json "${args[@]}" -d t_batch -j 2 t_batch
+check_status "failed to write lines for a batch"
+compare_json_lines e2/output t_batch/a.json && \
+    compare_json_lines e2/output t_batch/b.json
+check_status "lines written for a batch were different"
+rm -rf t_batch
 
 for dir in `find . -mindepth 1 -type d` ; do
     if [ -f $dir/input ] ; then
         run_test $dir "-s -x t.xml"
         run_test $dir "-j t.json"
+        run_test $dir "-S -j t.json"
+        run_test $dir "-C -s -x t.xml"
+        run_test $dir "-H -j t.json"
+        run_test $dir "-r -j t.json"
+        run_test $dir "-m t.schema.json -s -x t.xml"
+        run_test $dir "-m t.schema.json -j t.json"
+        run_test $dir "-j t_stream.json"
+        run_test $dir "-R -s -x t.xml"
     fi
 done
 
+# Strings long enough to be kept compressed with -z print the same as when
+# they aren't compressed, on their own and through format callbacks.
+rm -f t_long.json t_long.tmpl t_long.output
+awk 'BEGIN {
+    printf "{\"title\":\""
+    for ( i = 0; i < 20; i++ )
+        printf "title %d, ", i
+    printf "\",\"texts\":["
+    for ( i = 0; i < 200; i++ ) {
+        printf "%s{\"n\":%d,\"text\":\"", ( i ) ? "," : "", i
+        for ( j = 0; j < 10 + i % 20; j++ )
+            printf "Text %d/%d \\\"quoted\\\" ", i, j
+        printf "\"}"
+    }
+    print "]}"
+}' > t_long.json
+cat > t_long.tmpl <<'EOF'
+{{title}}
+{{#section texts ; separator="\n"}}
+{{n}} {{text}}|{{text ; format="upper"}}|{{text ; format="json"}}
+{{#end}}
+EOF
+$jxtl -j t_long.json -t t_long.tmpl > t_long.output
+check_status "failed to expand a template with long strings"
+for args in "-z 64" "-z 100" "-z 64 -C" "-z 64 -S" ; do
+    $jxtl $args -j t_long.json -t t_long.tmpl > t_long_test.output
+    check_status "jxtl with args $args had bad exit status"
+    cmp -s t_long.output t_long_test.output
+    check_status "jxtl with args $args gave different output"
+done
+for args in "-z 0" "-z 63" "-z 64x" "-z -100" "-z ''" ; do
+    eval $jxtl $args -j t_long.json -t t_long.tmpl > /dev/null 2>&1
+    if [ $? -eq 0 ] ; then
+        echo "jxtl should have rejected $args"
+        exit 1
+    fi
+done
+rm t_long.json t_long.tmpl t_long.output t_long_test.output
+
+# XML that ends in the middle of the records fails whether or not the
+# records are expanded while it is read.
+rm -f t_broken.xml
+sed -n '1,30p' t.xml > t_broken.xml
+run_failing_test t11 "-R -s -x t_broken.xml"
+$jxtl -s -x t_broken.xml -t t11/input > t11/test.output 2> /dev/null
+if [ $? -eq 0 ] || [ -s t11/test.output ] ; then
+    echo "jxtl should have failed without output for broken XML"
+    exit 1
+fi
+rm t11/test.output
+
 exit 0
@@ -0,0 +1,296 @@
+/*
+ * test_data_cache.c
+ *
+ * Description
+ *  Check that the data cache reuses dictionaries while their files don't
+ *  change, reloads them when they do, drops the least recently used ones to
+ *  stay within its budget and never keeps a file that failed to load.  This
+ *  program will exit with status 0 if every check passes and 1 otherwise.
+ *
+ * Copyright 2017 Dan Rinehimer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <apr_general.h>
+#include <apr_file_info.h>
+#include <apr_file_io.h>
+#include <apr_hash.h>
+#include <apr_time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apr_macros.h"
+#include "json.h"
+#include "json_doc.h"
+#include "jxtl_data_cache.h"
+
+static int status = 0;
+
+static void check( int ok, const char *what )
+{
+  if ( !ok ) {
+    fprintf( stderr, "data cache check failed: %s\n", what );
+    status = 1;
+  }
+}
+
+static void write_file( apr_pool_t *mp, const char *path, const char *text )
+{
+  apr_file_t *file;
+
+  if ( apr_file_open( &file, path, APR_WRITE | APR_CREATE | APR_TRUNCATE,
+                      APR_OS_DEFAULT, mp ) != APR_SUCCESS ) {
+    fprintf( stderr, "failed to write %s\n", path );
+    exit( EXIT_FAILURE );
+  }
+  apr_file_write_full( file, text, strlen( text ), NULL );
+  apr_file_close( file );
+}
+
+static apr_time_t file_mtime( apr_pool_t *mp, const char *path )
+{
+  apr_finfo_t finfo;
+
+  apr_stat( &finfo, path, APR_FINFO_MTIME, mp );
+
+  return finfo.mtime;
+}
+
+/**
+ * Rewrite a file and give it a modification time.
+ */
+static void rewrite_file( apr_pool_t *mp, const char *path, const char *text,
+                          apr_time_t mtime )
+{
+  write_file( mp, path, text );
+  apr_file_mtime_set( path, mtime, mp );
+}
+
+/**
+ * The integer value of a property of a document's root object, or -1.
+ */
+static int doc_value( json_doc_t *doc, const char *name )
+{
+  json_t *json;
+
+  if ( !doc || !JSON_IS_OBJECT( JSON_DOC_ROOT( doc ) ) )
+    return -1;
+
+  json = apr_hash_get( JSON_DOC_ROOT( doc )->value.object, name,
+                       APR_HASH_KEY_STRING );
+
+  return ( json && JSON_IS_INTEGER( json ) ) ? json->value.integer : -1;
+}
+
+/**
+ * A document is reused until its file changes size or modification time.
+ */
+static void check_changes( apr_pool_t *mp )
+{
+  jxtl_data_cache_t *cache = jxtl_data_cache_create( mp, 0, 0 );
+  const char *path = "test_cache_a.json";
+  json_doc_t *first;
+  json_doc_t *hit;
+  json_doc_t *resized;
+  json_doc_t *touched;
+  json_doc_t *unchanged;
+  apr_time_t mtime;
+
+  write_file( mp, path, "{\"a\":1}" );
+  first = jxtl_data_cache_get_json( cache, path );
+  hit = jxtl_data_cache_get_json( cache, path );
+  check( first && first == hit, "an unchanged file is a hit" );
+  check( doc_value( first, "a" ) == 1, "the first load has the file" );
+
+  mtime = file_mtime( mp, path );
+  rewrite_file( mp, path, "{\"a\":22}", mtime );
+  resized = jxtl_data_cache_get_json( cache, path );
+  check( resized && resized != first && doc_value( resized, "a" ) == 22,
+         "a file that changed size is reloaded" );
+
+  rewrite_file( mp, path, "{\"a\":33}", mtime + apr_time_from_sec( 10 ) );
+  touched = jxtl_data_cache_get_json( cache, path );
+  check( touched && touched != resized && doc_value( touched, "a" ) == 33,
+         "a file that changed modification time is reloaded" );
+
+  /* Without JXTL_DATA_CACHE_HASH only the size and time are compared. */
+  rewrite_file( mp, path, "{\"a\":44}", mtime + apr_time_from_sec( 10 ) );
+  unchanged = jxtl_data_cache_get_json( cache, path );
+  check( unchanged == touched, "only the size and time are compared" );
+
+  json_doc_release( first );
+  json_doc_release( hit );
+  json_doc_release( resized );
+  json_doc_release( touched );
+  json_doc_release( unchanged );
+  apr_file_remove( path, mp );
+}
+
+/**
+ * With JXTL_DATA_CACHE_HASH a file that is rewritten with the same size and
+ * modification time is reloaded.
+ */
+static void check_hash( apr_pool_t *mp )
+{
+  jxtl_data_cache_t *cache = jxtl_data_cache_create( mp, 0,
+                                                     JXTL_DATA_CACHE_HASH );
+  const char *path = "test_cache_h.json";
+  json_doc_t *first;
+  json_doc_t *hit;
+  json_doc_t *rewritten;
+  json_t *h;
+  apr_time_t mtime;
+
+  write_file( mp, path, "{\"h\":1}" );
+  mtime = file_mtime( mp, path );
+  first = jxtl_data_cache_get_json( cache, path );
+  hit = jxtl_data_cache_get_json( cache, path );
+  check( first && first == hit, "an unchanged file is a hit with a hash" );
+
+  rewrite_file( mp, path, "{\"h\":2}", mtime );
+  rewritten = jxtl_data_cache_get_json( cache, path );
+  check( rewritten && rewritten != first && doc_value( rewritten, "h" ) == 2,
+         "a file with new contents is reloaded with a hash" );
+
+  json_doc_release( first );
+  json_doc_release( hit );
+  json_doc_release( rewritten );
+  apr_file_remove( path, mp );
+
+  /* XML is converted from the same text that is hashed. */
+  path = "test_cache_h.xml";
+  write_file( mp, path, "<a><h>1</h></a>" );
+  mtime = file_mtime( mp, path );
+  first = jxtl_data_cache_get_xml( cache, path, TRUE );
+  hit = jxtl_data_cache_get_xml( cache, path, TRUE );
+  check( first && first == hit, "unchanged XML is a hit with a hash" );
+
+  rewrite_file( mp, path, "<a><h>2</h></a>", mtime );
+  rewritten = jxtl_data_cache_get_xml( cache, path, TRUE );
+  h = ( rewritten && JSON_IS_OBJECT( JSON_DOC_ROOT( rewritten ) ) ) ?
+      apr_hash_get( JSON_DOC_ROOT( rewritten )->value.object, "h",
+                    APR_HASH_KEY_STRING ) : NULL;
+  check( rewritten != first && h && JSON_IS_STRING( h ) &&
+         strcmp( (const char *) JSON_STRING_VALUE( h ), "2" ) == 0,
+         "XML with new contents is reloaded with a hash" );
+
+  if ( first )
+    json_doc_release( first );
+  if ( hit )
+    json_doc_release( hit );
+  if ( rewritten )
+    json_doc_release( rewritten );
+  apr_file_remove( path, mp );
+}
+
+/**
+ * Loading a file past the budget drops the least recently used ones, and a
+ * file bigger than the whole budget isn't kept.
+ */
+static void check_budget( apr_pool_t *mp )
+{
+  /* Each file is 7 bytes, so two of them fit. */
+  jxtl_data_cache_t *cache = jxtl_data_cache_create( mp, 14, 0 );
+  json_doc_t *b;
+  json_doc_t *c;
+  json_doc_t *d;
+  json_doc_t *b_again;
+  json_doc_t *c_again;
+  json_doc_t *big;
+  json_doc_t *big_again;
+
+  write_file( mp, "test_cache_b.json", "{\"b\":1}" );
+  write_file( mp, "test_cache_c.json", "{\"c\":1}" );
+  write_file( mp, "test_cache_d.json", "{\"d\":1}" );
+  write_file( mp, "test_cache_big.json", "{\"big\":12345678}" );
+
+  b = jxtl_data_cache_get_json( cache, "test_cache_b.json" );
+  c = jxtl_data_cache_get_json( cache, "test_cache_c.json" );
+  json_doc_release( jxtl_data_cache_get_json( cache, "test_cache_b.json" ) );
+  d = jxtl_data_cache_get_json( cache, "test_cache_d.json" );
+  check( cache->used <= cache->budget, "the budget is kept" );
+
+  b_again = jxtl_data_cache_get_json( cache, "test_cache_b.json" );
+  check( b_again == b, "a recently used file is kept" );
+  c_again = jxtl_data_cache_get_json( cache, "test_cache_c.json" );
+  check( c_again && c_again != c && doc_value( c_again, "c" ) == 1,
+         "the least recently used file is dropped" );
+  check( cache->used <= cache->budget, "the budget is kept after a reload" );
+
+  big = jxtl_data_cache_get_json( cache, "test_cache_big.json" );
+  big_again = jxtl_data_cache_get_json( cache, "test_cache_big.json" );
+  check( big && big_again && big != big_again,
+         "a file bigger than the budget isn't kept" );
+
+  json_doc_release( b );
+  json_doc_release( c );
+  json_doc_release( d );
+  json_doc_release( b_again );
+  json_doc_release( c_again );
+  json_doc_release( big );
+  json_doc_release( big_again );
+  apr_file_remove( "test_cache_b.json", mp );
+  apr_file_remove( "test_cache_c.json", mp );
+  apr_file_remove( "test_cache_d.json", mp );
+  apr_file_remove( "test_cache_big.json", mp );
+}
+
+/**
+ * A file that fails to load part way gives no document and isn't kept.
+ */
+static void check_broken( apr_pool_t *mp )
+{
+  jxtl_data_cache_t *cache = jxtl_data_cache_create( mp, 0, 0 );
+  json_doc_t *doc;
+
+  write_file( mp, "test_cache_broken.xml", "<a><b>1</b><c>" );
+  check( !jxtl_data_cache_get_xml( cache, "test_cache_broken.xml", TRUE ),
+         "broken XML gives no document" );
+  write_file( mp, "test_cache_broken.json", "{\"a\":1,\"b\":" );
+  check( !jxtl_data_cache_get_json( cache, "test_cache_broken.json" ),
+         "broken JSON gives no document" );
+  check( cache->head == NULL && cache->used == 0,
+         "broken files aren't kept" );
+
+  write_file( mp, "test_cache_broken.xml", "<a><b>1</b><c>2</c></a>" );
+  doc = jxtl_data_cache_get_xml( cache, "test_cache_broken.xml", TRUE );
+  check( doc && JSON_IS_OBJECT( JSON_DOC_ROOT( doc ) ) &&
+         apr_hash_get( JSON_DOC_ROOT( doc )->value.object, "c",
+                       APR_HASH_KEY_STRING ),
+         "fixed XML is loaded" );
+
+  if ( doc )
+    json_doc_release( doc );
+  apr_file_remove( "test_cache_broken.xml", mp );
+  apr_file_remove( "test_cache_broken.json", mp );
+}
+
+int main( int argc, char const * const *argv )
+{
+  apr_pool_t *mp;
+
+  apr_app_initialize( NULL, NULL, NULL );
+  apr_pool_create( &mp, NULL );
+
+  check_changes( mp );
+  check_hash( mp );
+  check_budget( mp );
+  check_broken( mp );
+
+  apr_pool_destroy( mp );
+  apr_terminate();
+
+  return status;
+}
@@ -0,0 +1,289 @@
+/*
+ * test_dump.c
+ *
+ * Description
+ *  Check that a JSON tree dumped on several threads gives the same text as
+ *  the tree dumped on one.  Objects are dumped in the order of their hash
+ *  tables, so the dumps are compared within one process.  A string that
+ *  can't be decompressed has to fail the dump.  This program will exit with
+ *  status 0 if every check passes and 1 otherwise.
+ *
+ * Copyright 2017 Dan Rinehimer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <apr_general.h>
+#include <apr_file_io.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apr_macros.h"
+#include "json.h"
+#include "json_compress.h"
+#include "parser.h"
+#include "str_buf.h"
+
+#define DUMP_FILE "test_dump.output"
+
+/**
+ * Build the text of a document with arrays and objects large enough to be
+ * split into chunks, nested inside each other.
+ */
+static char *large_document( apr_pool_t *mp )
+{
+  str_buf_t *buf = str_buf_create( mp, 1024 );
+  int i;
+
+  str_buf_append( buf, "{\"items\":[" );
+  for ( i = 0; i < 20000; i++ ) {
+    str_buf_printf( buf, "%s{\"id\":%d,\"name\":\"item \\\"%d\\\"\","
+                    "\"price\":%d.5,\"tags\":[\"a\",\"b\"],\"flag\":%s,"
+                    "\"none\":null}", ( i ) ? "," : "", i, i, i,
+                    ( i % 2 ) ? "true" : "false" );
+  }
+  str_buf_append( buf, "],\"map\":{" );
+  for ( i = 0; i < 3000; i++ ) {
+    str_buf_printf( buf, "%s\"k%d\":[%d,\"v%d\"]", ( i ) ? "," : "", i, i,
+                    i );
+  }
+  str_buf_append( buf, "},\"nested\":[" );
+  for ( i = 0; i < 4; i++ ) {
+    int j;
+    str_buf_printf( buf, "%s[", ( i ) ? "," : "" );
+    for ( j = 0; j < 2000; j++ ) {
+      str_buf_printf( buf, "%s%d", ( j ) ? "," : "", i * j );
+    }
+    str_buf_putc( buf, ']' );
+  }
+  str_buf_append( buf, "]}" );
+  str_buf_putc( buf, '\0' );
+
+  return buf->data;
+}
+
+/**
+ * Build the text of an array of long strings, with no objects so that it
+ * dumps the same way however many times it is parsed.
+ */
+static char *long_strings( apr_pool_t *mp )
+{
+  str_buf_t *buf = str_buf_create( mp, 1024 );
+  int i;
+  int j;
+
+  str_buf_putc( buf, '[' );
+  for ( i = 0; i < 2000; i++ ) {
+    str_buf_append( buf, ( i ) ? ",\"" : "\"" );
+    for ( j = 0; j < 10 + i % 20; j++ ) {
+      str_buf_printf( buf, "text %d/%d \\\"quoted\\\"\\n", i, j );
+    }
+    str_buf_putc( buf, '"' );
+  }
+  str_buf_append( buf, "]" );
+  str_buf_putc( buf, '\0' );
+
+  return buf->data;
+}
+
+/**
+ * Dump json to a file with the given number of threads and read it back.
+ */
+static char *dump_threaded( apr_pool_t *mp, json_t *json, int indent,
+                            int threads, apr_size_t *len )
+{
+  apr_file_t *file;
+  apr_finfo_t finfo;
+  apr_off_t offset = 0;
+  char *text = NULL;
+
+  if ( apr_file_open( &file, DUMP_FILE, APR_READ | APR_WRITE | APR_CREATE |
+                      APR_TRUNCATE, APR_OS_DEFAULT, mp ) != APR_SUCCESS ) {
+    return NULL;
+  }
+
+  json_dump_threaded( file, json, indent, threads );
+
+  if ( ( apr_file_flush( file ) == APR_SUCCESS ) &&
+       ( apr_file_info_get( &finfo, APR_FINFO_SIZE, file ) == APR_SUCCESS ) &&
+       ( apr_file_seek( file, APR_SET, &offset ) == APR_SUCCESS ) ) {
+    *len = (apr_size_t) finfo.size;
+    text = apr_palloc( mp, *len + 1 );
+    if ( apr_file_read_full( file, text, *len, NULL ) != APR_SUCCESS ) {
+      text = NULL;
+    }
+  }
+
+  apr_file_close( file );
+
+  return text;
+}
+
+/**
+ * Strings kept compressed dump the same as strings that aren't.
+ */
+static int check_compressed( apr_pool_t *mp )
+{
+  apr_pool_t *compress_mp;
+  parser_t *json_parser = json_parser_create( mp );
+  char *text = long_strings( mp );
+  json_t *plain;
+  json_t *compressed;
+  char *expected;
+  char *dumped;
+  apr_size_t expected_len;
+  apr_size_t len;
+  int indent;
+  int ok = TRUE;
+
+  apr_pool_create( &compress_mp, mp );
+  json_compress_attach( JSON_COMPRESS_MIN_SIZE, compress_mp );
+
+  if ( !json_parser_parse_buffer_to_obj( mp, json_parser, text, &plain ) ||
+       !json_parser_parse_buffer_to_obj( compress_mp, json_parser, text,
+                                         &compressed ) ) {
+    fprintf( stderr, "failed to parse the long strings\n" );
+    return FALSE;
+  }
+
+  for ( indent = 0; ok && indent <= 2; indent += 2 ) {
+    expected = json_dump_to_buffer( mp, plain, indent );
+    ok = ( strcmp( json_dump_to_buffer( mp, compressed, indent ),
+                   expected ) == 0 );
+    if ( ok ) {
+      expected = dump_threaded( mp, plain, indent, 1, &expected_len );
+      dumped = dump_threaded( mp, compressed, indent, 4, &len );
+      ok = ( expected && dumped && len == expected_len &&
+             memcmp( dumped, expected, len ) == 0 );
+    }
+    if ( !ok ) {
+      fprintf( stderr, "compressed strings dump differently with indent %d\n",
+               indent );
+    }
+  }
+
+  return ok;
+}
+
+/**
+ * A compressed string that can't be decompressed fails the dump, on one
+ * thread and on several.
+ */
+static int check_corrupt( apr_pool_t *mp )
+{
+  apr_pool_t *compress_mp;
+  parser_t *json_parser = json_parser_create( mp );
+  json_t *compressed;
+  json_t *json;
+  apr_file_t *file;
+  char *block;
+  int ok = TRUE;
+  int i;
+
+  apr_pool_create( &compress_mp, mp );
+  json_compress_attach( JSON_COMPRESS_MIN_SIZE, compress_mp );
+
+  if ( !json_parser_parse_buffer_to_obj( compress_mp, json_parser,
+                                         long_strings( mp ), &compressed ) ) {
+    fprintf( stderr, "failed to parse the long strings\n" );
+    return FALSE;
+  }
+
+  for ( i = compressed->value.array->nelts - 1; i >= 0; i-- ) {
+    json = APR_ARRAY_IDX( compressed->value.array, i, json_t * );
+    if ( JSON_IS_COMPRESSED_STRING( json ) )
+      break;
+  }
+  if ( i < 0 ) {
+    /* Built without zlib. */
+    return TRUE;
+  }
+
+  /* Spoil the checksum at the end of the block. */
+  block = (char *) json->value.string;
+  block[json_compressed_size( block ) - 1] ^= 0xFF;
+
+  fprintf( stderr, "expecting errors for a corrupt string:\n" );
+  if ( json_dump_to_buffer( mp, compressed, 0 ) ) {
+    fprintf( stderr, "a corrupt string dumped to a buffer\n" );
+    ok = FALSE;
+  }
+  if ( apr_file_open( &file, DUMP_FILE, APR_WRITE | APR_CREATE | APR_TRUNCATE,
+                      APR_OS_DEFAULT, mp ) == APR_SUCCESS ) {
+    if ( json_dump_threaded( file, compressed, 0, 1 ) ||
+         json_dump_threaded( file, compressed, 0, 4 ) ) {
+      fprintf( stderr, "a corrupt string dumped to a file\n" );
+      ok = FALSE;
+    }
+    apr_file_close( file );
+  }
+
+  return ok;
+}
+
+int main( int argc, char const * const *argv )
+{
+  apr_pool_t *mp;
+  parser_t *json_parser;
+  json_t *json;
+  char *expected;
+  apr_size_t expected_len;
+  char *text;
+  apr_size_t len;
+  int indents[] = { 0, 2 };
+  int threads[] = { 2, 3, 4, 7 };
+  int status = 0;
+  int i;
+  int j;
+
+  apr_app_initialize( NULL, NULL, NULL );
+  apr_pool_create( &mp, NULL );
+
+  json_parser = json_parser_create( mp );
+
+  if ( !json_parser_parse_buffer_to_obj( mp, json_parser,
+                                         large_document( mp ), &json ) ) {
+    fprintf( stderr, "failed to parse the test document\n" );
+    status = 1;
+  }
+
+  for ( i = 0; !status && i < sizeof( indents ) / sizeof( indents[0] );
+        i++ ) {
+    expected = dump_threaded( mp, json, indents[i], 1, &expected_len );
+    for ( j = 0; !status && j < sizeof( threads ) / sizeof( threads[0] );
+          j++ ) {
+      text = dump_threaded( mp, json, indents[i], threads[j], &len );
+      if ( !expected || !text || ( len != expected_len ) ||
+           ( memcmp( text, expected, len ) != 0 ) ) {
+        fprintf( stderr, "dump with indent %d on %d threads differs\n",
+                 indents[i], threads[j] );
+        status = 1;
+      }
+    }
+  }
+
+  if ( !status && !check_compressed( mp ) ) {
+    status = 1;
+  }
+
+  if ( !status && !check_corrupt( mp ) ) {
+    status = 1;
+  }
+
+  apr_file_remove( DUMP_FILE, mp );
+  apr_pool_destroy( mp );
+  apr_terminate();
+
+  return status;
+}
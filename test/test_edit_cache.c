@@ -0,0 +1,224 @@
+/*
+ * test_edit_cache.c
+ *
+ * Description
+ *  Check that a template that keeps the output of its sections between
+ *  expansions of an edited tree gives the same output as a template that
+ *  expands the tree from scratch, after each kind of edit, and that the
+ *  cache goes with the template or the edit.  This program will exit with
+ *  status 0 if every check passes and 1 otherwise.
+ *
+ * Copyright 2017 Dan Rinehimer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <apr_general.h>
+#include <apr_hash.h>
+#include <apr_pools.h>
+#include <apr_strings.h>
+#include <apr_tables.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apr_macros.h"
+#include "json.h"
+#include "json_edit.h"
+#include "jxtl.h"
+#include "jxtl_template.h"
+#include "parser.h"
+
+static const char *data =
+  "{\"title\":\"Groups\","
+  " \"groups\":{"
+  "  \"one\":{\"name\":\"one\",\"flag\":true,"
+  "   \"item\":{\"id\":1,\"label\":\"first\"},"
+  "   \"items\":[{\"id\":10,\"label\":\"a\",\"k10\":true},"
+  "            {\"id\":11,\"label\":\"b\",\"k11\":true}]},"
+  "  \"two\":{\"name\":\"two\",\"flag\":false,"
+  "   \"item\":{\"id\":2,\"label\":\"second\"},"
+  "   \"items\":[{\"id\":20,\"label\":\"c\",\"k20\":true}]}}}";
+
+static const char *template_text =
+  "{{title}}\n"
+  "{{#section groups/*}}"
+  "{{name}} {{#if flag}}flagged{{#else}}plain{{#end}}\n"
+  "{{#section item}}  item {{id}} {{label}}\n{{#end}}"
+  "{{#section items}}  - {{id}} {{label}}\n{{#end}}"
+  "{{#end}}";
+
+static int status = 0;
+
+static jxtl_template_t *parse_template( apr_pool_t *mp )
+{
+  parser_t *parser = jxtl_parser_create( mp );
+  jxtl_template_t *template;
+
+  if ( !jxtl_parser_parse_buffer_to_template( mp, parser, template_text,
+                                              &template ) ) {
+    fprintf( stderr, "failed to parse the test template\n" );
+    exit( EXIT_FAILURE );
+  }
+
+  return template;
+}
+
+static json_t *parse_json( apr_pool_t *mp, const char *text )
+{
+  parser_t *parser = json_parser_create( mp );
+  json_t *json;
+
+  if ( !json_parser_parse_buffer_to_obj( mp, parser, text, &json ) ) {
+    fprintf( stderr, "failed to parse %s\n", text );
+    exit( EXIT_FAILURE );
+  }
+
+  return json;
+}
+
+/**
+ * Expand the tree with the cached and the fresh template and compare.
+ */
+static void check_expansion( apr_pool_t *mp, jxtl_template_t *cached,
+                             jxtl_template_t *fresh, json_t *json,
+                             const char *after )
+{
+  char *cached_output = jxtl_template_expand_to_buffer( mp, cached, json );
+  char *fresh_output = jxtl_template_expand_to_buffer( mp, fresh, json );
+
+  if ( strcmp( cached_output, fresh_output ) != 0 ) {
+    fprintf( stderr, "cached output differs after %s:\n%s\nexpected:\n%s\n",
+             after, cached_output, fresh_output );
+    status = 1;
+  }
+}
+
+/**
+ * Parse a value that doesn't have to be an object or an array.
+ */
+static json_t *parse_value( apr_pool_t *mp, const char *text )
+{
+  json_t *array = parse_json( mp, apr_psprintf( mp, "[%s]", text ) );
+
+  return APR_ARRAY_IDX( array->value.array, 0, json_t * );
+}
+
+/**
+ * Find a property of an object.
+ */
+static json_t *property( json_t *json, const char *name )
+{
+  return apr_hash_get( json->value.object, name, APR_HASH_KEY_STRING );
+}
+
+/**
+ * A cache is dropped with whichever of the template and the edit goes
+ * first, leaving nothing behind that the other would use.
+ */
+static void check_lifetimes( apr_pool_t *mp )
+{
+  apr_pool_t *template_mp;
+  apr_pool_t *edit_mp;
+  jxtl_template_t *template;
+  json_t *json;
+  json_edit_t *edit;
+
+  /* The template goes first. */
+  apr_pool_create( &template_mp, mp );
+  apr_pool_create( &edit_mp, mp );
+  json = parse_json( edit_mp, data );
+  edit = json_edit_create( edit_mp, json );
+  template = parse_template( template_mp );
+  jxtl_template_set_edit( template, edit );
+  jxtl_template_expand_to_buffer( mp, template, json );
+  apr_pool_destroy( template_mp );
+  if ( edit->listeners->nelts != 0 ) {
+    fprintf( stderr, "the edit still has a listener after its template "
+             "went\n" );
+    status = 1;
+  }
+  json_edit_remove( edit, "groups/one/items[k10]" );
+  apr_pool_destroy( edit_mp );
+
+  /* The edit goes first. */
+  apr_pool_create( &template_mp, mp );
+  apr_pool_create( &edit_mp, mp );
+  json = parse_json( edit_mp, data );
+  edit = json_edit_create( edit_mp, json );
+  template = parse_template( template_mp );
+  jxtl_template_set_edit( template, edit );
+  jxtl_template_expand_to_buffer( mp, template, json );
+  apr_pool_destroy( edit_mp );
+  if ( template->cache ) {
+    fprintf( stderr, "the template still has a cache after its edit went\n" );
+    status = 1;
+  }
+  apr_pool_destroy( template_mp );
+}
+
+int main( int argc, char const * const *argv )
+{
+  apr_pool_t *mp;
+  apr_pool_t *out_mp;
+  json_t *json;
+  json_t *item;
+  json_edit_t *edit;
+  jxtl_template_t *cached;
+  jxtl_template_t *fresh;
+
+  apr_app_initialize( NULL, NULL, NULL );
+  apr_pool_create( &mp, NULL );
+  apr_pool_create( &out_mp, NULL );
+
+  json = parse_json( mp, data );
+  edit = json_edit_create( mp, json );
+  cached = parse_template( mp );
+  fresh = parse_template( mp );
+  jxtl_template_set_edit( cached, edit );
+
+  check_expansion( out_mp, cached, fresh, json, "the first expansion" );
+  check_expansion( out_mp, cached, fresh, json, "no edits" );
+
+  json_edit_set( edit, "groups/one/items[k11]", "label",
+                 parse_value( mp, "\"changed\"" ) );
+  check_expansion( out_mp, cached, fresh, json, "setting a property" );
+
+  json_edit_insert( edit, "groups/two", "items", 0,
+                    parse_json( mp, "{\"id\":19,\"label\":\"new\"}" ) );
+  check_expansion( out_mp, cached, fresh, json, "inserting an element" );
+
+  json_edit_remove( edit, "groups/one/items[k10]" );
+  check_expansion( out_mp, cached, fresh, json, "removing an element" );
+
+  /* Change an object in place, then set it as the value it already is. */
+  item = property( property( property( json, "groups" ), "one" ), "item" );
+  property( item, "id" )->value.integer = 100;
+  json_edit_set( edit, "groups/one", "item", item );
+  check_expansion( out_mp, cached, fresh, json,
+                   "setting a property to itself" );
+
+  /* Change a value in place and touch it. */
+  item = property( property( property( json, "groups" ), "two" ), "item" );
+  property( item, "id" )->value.integer = 200;
+  json_edit_touch( edit, "groups/two/item/id" );
+  check_expansion( out_mp, cached, fresh, json, "touching a value" );
+
+  check_lifetimes( out_mp );
+
+  apr_pool_destroy( out_mp );
+  apr_pool_destroy( mp );
+  apr_terminate();
+
+  return status;
+}
@@ -0,0 +1,220 @@
+/*
+ * test_xml_map.c
+ *
+ * Description
+ *  Check that converting a regular file gives the whole document when one of
+ *  the windows it is mapped in can't be mapped, and that a broken document
+ *  still fails.  apr_mmap_create and apr_mmap_delete are defined here, in
+ *  place of APR's, to read a window instead of mapping it so that any one of
+ *  them can be made to fail.  This program will exit with status 0 if every
+ *  check passes and 1 otherwise.
+ *
+ * Copyright 2017 Dan Rinehimer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <apr_general.h>
+#include <apr_file_io.h>
+#if APR_HAS_MMAP
+#include <apr_mmap.h>
+#endif
+#include <apr_hash.h>
+#include <apr_strings.h>
+#include <apr_tables.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apr_macros.h"
+#include "json.h"
+#include "str_buf.h"
+#include "xml2json.h"
+
+#define XML_FILE "test_xml_map.xml"
+#define ITEMS 20000
+
+static int status = 0;
+
+#if APR_HAS_MMAP
+/** Which call to apr_mmap_create fails, counting from 1, or 0 for none. */
+static int fail_call = 0;
+static int calls = 0;
+
+apr_status_t apr_mmap_create( apr_mmap_t **new_mmap, apr_file_t *file,
+                              apr_off_t offset, apr_size_t size,
+                              apr_int32_t flag, apr_pool_t *cntxt )
+{
+  apr_mmap_t *mm;
+
+  if ( ++calls == fail_call )
+    return APR_ENOMEM;
+
+  mm = apr_pcalloc( cntxt, sizeof(apr_mmap_t) );
+  mm->cntxt = cntxt;
+  mm->size = size;
+  mm->mm = apr_palloc( cntxt, size );
+  if ( apr_file_seek( file, APR_SET, &offset ) != APR_SUCCESS ||
+       apr_file_read_full( file, mm->mm, size, NULL ) != APR_SUCCESS ) {
+    return APR_EGENERAL;
+  }
+  *new_mmap = mm;
+
+  return APR_SUCCESS;
+}
+
+apr_status_t apr_mmap_delete( apr_mmap_t *mm )
+{
+  return APR_SUCCESS;
+}
+#endif
+
+static void check( int ok, const char *what )
+{
+  if ( !ok ) {
+    fprintf( stderr, "xml map check failed: %s\n", what );
+    status = 1;
+  }
+}
+
+/**
+ * Write a document of ITEMS items, leaving the end off if it is broken.
+ */
+static void write_document( apr_pool_t *mp, int broken )
+{
+  str_buf_t *buf = str_buf_create( mp, 1024 );
+  apr_file_t *file;
+  int i;
+
+  str_buf_append( buf, "<root>" );
+  for ( i = 0; i < ITEMS; i++ ) {
+    str_buf_printf( buf, "<item><id>%d</id><name>item %d</name></item>", i,
+                    i );
+  }
+  if ( !broken ) {
+    str_buf_append( buf, "</root>" );
+  }
+
+  if ( apr_file_open( &file, XML_FILE, APR_WRITE | APR_CREATE | APR_TRUNCATE,
+                      APR_OS_DEFAULT, mp ) != APR_SUCCESS ) {
+    fprintf( stderr, "failed to write %s\n", XML_FILE );
+    exit( EXIT_FAILURE );
+  }
+  apr_file_write_full( file, buf->data, buf->data_len, NULL );
+  apr_file_close( file );
+}
+
+/**
+ * Convert the document with small windows.
+ * @return The status of the conversion.
+ */
+static int convert( apr_pool_t *mp, json_t **json )
+{
+  apr_file_t *file;
+  xml2json_t *x;
+  int converted = FALSE;
+
+  if ( apr_file_open( &file, XML_FILE, APR_READ | APR_BUFFERED,
+                      APR_OS_DEFAULT, mp ) != APR_SUCCESS ) {
+    fprintf( stderr, "failed to open %s\n", XML_FILE );
+    exit( EXIT_FAILURE );
+  }
+
+  if ( ( x = xml2json_create( mp ) ) ) {
+    xml2json_set_read_sizes( x, 4096, XML_TO_JSON_MAP_ALIGN );
+    converted = xml2json_convert( x, mp, file, TRUE, json );
+  }
+  apr_file_close( file );
+
+  return converted;
+}
+
+/**
+ * Whether a tree has every item of the document, in order.
+ */
+static int has_every_item( json_t *json )
+{
+  json_t *items;
+  json_t *item;
+  json_t *id;
+  int i;
+
+  if ( !json || !JSON_IS_OBJECT( json ) )
+    return FALSE;
+
+  items = apr_hash_get( json->value.object, "item", APR_HASH_KEY_STRING );
+  if ( !items || !JSON_IS_ARRAY( items ) ||
+       items->value.array->nelts != ITEMS ) {
+    return FALSE;
+  }
+
+  for ( i = 0; i < ITEMS; i++ ) {
+    item = APR_ARRAY_IDX( items->value.array, i, json_t * );
+    id = ( JSON_IS_OBJECT( item ) ) ?
+         apr_hash_get( item->value.object, "id", APR_HASH_KEY_STRING ) : NULL;
+    if ( !id || !JSON_IS_STRING( id ) ||
+         atoi( (const char *) JSON_STRING_VALUE( id ) ) != i ) {
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+int main( int argc, char const * const *argv )
+{
+  apr_pool_t *mp;
+  apr_pool_t *convert_mp;
+  json_t *json;
+  int windows = 0;
+  int converted;
+  int i;
+
+  apr_app_initialize( NULL, NULL, NULL );
+  apr_pool_create( &mp, NULL );
+  apr_pool_create( &convert_mp, mp );
+
+  write_document( mp, FALSE );
+  converted = convert( convert_mp, &json );
+  check( converted && has_every_item( json ), "a mapped file converts" );
+  apr_pool_clear( convert_mp );
+
+#if APR_HAS_MMAP
+  windows = calls;
+  check( windows > 3, "the file is mapped in several windows" );
+
+  /* Fail the first, a middle and the last window. */
+  for ( i = 1; i <= windows; i += ( windows - 1 ) / 2 ) {
+    calls = 0;
+    fail_call = i;
+    converted = convert( convert_mp, &json );
+    check( converted && has_every_item( json ),
+           apr_psprintf( mp, "window %d of %d failing to map gives the whole "
+                         "document", i, windows ) );
+    apr_pool_clear( convert_mp );
+  }
+
+  write_document( mp, TRUE );
+  calls = 0;
+  fail_call = 2;
+  check( !convert( convert_mp, &json ),
+         "a broken document fails when a window fails to map" );
+  apr_pool_clear( convert_mp );
+#endif
+
+  apr_file_remove( XML_FILE, mp );
+  apr_pool_destroy( mp );
+  apr_terminate();
+
+  return status;
+}